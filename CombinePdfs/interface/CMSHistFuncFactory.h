@@ -1,11 +1,13 @@
 #ifndef CMSHistFuncFactory_h
 #define CMSHistFuncFactory_h
 #include <algorithm>
+#include <memory>
 #include <vector>
 #include "RooWorkspace.h"
 #include "RooHistPdf.h"
 #include "RooBinning.h"
 #include "CombineHarvester/CombineTools/interface/CombineHarvester.h"
+#include "CombineHarvester/CombinePdfs/interface/TemplateCache.h"
 #pragma GCC diagnostic push
 #pragma GCC diagnostic ignored "-Wuninitialized"
 #pragma GCC diagnostic ignored "-Wignored-qualifiers"
@@ -18,21 +20,51 @@
 
 namespace ch {
 
+/**
+ * Builds a CMSHistFunc and normalisation term for each (bin, process) in a
+ * CombineHarvester instance and imports them into a RooWorkspace
+ *
+ * The input templates and yields for each (bin, process) pair are gathered,
+ * converted and normalised in parallel, over up to SetNumThreads() threads.
+ * The RooFit objects are then built and imported into the workspace one pair
+ * at a time, as neither RooWorkspace::import nor the RooFit name registry are
+ * thread-safe.
+ */
 class CMSHistFuncFactory {
 public:
   void Run(CombineHarvester& cb, RooWorkspace& ws, std::map<std::string, std::string> process_vs_norm_postfix_map);
   void Run(CombineHarvester& cb, RooWorkspace& ws);
   void SetHorizontalMorphingVariable(std::map<std::string, RooAbsReal*> &hvar) { mass_var = hvar; }
+  /**
+   * Set the number of threads used to prepare the inputs. The default is 1,
+   * i.e. no worker threads. ch::DefaultNumThreads() gives the number of
+   * hardware threads.
+   */
+  void SetNumThreads(unsigned n_threads) { n_threads_ = n_threads; }
+  /**
+   * Set a cache of converted input templates. By default none is used. Pass
+   * the same cache to several factories (or to ch::BuildRooMorphing) to share
+   * the conversions between them.
+   */
+  void SetTemplateCache(std::shared_ptr<TemplateCache> cache) { cache_ = cache; }
   CMSHistFuncFactory();
 private:
+  // The inputs gathered for a single (bin, process) pair
+  struct ProcInputs;
+
   std::string norm_postfix_ = "norm";
   unsigned v_;
   // RooAbsReal *mass_var;
   std::map<std::string, RooAbsReal*> mass_var;
-  void RunSingleProc(CombineHarvester& cb, RooWorkspace& ws, std::string bin, std::string process);
+  std::unique_ptr<ProcInputs> PrepareSingleProc(CombineHarvester& cb, std::string const& bin, std::string const& process);
+  void BuildSingleProc(CombineHarvester& cb, RooWorkspace& ws, ProcInputs & in);
+  // The TH1F form of an input template, taken from cache_ if there is one
+  std::shared_ptr<TH1F> ConvertTemplate(TH1 const* hist);
   std::map<std::string, RooRealVar> obs_;
   unsigned hist_mode_;
   bool rebin_;
+  unsigned n_threads_;
+  std::shared_ptr<TemplateCache> cache_;
 
   TH1F AsTH1F(TH1 const* hist) {
     TH1F res;
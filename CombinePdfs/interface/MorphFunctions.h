@@ -5,6 +5,7 @@
 #include "RooWorkspace.h"
 #include "RooHistPdf.h"
 #include "CombineHarvester/CombineTools/interface/CombineHarvester.h"
+#include "CombineHarvester/CombinePdfs/interface/TemplateCache.h"
 #pragma GCC diagnostic push
 #pragma GCC diagnostic ignored "-Wuninitialized"
 #pragma GCC diagnostic ignored "-Wignored-qualifiers"
@@ -35,7 +36,8 @@ inline TH1F AsTH1F(TH1 const* hist) {
 std::string BuildRooMorphing(RooWorkspace& ws, CombineHarvester& cb,
                       std::string const& bin, std::string const& process,
                       RooAbsReal& mass_var, std::string norm_postfix,
-                      bool allow_morph, bool verbose, bool force_template_limit=false, TFile * file = nullptr);
+                      bool allow_morph, bool verbose, bool force_template_limit=false, TFile * file = nullptr,
+                      TemplateCache * cache = nullptr);
 
 TGraph GraphFromSpline(RooSpline1D const* spline);
 
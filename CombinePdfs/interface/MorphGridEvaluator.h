@@ -0,0 +1,171 @@
+#ifndef CombinePdfs_MorphGridEvaluator_h
+#define CombinePdfs_MorphGridEvaluator_h
+#include <map>
+#include <string>
+#include <vector>
+#include "boost/multi_array.hpp"
+#include "TH1F.h"
+#include "RooRealVar.h"
+#include "RooWorkspace.h"
+#include "CombineHarvester/CombineTools/interface/CombineHarvester.h"
+#include "CombineHarvester/CombinePdfs/interface/TemplateCache.h"
+
+namespace ch {
+
+/**
+ * Evaluates a mass-morphed template model on plain arrays for many mass
+ * values at once
+ *
+ * Takes the same inputs as ch::BuildRooMorphing, i.e. the templates of a
+ * single (bin, process) at each mass point, and follows the same scheme as
+ * the RooMorphingPdf it builds:
+ *   - At each mass point the nominal template is vertically interpolated
+ *     with the shape systematic templates, using the quadratic-to-linear
+ *     smoothed interpolation of FastVerticalInterpHistPdf2. Negative bins are
+ *     set to zero and the result is normalised to unity.
+ *   - Between mass points the two neighbouring templates are interpolated
+ *     horizontally by linear interpolation of their cumulative distributions
+ *     (as in th1fmorph). If morphing is not allowed the template of the
+ *     closest mass point is used instead. Outside the range of mass points the
+ *     first or last template is used.
+ *   - The result is summed into the binning of the observed data.
+ *   - The yield is linearly interpolated in mass and multiplied by the
+ *     mass-dependent effect of the shape and lnN systematics.
+ *
+ * This avoids setting the mass variable and calling RooAbsReal::getVal for
+ * every bin and mass, so dense mass scans and validation grids are cheap to
+ * compute. Masses are evaluated in parallel if more than one thread is
+ * requested:
+ *
+ *     ch::MorphGridEvaluator eval(cb, "htt_mt_1_8TeV", "ggH");
+ *     eval.SetParameter("CMS_scale_t_mutau_8TeV", 0.5);
+ *     std::vector<double> masses = {90., 90.5, 91.};
+ *     auto shapes = eval.Evaluate(masses, 4);
+ *
+ * Since the interpolation is reimplemented here, Validate() can be used to
+ * check the results against the RooMorphingPdf that ch::BuildRooMorphing
+ * builds from the same inputs.
+ *
+ * \note The CombineHarvester instance is only read in the constructor, it can
+ * be modified or deleted afterwards.
+ */
+class MorphGridEvaluator {
+ public:
+  /**
+   * Gather the templates and yields of a (bin, process) pair
+   *
+   * @param cb The input instance, containing one Process entry per mass point
+   * @param bin The bin
+   * @param process The process
+   * @param allow_morph If false, use the template of the closest mass point
+   * instead of interpolating horizontally
+   * @param force_template_limit If true the yield goes to zero outside the
+   * range of mass points, as with the option of the same name in
+   * ch::BuildRooMorphing
+   * @param cache An optional cache for the converted templates
+   */
+  MorphGridEvaluator(CombineHarvester & cb, std::string const& bin,
+                     std::string const& process, bool allow_morph = true,
+                     bool force_template_limit = false,
+                     TemplateCache * cache = nullptr);
+
+  /**
+   * Set the value of a shape or lnN systematic nuisance parameter, all
+   * parameters are zero by default. Names that do not affect this model are
+   * ignored.
+   */
+  MorphGridEvaluator& SetParameter(std::string const& name, double val);
+
+  /// Set all parameters back to zero
+  MorphGridEvaluator& ResetParameters();
+
+  /// The sorted mass points
+  std::vector<double> const& MassPoints() const { return m_vec_; }
+
+  /**
+   * The normalised templates, in the binning of the observed data, for each
+   * of the given masses
+   *
+   * @param masses The mass values, in any order
+   * @param n_threads The number of threads to use
+   * @return One vector of bin contents per mass value, each summing to unity
+   * (unless all bins are empty)
+   */
+  std::vector<std::vector<double>> Evaluate(std::vector<double> const& masses,
+                                            unsigned n_threads = 1) const;
+
+  /// The yield for each of the given masses
+  std::vector<double> EvaluateRates(std::vector<double> const& masses) const;
+
+  /**
+   * Like Evaluate, but returns histograms with the binning of the observed
+   * data, optionally scaled by the yield at each mass
+   */
+  std::vector<TH1F> EvaluateHists(std::vector<double> const& masses,
+                                  bool with_rate = true,
+                                  unsigned n_threads = 1) const;
+
+  /**
+   * Compare with the model built by ch::BuildRooMorphing from the same inputs
+   *
+   * The evaluator must be constructed before BuildRooMorphing is called, as
+   * that modifies the CombineHarvester instance. The nuisance parameters in
+   * the workspace are set to the values given with SetParameter, and both
+   * models are evaluated at each mass. All the parameters, and the mass, are
+   * restored afterwards.
+   *
+   * @param ws The workspace the model was imported into
+   * @param mass_var The mass variable that was given to BuildRooMorphing
+   * @param masses The mass values to compare at
+   * @param tolerance The largest allowed difference in each normalised bin
+   * content, and in the yield relative to that of the workspace
+   * @param norm_postfix The norm_postfix that was given to BuildRooMorphing
+   * @return The largest difference found
+   *
+   * @throws std::runtime_error if the model is not in the workspace, or if a
+   * difference is larger than the tolerance
+   */
+  double Validate(RooWorkspace & ws, RooRealVar & mass_var,
+                  std::vector<double> const& masses, double tolerance = 1E-4,
+                  std::string const& norm_postfix = "norm") const;
+
+ private:
+  std::vector<double> VerticalMorph(unsigned mi) const;
+  std::vector<double> HorizontalMorph(
+      std::vector<std::vector<double>> const& vert, double mass) const;
+  std::vector<double> ToTargetBinning(std::vector<double> const& fine) const;
+  double Interpolate(double const* vals, double mass) const;
+
+  // bin + "_" + process, as used in the names of the BuildRooMorphing objects
+  std::string key_;
+  bool allow_morph_;
+  bool force_template_limit_;
+  std::vector<double> m_vec_;
+  // Binning of the input templates, and the binning of the observed data
+  std::vector<double> fine_edges_;
+  TH1F target_;
+  // For each fine bin the target bin it is summed into, or -1
+  std::vector<int> target_idx_;
+  // Shape systematics: names, scale factors, nuisance parameter values
+  std::vector<std::string> ss_vec_;
+  std::vector<double> ss_scale_vec_;
+  std::vector<double> ss_val_vec_;
+  double qrange_;
+  // lnN systematics that vary with mass
+  std::vector<std::string> lms_vec_;
+  std::vector<double> lms_val_vec_;
+  // [m][nfine] nominal, and [m][ss][nfine] half-difference and half-sum of
+  // the Up and Down shifts
+  boost::multi_array<double, 2> nominal_arr_;
+  boost::multi_array<double, 3> diff_arr_;
+  boost::multi_array<double, 3> sum_arr_;
+  std::vector<double> rate_vec_;
+  // [ss][m] and [lms][m] kappa values
+  boost::multi_array<double, 2> ss_k_hi_arr_;
+  boost::multi_array<double, 2> ss_k_lo_arr_;
+  boost::multi_array<double, 2> lms_k_hi_arr_;
+  boost::multi_array<double, 2> lms_k_lo_arr_;
+};
+}
+
+#endif
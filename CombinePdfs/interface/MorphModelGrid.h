@@ -0,0 +1,77 @@
+#ifndef CombinePdfs_MorphModelGrid_h
+#define CombinePdfs_MorphModelGrid_h
+#include <string>
+#include <vector>
+#include "boost/multi_array.hpp"
+#include "CombineHarvester/CombineTools/interface/CombineHarvester.h"
+
+namespace ch {
+
+/**
+ * Indexes the Process and Systematic entries of a single (bin, process)
+ * morphing model by mass point and systematic name
+ *
+ * The morphing builders (ch::BuildRooMorphing and ch::CMSHistFuncFactory)
+ * need, for each mass point, the Process entry along with its shape and lnN
+ * Systematic entries in a fixed order. This class builds these arrays with a
+ * single pass over the entries of the input instance, rather than a filtered
+ * copy for every (mass, systematic) combination.
+ *
+ *     ch::MorphModelGrid grid(cb.cp().bin({bin}).process({process}));
+ *     for (unsigned mi = 0; mi < grid.m(); ++mi) {
+ *       ch::Process *p = grid.pr_arr[mi];
+ *       ch::Systematic *s = grid.ss_arr[0][mi];
+ *     }
+ *
+ * \note The arrays hold non-owning pointers to the entries of the instance
+ * that was passed to the constructor, which must outlive the grid.
+ */
+class MorphModelGrid {
+ public:
+  /**
+   * Build the grid from all the entries in `cb`
+   *
+   * The input should already be filtered to a single bin and process. The
+   * mass points are sorted by numerical value.
+   *
+   * @param cb The (filtered) input instance
+   * @param shape_types The systematic types that should be treated as shape
+   * systematics, every other type apart from "lnN" is ignored
+   * @param numeric_mass If true the mass values must always be
+   * float-convertible. If false this is only required when there is more than
+   * one mass point, and for a single mass point m_vec will be left empty
+   *
+   * @throws std::runtime_error if a shape or lnN systematic is not defined for
+   * every mass point, and boost::bad_lexical_cast if a mass value that must be
+   * numeric is not
+   */
+  explicit MorphModelGrid(
+      CombineHarvester & cb,
+      std::vector<std::string> const& shape_types = {"shape"},
+      bool numeric_mass = true);
+
+  /// The number of mass points
+  unsigned m() const { return m_str_vec.size(); }
+  /// The number of shape systematics
+  unsigned ss() const { return ss_vec.size(); }
+  /// The number of lnN systematics
+  unsigned ls() const { return ls_vec.size(); }
+
+  /// Mass points as strings, sorted by numerical value
+  std::vector<std::string> m_str_vec;
+  /// Mass points as numbers, in the same order as m_str_vec
+  std::vector<double> m_vec;
+  /// Names of the shape systematics
+  std::vector<std::string> ss_vec;
+  /// Names of the lnN systematics
+  std::vector<std::string> ls_vec;
+  /// The Process entry for each mass point: [m]
+  boost::multi_array<ch::Process *, 1> pr_arr;
+  /// The shape Systematic entries: [ss][m]
+  boost::multi_array<ch::Systematic *, 2> ss_arr;
+  /// The lnN Systematic entries: [ls][m]
+  boost::multi_array<ch::Systematic *, 2> ls_arr;
+};
+}
+
+#endif
@@ -5,10 +5,18 @@
 #include "boost/python/type_id.hpp"
 #include "TPython.h"
 #include "CombineHarvester/CombinePdfs/interface/MorphFunctions.h"
+#include "CombineHarvester/CombinePdfs/interface/MorphGridEvaluator.h"
 
 namespace bp = boost::python;
 
 void BuildRooMorphingPy(bp::object & ws, ch::CombineHarvester& cb,
                       std::string const& bin, std::string const& process,
                       bp::object & mass_var, std::string norm_postfix,
-                      bool allow_morph, bool verbose, bool force_template_limit, bp::object & file);
+                      bool allow_morph, bool verbose, bool force_template_limit, bp::object & file,
+                      bp::object & cache);
+
+bp::list MorphGridEvaluatePy(ch::MorphGridEvaluator const& eval,
+                             bp::object const& masses, unsigned n_threads);
+
+bp::list MorphGridEvaluateRatesPy(ch::MorphGridEvaluator const& eval,
+                                  bp::object const& masses);
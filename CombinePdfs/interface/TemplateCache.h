@@ -0,0 +1,95 @@
+#ifndef CombinePdfs_TemplateCache_h
+#define CombinePdfs_TemplateCache_h
+#include <map>
+#include <memory>
+#include <mutex>
+#include <tuple>
+#include <utility>
+#include "TH1.h"
+#include "TH1F.h"
+#include "RooDataHist.h"
+#include "RooRealVar.h"
+
+namespace ch {
+
+/**
+ * Caches the TH1F and RooDataHist forms of the templates used to build
+ * morphing models
+ *
+ * The morphing builders (ch::BuildRooMorphing and ch::CMSHistFuncFactory)
+ * have to convert every input template to a TH1F and, usually, to a uniform
+ * integer binning with ch::RebinHist. When several models are built from the
+ * same inputs, e.g. for a number of signal hypotheses, the same templates
+ * would otherwise be converted again for every call. Sharing a TemplateCache
+ * between these calls means each distinct template is only converted once:
+ *
+ *     ch::TemplateCache cache;
+ *     for (auto const& p : {"ggH", "bbH"}) {
+ *       ch::BuildRooMorphing(ws, cb, bin, p, mass, "norm", true, false, false,
+ *                            nullptr, &cache);
+ *     }
+ *
+ * The builders only use a cache when one is passed to them.
+ *
+ * Templates are looked up by their address. This relies on the Process and
+ * Systematic templates being shared and immutable (see ch::HistogramPool): a
+ * template must not be modified or deleted while a cache that has seen it is
+ * in use. Call Clear() before reusing a cache after the CombineHarvester
+ * instance it was filled from has changed.
+ *
+ * All methods are thread-safe.
+ */
+class TemplateCache {
+ public:
+  TemplateCache() : hits_(0), misses_(0) {}
+
+  /**
+   * Get the TH1F form of a template
+   *
+   * @param hist The template, must be a TH1F or a TH1D
+   * @param rebin If true, the result is converted to a uniform integer
+   * binning with ch::RebinHist
+   *
+   * @throws std::runtime_error if hist is not a TH1F or a TH1D
+   */
+  std::shared_ptr<TH1F const> GetTH1F(TH1 const* hist, bool rebin);
+
+  /**
+   * Get the RooDataHist form of a template, as built by ch::TH1F2Data
+   *
+   * The RooDataHist is defined on x, which must stay valid while the cache
+   * is in use, and takes the name of hist.
+   *
+   * @throws std::runtime_error if hist is not a TH1F or a TH1D
+   */
+  std::shared_ptr<RooDataHist const> GetRooDataHist(TH1 const* hist,
+                                                    RooRealVar const& x);
+
+  /**
+   * The conversion done by GetTH1F, for callers that have no cache
+   */
+  static TH1F Convert(TH1 const* hist, bool rebin);
+
+  /// Remove all the cached templates
+  void Clear();
+
+  /// The number of cached templates, in either form
+  std::size_t Size() const;
+
+  /// The number of lookups answered from the cache
+  std::size_t Hits() const;
+
+  /// The number of lookups that required a new conversion
+  std::size_t Misses() const;
+
+ private:
+  mutable std::mutex mutex_;
+  std::map<std::pair<TH1 const*, bool>, std::shared_ptr<TH1F const>> th1f_;
+  std::map<std::pair<TH1 const*, RooRealVar const*>,
+           std::shared_ptr<RooDataHist const>> rdh_;
+  std::size_t hits_;
+  std::size_t misses_;
+};
+}
+
+#endif
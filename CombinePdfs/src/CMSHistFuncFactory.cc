@@ -13,7 +13,11 @@
 #include "RooDataHist.h"
 #include "RooProduct.h"
 #include "RooConstVar.h"
+#include "TROOT.h"
+#include "TDirectory.h"
 #include "CombineHarvester/CombineTools/interface/Logging.h"
+#include "CombineHarvester/CombineTools/interface/Parallel.h"
+#include "CombineHarvester/CombinePdfs/interface/MorphModelGrid.h"
 
 namespace ch {
 
@@ -23,11 +27,74 @@ TODO:
 3) Remove morphing proc errors
 */
 
-CMSHistFuncFactory::CMSHistFuncFactory() : v_(1), hist_mode_(0), rebin_(true) {}
+struct CMSHistFuncFactory::ProcInputs {
+  std::string bin;
+  std::string process;
+  TString key;
+  // Mass points, as strings and as numbers (the latter only if m > 1)
+  std::vector<std::string> m_str_vec;
+  std::vector<double> m_vec;
+  // Names and scale factors of the shape systematics
+  std::vector<std::string> ss_vec;
+  std::vector<double> ss_scale_vec;
+  // Names of the lnN systematics that vary with mass
+  std::vector<std::string> lms_vec;
+  std::set<std::string> lms_set;
+  // Nominal, Up and Down templates per mass point: (m * (1 + 2*ss))
+  boost::multi_array<std::shared_ptr<TH1F>, 2> hist_arr;
+  boost::multi_array<double, 1> rate_arr;
+  boost::multi_array<double, 2> ss_k_hi_arr;
+  boost::multi_array<double, 2> ss_k_lo_arr;
+  boost::multi_array<double, 2> lms_k_hi_arr;
+  boost::multi_array<double, 2> lms_k_lo_arr;
+  // Defines the target binning
+  TH1F data_hist;
+};
+
+CMSHistFuncFactory::CMSHistFuncFactory()
+    : v_(1),
+      hist_mode_(0),
+      rebin_(true),
+      n_threads_(1) {}
+
+std::shared_ptr<TH1F> CMSHistFuncFactory::ConvertTemplate(TH1 const* hist) {
+  // A cached template is shared, so we take a copy as it will be modified
+  if (cache_) return std::make_shared<TH1F>(*cache_->GetTH1F(hist, rebin_));
+  return std::make_shared<TH1F>(TemplateCache::Convert(hist, rebin_));
+}
 
 void CMSHistFuncFactory::Run(ch::CombineHarvester &cb, RooWorkspace &ws, std::map<std::string, std::string> process_vs_norm_postfix_map) {
-  for (auto const& bin : cb.bin_set()) {
+  std::vector<std::pair<std::string, std::string>> bin_procs;
+  std::vector<std::string> bins = Set2Vec(cb.bin_set());
+  for (auto const& bin : bins) {
     for (auto const& proc : cb.cp().bin({bin}).process_set()) {
+      bin_procs.push_back(std::make_pair(bin, proc));
+    }
+  }
+
+  // The inputs are prepared in batches to limit the number of template copies
+  // held in memory at any one time
+  // New histograms should not be added to gDirectory. This is unset here for
+  // the calling thread and again in each worker, as gDirectory is local to
+  // each thread once thread safety is enabled.
+  TDirectory::TContext no_dir(nullptr);
+  if (n_threads_ > 1) ROOT::EnableThreadSafety();
+  std::size_t batch = std::max(1u, 2 * n_threads_);
+  std::vector<std::unique_ptr<ProcInputs>> inputs;
+  std::size_t next = 0;
+  for (auto const& bin : bins) {
+    for (; next < bin_procs.size() && bin_procs[next].first == bin; ++next) {
+      if (next % batch == 0) {
+        std::size_t n = std::min(batch, bin_procs.size() - next);
+        inputs.clear();
+        inputs.resize(n);
+        ParallelFor(n, n_threads_, [&](std::size_t i) {
+          TDirectory::TContext worker_no_dir(nullptr);
+          inputs[i] = PrepareSingleProc(cb, bin_procs[next + i].first,
+                                        bin_procs[next + i].second);
+        });
+      }
+      std::string const& proc = bin_procs[next].second;
       if (v_) {
         std::cout << ">> Processing " << bin << "," << proc << "\n";
       }
@@ -39,7 +106,9 @@ void CMSHistFuncFactory::Run(ch::CombineHarvester &cb, RooWorkspace &ws, std::ma
       {
         norm_postfix_ = process_vs_norm_postfix_map[proc];
       }
-      RunSingleProc(cb, ws, bin, proc);
+      std::unique_ptr<ProcInputs> & in = inputs[next % batch];
+      BuildSingleProc(cb, ws, *in);
+      in.reset();
     }
     TH1F data_hist = cb.cp().bin({bin}).GetObservedShape();
     if (rebin_) data_hist = RebinHist(data_hist);
@@ -62,105 +131,210 @@ void CMSHistFuncFactory::Run(ch::CombineHarvester &cb, RooWorkspace &ws) {
   CMSHistFuncFactory::Run(cb, ws,  {});
 }
 
-void CMSHistFuncFactory::RunSingleProc(CombineHarvester& cb, RooWorkspace& ws,
-                                       std::string bin, std::string process) {
+std::unique_ptr<CMSHistFuncFactory::ProcInputs>
+CMSHistFuncFactory::PrepareSingleProc(CombineHarvester& cb,
+                                      std::string const& bin,
+                                      std::string const& process) {
   using std::vector;
   using std::set;
   using std::string;
-  using boost::lexical_cast;
   using boost::multi_array;
   using boost::extents;
 
-  TString key = bin + "_" + process;
-
+  // Note this function is called from several threads at once, it must not
+  // modify cb or any other shared state
+  std::unique_ptr<ProcInputs> res(new ProcInputs());
+  ProcInputs & in = *res;
+  in.bin = bin;
+  in.process = process;
+  in.key = bin + "_" + process;
 
   CombineHarvester cbp = cb.cp().bin({bin}).process({process});
-  vector<string> m_str_vec = Set2Vec(cbp.SetFromProcs(
-      std::mem_fn(&ch::Process::mass)));
-  unsigned m = m_str_vec.size();
-  vector<double> m_vec;
-  if (m_str_vec.size() == 1) {
-  } else {
-    std::sort(m_str_vec.begin(), m_str_vec.end(),
-              [](string const& s1, string const& s2) {
-                return lexical_cast<double>(s1) < lexical_cast<double>(s2);
-              });
-    for (auto const& s : m_str_vec) {
-      if (v_) std::cout << ">>>> Mass point: " << s << "\n";
-      m_vec.push_back(lexical_cast<double>(s));
-    }
-  }
+  // Index the process and systematic entries by mass point and systematic
+  // name. The masses only need to be numeric if there is more than one.
+  MorphModelGrid grid(cbp, {"shape", "shapeU"}, false);
+  in.m_str_vec = grid.m_str_vec;
+  in.m_vec = grid.m_vec;
+  unsigned m = grid.m();
 
   // ss = "shape systematic"
-  // Make a list of the names of shape systematics affecting this process
-  vector<string> ss_vec =
-      Set2Vec(cbp.cp().syst_type({"shape", "shapeU"}).syst_name_set());
-  // Now check if all shape systematics are present for all mass points
-  for (auto const& s : m_str_vec) {
-    if (cbp.cp().syst_type({"shape", "shapeU"}).mass({s}).syst_name_set().size() !=
-        ss_vec.size()) {
+  in.ss_vec = grid.ss_vec;
+  unsigned ss = grid.ss();  // number of shape systematics
+  vector<string> const& ls_vec = grid.ls_vec;
+  unsigned ls = grid.ls();  // number of lnN systematics
+
+  multi_array<ch::Process *,  1> const& pr_arr = grid.pr_arr;
+  multi_array<ch::Systematic *, 2> const& ss_arr = grid.ss_arr;
+  multi_array<ch::Systematic *, 2> const& ls_arr = grid.ls_arr;
+
+  // We'll make a quick check that the scale factor for each shape systematic
+  // is the same for all mass points. We could do a separate scaling at each
+  // mass point but this would create a lot of complications
+  in.ss_scale_vec.resize(ss);
+  for (unsigned ssi = 0; ssi < ss; ++ssi) {
+    set<double> scales;
+    // Insert the scale from each mass point into the set, if it has a size
+    // larger than one at the end then we have a problem!
+    for (unsigned mi = 0; mi < m; ++mi) {
+      scales.insert(ss_arr[ssi][mi]->scale());
+    }
+    if (scales.size() > 1) {
+      // Don't let the user proceed, we can't build the model they want
       throw std::runtime_error(FNERROR(
-          "Some mass points do not have the full set of shape systematics, "
-          "this is currently unsupported"));
+          "Shape morphing parameters that vary with mass are not allowed"));
+    }
+    in.ss_scale_vec[ssi] = *(scales.begin());
+  }
+
+  // lms = "lnN morphing systematic"
+  // Now we have some work to do with the lnN systematics. We can consider two cases:
+  //  a) The uncertainty is the same for each mass point => we can leave it in
+  //     the datacard as is and let text2workspace do its normal thing
+  //  b) The uncertainty varies between mass points => we can't capture this
+  //     information in the text datacard in the usual way, so we'll build a RooFit
+  //     object that effectively makes the lnN uncertainty a function of the mass
+  //     variable
+  // We'll use "lms" to refer to case b), which we'll try to figure out now...
+  // index positions in our full ls_arr array for the lms systematics
+  vector<unsigned > lms_vec_idx;
+  for (unsigned lsi = 0; lsi < ls; ++lsi) {
+    // Extra complication is that the user might have been evil and mixed
+    // symmetric and asymmetric lnN values, we'll try and detect changes in
+    // either
+    set<double> k_hi;
+    set<double> k_lo;
+    // Go through each mass point for this systematic and add the uncertainty
+    // values (so-called "kappa" values)
+    for (unsigned mi = 0; mi < m; ++mi) {
+      Systematic *n = ls_arr[lsi][mi];
+      k_hi.insert(n->value_u());
+      if (n->asymm()) {
+        k_lo.insert(n->value_d());
+      }
+    }
+    // If either of these sets has more than one entry then this is a lms case
+    if (k_hi.size() > 1 || k_lo.size() > 1) {
+      in.lms_vec.push_back(ls_vec[lsi]);
+      in.lms_set.insert(ls_vec[lsi]);
+      lms_vec_idx.push_back(lsi);
+    }
+  }
+  unsigned lms = in.lms_vec.size();
+
+  // 2D array of all input histograms, size is (mass points * (nominal +
+  // 2*shape-systs)). The factor of 2 needed for the Up and Down shapes
+  in.hist_arr.resize(extents[m][1+ss*2]);
+  multi_array<std::shared_ptr<TH1F>, 2> & hist_arr = in.hist_arr;
+  // We also need the array of process yields vs mass, because this will have to
+  // be interpolated too
+  in.rate_arr.resize(extents[m]);
+  // Combine always treats the normalisation part of shape systematics as
+  // distinct from the actual shape morphing. Essentially the norm part is
+  // treated as an asymmetric lnN. We have to make the kappa_hi and kappa_lo a
+  // function of the mass parameter too, so we need two more arrays in (ss * m)
+  in.ss_k_hi_arr.resize(extents[ss][m]);
+  in.ss_k_lo_arr.resize(extents[ss][m]);
+  // Similar set of objects needed for the lms normalisation systematics
+  in.lms_k_hi_arr.resize(extents[lms][m]);
+  in.lms_k_lo_arr.resize(extents[lms][m]);
+
+  for (unsigned mi = 0; mi < m; ++mi) {
+    // Grab the nominal process histograms. We also have to convert every
+    // histogram to a uniform integer binning, because this is what
+    // text2workspace will do for all the non-morphed processes in our datacard,
+    // and we need the binning of these to be in sync.
+    hist_arr[mi][0] = ConvertTemplate(pr_arr[mi]->shape());
+    hist_arr[mi][0]->Scale(pr_arr[mi]->no_norm_rate());
+    if (m > 1) {
+      for (int b = 1; b < hist_arr[mi][0]->GetNbinsX() + 1; ++b) {
+        hist_arr[mi][0]->SetBinError(b, 0.);
+      }
+    }
+    // Store the process rate
+    in.rate_arr[mi] = 1.;
+    // Do the same for the Up and Down shapes
+    for (unsigned ssi = 0; ssi < ss; ++ssi) {
+      hist_arr[mi][1 + 2 * ssi] = ConvertTemplate(ss_arr[ssi][mi]->shape_u());
+      hist_arr[mi][2 + 2 * ssi] = ConvertTemplate(ss_arr[ssi][mi]->shape_d());
+      TH1F* h_hi = hist_arr[mi][1 + 2 * ssi].get();
+      TH1F* h_lo = hist_arr[mi][2 + 2 * ssi].get();
+      if (h_hi->Integral() > 0.) {
+        h_hi->Scale(hist_arr[mi][0]->Integral() / h_hi->Integral());
+      }
+      if (h_lo->Integral() > 0.) {
+        h_lo->Scale(hist_arr[mi][0]->Integral() / h_lo->Integral());
+      }
+
+      // TODO: Need to implement the logic of normalising shape variations here
+
+      // Store the uncertainty ("kappa") values for the shape systematics
+      in.ss_k_hi_arr[ssi][mi] = ss_arr[ssi][mi]->value_u();
+      in.ss_k_lo_arr[ssi][mi] = ss_arr[ssi][mi]->value_d();
+      // For the normalisation we scale the kappa instead of putting the scaling
+      // parameter as the variable
+      if (std::fabs(in.ss_scale_vec[ssi] - 1.0) > 1E-6) {
+        in.ss_k_hi_arr[ssi][mi] = std::pow(ss_arr[ssi][mi]->value_u(), in.ss_scale_vec[ssi]);
+        in.ss_k_lo_arr[ssi][mi] = std::pow(ss_arr[ssi][mi]->value_d(), in.ss_scale_vec[ssi]);
+      }
+    }
+    // And now the uncertainty values for the lnN systematics that vary with mass
+    // We'll force these to be asymmetric even if they're not
+    for (unsigned lmsi = 0; lmsi < lms; ++lmsi) {
+      Systematic *n = ls_arr[lms_vec_idx[lmsi]][mi];
+      in.lms_k_hi_arr[lmsi][mi] = n->value_u();
+      if (n->asymm()) {
+        in.lms_k_lo_arr[lmsi][mi] = n->value_d();
+      } else {
+        in.lms_k_lo_arr[lmsi][mi] = 1. / n->value_u();
+      }
+    }
+  }
+
+  // We anticipate that the process histograms we have been supplied could have
+  // a finer binning than is actually wanted for the analysis (and the fit). We
+  // assume the observed data histogram has the target binning.
+  in.data_hist = cbp.GetObservedShape();
+  return res;
+}
+
+void CMSHistFuncFactory::BuildSingleProc(CombineHarvester& cb, RooWorkspace& ws,
+                                         ProcInputs & in) {
+  using std::vector;
+  using std::string;
+  using boost::multi_array;
+  using boost::extents;
+
+  std::string const& bin = in.bin;
+  std::string const& process = in.process;
+  TString const& key = in.key;
+  vector<string> const& m_str_vec = in.m_str_vec;
+  vector<double> & m_vec = in.m_vec;
+  vector<string> const& ss_vec = in.ss_vec;
+  vector<string> const& lms_vec = in.lms_vec;
+  unsigned m = m_str_vec.size();
+  unsigned ss = ss_vec.size();
+  unsigned lms = lms_vec.size();
+  multi_array<std::shared_ptr<TH1F>, 2> & hist_arr = in.hist_arr;
+
+  if (v_ && m > 1) {
+    for (auto const& s : m_str_vec) {
+      std::cout << ">>>> Mass point: " << s << "\n";
     }
   }
-  unsigned ss = ss_vec.size();  // number of shape systematics
-
-  vector<string> ls_vec =
-      Set2Vec(cbp.cp().syst_type({"lnN"}).syst_name_set());
-  unsigned ls = ls_vec.size();  // number of lnN systematics
-
-  // Store pointers to each ch::Process (one per mass point) in the CH instance
-  multi_array<ch::Process *,  1> pr_arr(extents[m]);
-  // Store pointers pointers to each ch::Systematic for each mass point (hence
-  // an ss * m 2D array)
-  multi_array<ch::Systematic *, 2> ss_arr(extents[ss][m]);
-  // With shape systematics we have to support cases where the value in the
-  // datacard is != 1.0, i.e. we are scaling the parameter that goes into the
-  // Gaussian constraint PDF - we have to pass this factor on when we build the
-  // normal vertical-interpolation PDF for each mass point. We will store these
-  // scale factors in this array, one per shape systematic.
-  multi_array<double, 1> ss_scale_arr(extents[ss]);
-  // Really just for book-keeping, we'll set this flag to true when the shape
-  // systematic scale factor != 1
-  multi_array<bool, 1> ss_must_scale_arr(extents[ss]);
-  // Similar to the ss_arr above, store the lnN ch::Systematic objects. Note
-  // implicit in all this is the assumption that the processes at each mass
-  // point have exactly the same list of systematic uncertainties.
-  multi_array<ch::Systematic *, 2> ls_arr(extents[ls][m]);
 
   // This array holds pointers to the RooRealVar objects that will become our
   // shape nuisance parameters, e.g. "CMS_scale_t_mutau_8TeV"
   multi_array<std::shared_ptr<RooRealVar>, 1> ss_scale_var_arr(extents[ss]);
   // And this array holds the constant scale factors that we'll build from
-  // ss_scale_arr above
+  // the scale factors found for each systematic
   multi_array<std::shared_ptr<RooConstVar>, 1> ss_scale_fac_arr(extents[ss]);
   // Finally this array will contain the scale_var * scale_fac product where we
   // need to provide a scaled value of the nuisance parameter instead of the
   // parameter itself in building the vertical-interp. PDF
   multi_array<std::shared_ptr<RooProduct>, 1> ss_scale_prod_arr(extents[ss]);
-
-    // Now let's fill some of these arrays...
-    for (unsigned mi = 0; mi < m; ++mi) {
-      // The ch::Process pointers
-      cbp.cp().mass({m_str_vec[mi]}).ForEachProc([&](ch::Process *p) {
-        pr_arr[mi] = p;
-      });
-      for (unsigned ssi = 0; ssi < ss; ++ssi) {
-        // The ch::Systematic pointers for shape systematics
-        cbp.cp().mass({m_str_vec[mi]}).syst_name({ss_vec[ssi]})
-          .ForEachSyst([&](ch::Systematic *n) {
-              ss_arr[ssi][mi] = n;
-          });
-      }
-      for (unsigned lsi = 0; lsi < ls; ++lsi) {
-        // The ch::Systematic pointers for lnN systematics
-        cbp.cp().mass({m_str_vec[mi]}).syst_name({ls_vec[lsi]})
-          .ForEachSyst([&](ch::Systematic *n) {
-              ls_arr[lsi][mi] = n;
-          });
-      }
-    }
+  // Really just for book-keeping, we'll set this flag to true when the shape
+  // systematic scale factor != 1
+  multi_array<bool, 1> ss_must_scale_arr(extents[ss]);
 
     //! [part3]
     // We need to build a RooArgList of the vertical morphing parameters for the
@@ -173,41 +347,24 @@ void CMSHistFuncFactory::RunSingleProc(CombineHarvester& cb, RooWorkspace& ws,
       // the end
       ss_scale_var_arr[ssi] =
           std::make_shared<RooRealVar>(ss_vec[ssi].c_str(), "", 0);
-      // We'll make a quick check that the scale factor for this systematic is the
-      // same for all mass points. We could do a separate scaling at each mass
-      // point but this would create a lot of complications
-      set<double> scales;
-      // Insert the scale from each mass point into the set, if it has a size
-      // larger than one at the end then we have a problem!
-      for (unsigned mi = 0; mi < m; ++mi) {
-        scales.insert(ss_arr[ssi][mi]->scale());
-      }
-      if (scales.size() > 1) {
-        // Don't let the user proceed, we can't build the model they want
-        std::runtime_error(FNERROR(
-            "Shape morphing parameters that vary with mass are not allowed"));
+      double scale = in.ss_scale_vec[ssi];
+      // Handle the case where the scale factor is != 1
+      if (std::fabs(scale - 1.0) > 1E-6) {
+        ss_must_scale_arr[ssi] = true;
+        // Build the RooConstVar with the value of the scale factor
+        ss_scale_fac_arr[ssi] = std::make_shared<RooConstVar>(
+            TString::Format("%g", scale), "", scale);
+        // Create the product of the floating nuisance parameter and the
+        // constant scale factor
+        ss_scale_prod_arr[ssi] = std::make_shared<RooProduct>(
+            ss_vec[ssi] + "_scaled_" + key, "",
+            RooArgList(*(ss_scale_var_arr[ssi]), *(ss_scale_fac_arr[ssi])));
+        // Add this to the list
+        ss_list.add(*(ss_scale_prod_arr[ssi]));
       } else {
-        // Everything ok, set the scale value in its array
-        ss_scale_arr[ssi] = *(scales.begin());
-        // Handle the case where the scale factor is != 1
-        if (std::fabs(ss_scale_arr[ssi] - 1.0) > 1E-6) {
-          ss_must_scale_arr[ssi] = true;
-          // Build the RooConstVar with the value of the scale factor
-          ss_scale_fac_arr[ssi] = std::make_shared<RooConstVar>(
-              TString::Format("%g", ss_scale_arr[ssi]), "",
-              ss_scale_arr[ssi]);
-          // Create the product of the floating nuisance parameter and the
-          // constant scale factor
-          ss_scale_prod_arr[ssi] = std::make_shared<RooProduct>(
-              ss_vec[ssi] + "_scaled_" + key, "",
-              RooArgList(*(ss_scale_var_arr[ssi]), *(ss_scale_fac_arr[ssi])));
-          // Add this to the list
-          ss_list.add(*(ss_scale_prod_arr[ssi]));
-        } else {
-          // If the scale factor is 1.0 then we just add the nuisance parameter
-          // directly to our list
-          ss_list.add(*(ss_scale_var_arr[ssi]));
-        }
+        // If the scale factor is 1.0 then we just add the nuisance parameter
+        // directly to our list
+        ss_list.add(*(ss_scale_var_arr[ssi]));
       }
     }
     //! [part3]
@@ -216,55 +373,11 @@ void CMSHistFuncFactory::RunSingleProc(CombineHarvester& cb, RooWorkspace& ws,
     std::cout << ">> Shape systematics: " << ss << "\n";
     for (unsigned ssi = 0; ssi < ss; ++ssi) {
       std::cout << boost::format("%-50s %-5i %-8.3g\n")
-        % ss_vec[ssi] % ss_must_scale_arr[ssi] % ss_scale_arr[ssi];
+        % ss_vec[ssi] % ss_must_scale_arr[ssi] % in.ss_scale_vec[ssi];
     }
   }
 
-    // lms = "lnN morphing systematic"
-    // Now we have some work to do with the lnN systematics. We can consider two cases:
-    //  a) The uncertainty is the same for each mass point => we can leave it in
-    //     the datacard as is and let text2workspace do its normal thing
-    //  b) The uncertainty varies between mass points => we can't capture this
-    //     information in the text datacard in the usual way, so we'll build a RooFit
-    //     object that effectively makes the lnN uncertainty a function of the mass
-    //     variable
-    // We'll use "lms" to refer to case b), which we'll try to figure out now...
-    vector<string> lms_vec;  // vec of systematic names
-    set<string> lms_set;     // set of systematic names
-    // index positions in our full ls_arr array for the lms systematics
-    vector<unsigned > lms_vec_idx;
-    for (unsigned lsi = 0; lsi < ls; ++lsi) {
-      // Extra complication is that the user might have been evil and mixed
-      // symmetric and asymmetric lnN values, we'll try and detect changes in
-      // either
-      set<double> k_hi;
-      set<double> k_lo;
-      // Go through each mass point for this systematic and add the uncertainty
-      // values (so-called "kappa" values)
-      for (unsigned mi = 0; mi < m; ++mi) {
-        Systematic *n = ls_arr[lsi][mi];
-        k_hi.insert(n->value_u());
-        if (n->asymm()) {
-          k_lo.insert(n->value_d());
-        }
-      }
-      // If either of these sets has more than one entry then this is a lms case
-      if (k_hi.size() > 1 || k_lo.size() > 1) {
-        lms_vec.push_back(ls_vec[lsi]);
-        lms_set.insert(ls_vec[lsi]);
-        lms_vec_idx.push_back(lsi);
-      }
-    }
-    unsigned lms = lms_vec.size();
-    // New array for the pointers to the lms Systematic objects
-    multi_array<ch::Systematic *, 2> lms_arr(extents[lms][m]);
-    for (unsigned lmsi = 0; lmsi < lms; ++lmsi) {
-      for (unsigned mi = 0; mi < m; ++mi) {
-        lms_arr[lmsi][mi] = ls_arr[lms_vec_idx[lmsi]][mi];
-      }
-    }
-
-    // We will need to create the nuisance parameters for these now
+    // We will need to create the nuisance parameters for the lms systematics
     multi_array<std::shared_ptr<RooRealVar>, 1> lms_var_arr(extents[lms]);
     for (unsigned lmsi = 0; lmsi < lms; ++lmsi) {
       lms_var_arr[lmsi] =
@@ -279,23 +392,11 @@ void CMSHistFuncFactory::RunSingleProc(CombineHarvester& cb, RooWorkspace& ws,
       }
     }
 
-    // 2D array of all input histograms, size is (mass points * (nominal +
-    // 2*shape-systs)). The factor of 2 needed for the Up and Down shapes
-    multi_array<std::shared_ptr<TH1F>, 2> hist_arr(extents[m][1+ss*2]);
-    // We also need the array of process yields vs mass, because this will have to
-    // be interpolated too
-    multi_array<double, 1> rate_arr(extents[m]);
-    // Also store the yield uncertainty - we don't actually need this for the signal
-    // model, but will include it in the debug TGraph
-    multi_array<double, 1> rate_unc_arr(extents[m]);
-    // The vertical-interpolation PDF needs the TH1 inputs in the format of a TList
-    multi_array<std::shared_ptr<TList>, 1> list_arr(extents[m]);
-    // Combine always treats the normalisation part of shape systematics as
-    // distinct from the actual shape morphing. Essentially the norm part is
-    // treated as an asymmetric lnN. We have to make the kappa_hi and kappa_lo a
-    // function of the mass parameter too, so we need two more arrays in (ss * m)
-    multi_array<double, 2> ss_k_hi_arr(extents[ss][m]);
-    multi_array<double, 2> ss_k_lo_arr(extents[ss][m]);
+    multi_array<double, 1> & rate_arr = in.rate_arr;
+    multi_array<double, 2> & ss_k_hi_arr = in.ss_k_hi_arr;
+    multi_array<double, 2> & ss_k_lo_arr = in.ss_k_lo_arr;
+    multi_array<double, 2> & lms_k_hi_arr = in.lms_k_hi_arr;
+    multi_array<double, 2> & lms_k_lo_arr = in.lms_k_lo_arr;
     // For each shape systematic we will build a RooSpline1D, configured to
     // interpolate linearly between the kappa values
     multi_array<std::shared_ptr<RooAbsReal>, 1> ss_spl_hi_arr(extents[ss]);
@@ -305,92 +406,10 @@ void CMSHistFuncFactory::RunSingleProc(CombineHarvester& cb, RooWorkspace& ws,
     multi_array<std::shared_ptr<AsymPow>, 1> ss_asy_arr(extents[ss]);
 
     // Similar set of objects needed for the lms normalisation systematics
-    multi_array<double, 2> lms_k_hi_arr(extents[lms][m]);
-    multi_array<double, 2> lms_k_lo_arr(extents[lms][m]);
     multi_array<std::shared_ptr<RooSpline1D>, 1> lms_spl_hi_arr(extents[lms]);
     multi_array<std::shared_ptr<RooSpline1D>, 1> lms_spl_lo_arr(extents[lms]);
     multi_array<std::shared_ptr<AsymPow>, 1> lms_asy_arr(extents[lms]);
 
-    for (unsigned mi = 0; mi < m; ++mi) {
-      // Grab the nominal process histograms. We also have to convert every
-      // histogram to a uniform integer binning, because this is what
-      // text2workspace will do for all the non-morphed processes in our datacard,
-      // and we need the binning of these to be in sync.
-      hist_arr[mi][0] =
-          std::make_shared<TH1F>(AsTH1F(pr_arr[mi]->ClonedScaledShape().get()));
-      if (rebin_) *hist_arr[mi][0] = RebinHist(*hist_arr[mi][0]);
-      if (m > 1) {
-        for (int b = 1; b < hist_arr[mi][0]->GetNbinsX() + 1; ++b) {
-          hist_arr[mi][0]->SetBinError(b, 0.);
-        }
-      }
-      // If the user supplied a TFile pointer we'll dump a bunch of info into it
-      // for debugging
-      // if (file) {
-      //   file->WriteTObject(pr_arr[mi]->shape(), key + "_" + m_str_vec[mi]);
-      // }
-      // Store the process rate
-      rate_arr[mi] = 1.;
-      // auto proc_hist = pr_arr[mi]->ClonedScaledShape();
-      // proc_hist->IntegralAndError(1, proc_hist->GetNbinsX(), rate_unc_arr[mi]);
-      // Do the same for the Up and Down shapes
-      for (unsigned ssi = 0; ssi < ss; ++ssi) {
-        hist_arr[mi][1 + 2 * ssi] =
-            std::make_shared<TH1F>(AsTH1F(ss_arr[ssi][mi]->shape_u()));
-        hist_arr[mi][2 + 2 * ssi] =
-            std::make_shared<TH1F>(AsTH1F(ss_arr[ssi][mi]->shape_d()));
-        if (rebin_) *hist_arr[mi][1 + 2 * ssi] = RebinHist(*hist_arr[mi][1 + 2 * ssi]);
-        if (rebin_) *hist_arr[mi][2 + 2 * ssi] = RebinHist(*hist_arr[mi][2 + 2 * ssi]);
-        TH1F* h_hi = hist_arr[mi][1 + 2 * ssi].get();
-        TH1F* h_lo = hist_arr[mi][2 + 2 * ssi].get();
-        if (h_hi->Integral() > 0.) {
-          h_hi->Scale(hist_arr[mi][0]->Integral() / h_hi->Integral());
-        }
-        if (h_lo->Integral() > 0.) {
-          h_lo->Scale(hist_arr[mi][0]->Integral() / h_lo->Integral());
-        }
-
-        // TODO: Need to implement the logic of normalising shape variations here
-
-        // if (file) {
-        //   file->WriteTObject(ss_arr[ssi][mi]->shape_u(),
-        //                      key + "_" + m_str_vec[mi] + "_" + ss_vec[ssi] + "Up");
-        //   file->WriteTObject(ss_arr[ssi][mi]->shape_d(),
-        //                      key + "_" + m_str_vec[mi] + "_" + ss_vec[ssi] + "Down");
-        // }
-        // Store the uncertainty ("kappa") values for the shape systematics
-        ss_k_hi_arr[ssi][mi] = ss_arr[ssi][mi]->value_u();
-        ss_k_lo_arr[ssi][mi] = ss_arr[ssi][mi]->value_d();
-        // For the normalisation we scale the kappa instead of putting the scaling
-        // parameter as the variable
-        if (std::fabs(ss_scale_arr[ssi] - 1.0) > 1E-6) {
-          ss_k_hi_arr[ssi][mi] = std::pow(ss_arr[ssi][mi]->value_u(), ss_scale_arr[ssi]);
-          ss_k_lo_arr[ssi][mi] = std::pow(ss_arr[ssi][mi]->value_d(), ss_scale_arr[ssi]);
-        }
-      }
-      // And now the uncertainty values for the lnN systematics that vary with mass
-      // We'll force these to be asymmetric even if they're not
-      for (unsigned lmsi = 0; lmsi < lms; ++lmsi) {
-        lms_k_hi_arr[lmsi][mi] = lms_arr[lmsi][mi]->value_u();
-        if (lms_arr[lmsi][mi]->asymm()) {
-          lms_k_lo_arr[lmsi][mi] = lms_arr[lmsi][mi]->value_d();
-        } else {
-          lms_k_lo_arr[lmsi][mi] = 1. / lms_arr[lmsi][mi]->value_u();
-        }
-      }
-    }
-    // Now we'll fill these objects..
-
-
-    // Now we've made all our histograms, we'll put them in the TList format
-    // of [nominal, syst_1_Up, syst_1_Down, ... , syst_N_Up, syst_N_Down]
-    // for (unsigned mi = 0; mi < m; ++mi) {
-    //   list_arr[mi] = std::make_shared<TList>();
-    //   for (unsigned xi = 0; xi < (1 + ss * 2); ++xi) {
-    //     list_arr[mi]->Add(hist_arr[mi][xi].get());
-    //   }
-    // }
-
     // Print the values of the yields and kappa factors that will be inputs
     // to our spline interpolation objects
     if (v_) {
@@ -533,8 +552,7 @@ void CMSHistFuncFactory::RunSingleProc(CombineHarvester& cb, RooWorkspace& ws,
     // mass point if the binning is too wide. The RooMorphingPdf will handle
     // re-binning on the fly, but we have to tell it how to rebin. To do this we
     // assume the observed data histogram has the target binning.
-    TH1F data_hist = cbp.GetObservedShape();
-    TH1F proc_hist = cbp.GetShape();
+    TH1F const& data_hist = in.data_hist;
     // The x-axis variable has to be called "CMS_th1x", as this is what
     // text2workspace will use for all the normal processes
     // data_hist.Print("range");
@@ -561,7 +579,7 @@ void CMSHistFuncFactory::RunSingleProc(CombineHarvester& cb, RooWorkspace& ws,
     // to the minimum of all of the shape scales
     double qrange = 1.;
     for (unsigned ssi = 0; ssi < ss; ++ssi) {
-      if (ss_scale_arr[ssi] < qrange) qrange = ss_scale_arr[ssi];
+      if (in.ss_scale_vec[ssi] < qrange) qrange = in.ss_scale_vec[ssi];
     }
 
 
@@ -631,7 +649,7 @@ void CMSHistFuncFactory::RunSingleProc(CombineHarvester& cb, RooWorkspace& ws,
     cb.FilterSysts([&](ch::Systematic const* n) {
       return (n->bin() == bin && n->process() == process) &&
              ((n->mass() != mass_min) || (n->type() == "shape" || n->type() == "shapeU") ||
-              (lms_set.count(n->name())));
+              (in.lms_set.count(n->name())));
     });
     // With the remaining Process entry (should only be one if we did this right),
     // Make the mass generic ("*"), drop the TH1 and set the rate to 1.0, as this
@@ -13,6 +13,7 @@
 #include "RooProduct.h"
 #include "RooConstVar.h"
 #include "CombineHarvester/CombineTools/interface/Logging.h"
+#include "CombineHarvester/CombinePdfs/interface/MorphModelGrid.h"
 
 namespace ch {
 
@@ -20,7 +21,8 @@ namespace ch {
 std::string BuildRooMorphing(RooWorkspace& ws, CombineHarvester& cb,
                       std::string const& bin, std::string const& process,
                       RooAbsReal& mass_var, std::string norm_postfix,
-                      bool allow_morph, bool verbose, bool force_template_limit, TFile * file) {
+                      bool allow_morph, bool verbose, bool force_template_limit, TFile * file,
+                      TemplateCache * cache) {
   //! [part1]
   // To keep the code concise we'll make some using-declarations here
   using std::set;
@@ -51,61 +53,43 @@ std::string BuildRooMorphing(RooWorkspace& ws, CombineHarvester& cb,
   CombineHarvester cb_bp = cb.cp().bin({bin}).process({process});
 
   //! [part2]
-  // Get a vector of the mass values
-  vector<string> m_str_vec = Set2Vec(cb_bp.SetFromProcs(
-      std::mem_fn(&ch::Process::mass)));
-
-  // We now sort these based on numerical value, hence the lexical_cast to double
-  // At the moment this also serves as our check that all mass values are
-  // float-convertible, as an exception will be thrown by lexical_cast if not.
-  std::sort(m_str_vec.begin(), m_str_vec.end(),
-    [](string const& s1, string const& s2) {
-      return lexical_cast<double>(s1) < lexical_cast<double>(s2);
-    });
-
-  // Convert the sorted vector of mass strings to an actual vector of doubles
-  vector<double> m_vec;
-  for (auto const& s : m_str_vec) {
-    if (verbose) std::cout << ">>>> Mass point: " << s << "\n";
-    m_vec.push_back(lexical_cast<double>(s));
+  // Index the process and systematic entries by mass point and systematic
+  // name. The mass points are sorted by numerical value, and at the moment
+  // this also serves as our check that all mass values are float-convertible,
+  // as an exception will be thrown by lexical_cast if not. An exception is
+  // also thrown if a mass point does not have the full set of shape or lnN
+  // systematics, this is currently unsupported.
+  MorphModelGrid grid(cb_bp, {"shape"}, true);
+  vector<string> const& m_str_vec = grid.m_str_vec;
+  vector<double> const& m_vec = grid.m_vec;
+  if (verbose) {
+    for (auto const& s : m_str_vec) std::cout << ">>>> Mass point: " << s << "\n";
   }
   // So, we have m mass points to consider
-  unsigned m = m_vec.size();
+  unsigned m = grid.m();
   //! [part2]
 
   // ss = "shape systematic"
-  // Make a list of the names of shape systematics affecting this process
-  vector<string> ss_vec =
-      Set2Vec(cb_bp.cp().syst_type({"shape"}).syst_name_set());
-  // Now check if all shape systematics are present for all mass points
-  for (auto const& s : m_str_vec) {
-    if (cb_bp.cp().syst_type({"shape"}).mass({s}).syst_name_set().size() !=
-        ss_vec.size()) {
-      throw std::runtime_error(FNERROR(
-          "Some mass points do not have the full set of shape systematics, "
-          "this is currently unsupported"));
-    }
-  }
-
-  unsigned ss = ss_vec.size();  // number of shape systematics
+  // The names of shape systematics affecting this process
+  vector<string> const& ss_vec = grid.ss_vec;
+  unsigned ss = grid.ss();  // number of shape systematics
 
   // ls = "lnN systematic"
-  // Make a list of the regular lnN normalisation systematics affecting this
+  // The names of the regular lnN normalisation systematics affecting this
   // process
-  vector<string> ls_vec =
-      Set2Vec(cb_bp.cp().syst_type({"lnN"}).syst_name_set());
-  unsigned ls = ls_vec.size();  // number of lnN systematics
+  vector<string> const& ls_vec = grid.ls_vec;
+  unsigned ls = grid.ls();  // number of lnN systematics
 
   // Create a bunch of empty arrays to store the information we need in a more
   // convenient format. We use the boost multi_array class because it's a nice
   // multi-dimensional array implementation, and safer to use than standard
   // C-arrays
 
-  // Store pointers to each ch::Process (one per mass point) in the CH instance
-  multi_array<ch::Process *,  1> pr_arr(extents[m]);
-  // Store pointers pointers to each ch::Systematic for each mass point (hence
-  // an ss * m 2D array)
-  multi_array<ch::Systematic *, 2> ss_arr(extents[ss][m]);
+  // Pointers to each ch::Process (one per mass point) in the CH instance
+  multi_array<ch::Process *,  1> const& pr_arr = grid.pr_arr;
+  // Pointers to each ch::Systematic for each mass point (hence an ss * m 2D
+  // array)
+  multi_array<ch::Systematic *, 2> const& ss_arr = grid.ss_arr;
   // With shape systematics we have to support cases where the value in the
   // datacard is != 1.0, i.e. we are scaling the parameter that goes into the
   // Gaussian constraint PDF - we have to pass this factor on when we build the
@@ -115,10 +99,10 @@ std::string BuildRooMorphing(RooWorkspace& ws, CombineHarvester& cb,
   // Really just for book-keeping, we'll set this flag to true when the shape
   // systematic scale factor != 1
   multi_array<bool, 1> ss_must_scale_arr(extents[ss]);
-  // Similar to the ss_arr above, store the lnN ch::Systematic objects. Note
+  // Similar to the ss_arr above, the lnN ch::Systematic objects. Note
   // implicit in all this is the assumption that the processes at each mass
   // point have exactly the same list of systematic uncertainties.
-  multi_array<ch::Systematic *, 2> ls_arr(extents[ls][m]);
+  multi_array<ch::Systematic *, 2> const& ls_arr = grid.ls_arr;
 
   // This array holds pointers to the RooRealVar objects that will become our
   // shape nuisance parameters, e.g. "CMS_scale_t_mutau_8TeV"
@@ -131,29 +115,6 @@ std::string BuildRooMorphing(RooWorkspace& ws, CombineHarvester& cb,
   // parameter itself in building the vertical-interp. PDF
   multi_array<std::shared_ptr<RooProduct>, 1> ss_scale_prod_arr(extents[ss]);
 
-
-  // Now let's fill some of these arrays...
-  for (unsigned mi = 0; mi < m; ++mi) {
-    // The ch::Process pointers
-    cb_bp.cp().mass({m_str_vec[mi]}).ForEachProc([&](ch::Process *p) {
-      pr_arr[mi] = p;
-    });
-    for (unsigned ssi = 0; ssi < ss; ++ssi) {
-      // The ch::Systematic pointers for shape systematics
-      cb_bp.cp().mass({m_str_vec[mi]}).syst_name({ss_vec[ssi]})
-        .ForEachSyst([&](ch::Systematic *n) {
-            ss_arr[ssi][mi] = n;
-        });
-    }
-    for (unsigned lsi = 0; lsi < ls; ++lsi) {
-      // The ch::Systematic pointers for lnN systematics
-      cb_bp.cp().mass({m_str_vec[mi]}).syst_name({ls_vec[lsi]})
-        .ForEachSyst([&](ch::Systematic *n) {
-            ls_arr[lsi][mi] = n;
-        });
-    }
-  }
-
   //! [part3]
   // We need to build a RooArgList of the vertical morphing parameters for the
   // vertical-interpolation pdf - this will be the same for each mass point so
@@ -176,7 +137,7 @@ std::string BuildRooMorphing(RooWorkspace& ws, CombineHarvester& cb,
     }
     if (scales.size() > 1) {
       // Don't let the user proceed, we can't build the model they want
-      std::runtime_error(FNERROR(
+      throw std::runtime_error(FNERROR(
           "Shape morphing parameters that vary with mass are not allowed"));
     } else {
       // Everything ok, set the scale value in its array
@@ -275,6 +236,13 @@ std::string BuildRooMorphing(RooWorkspace& ws, CombineHarvester& cb,
 
   // Now we move into a phase of building all the objects we need:
 
+  // If the user supplied a cache the converted input histograms are taken
+  // from it, so that templates shared with other calls are only converted
+  // once. The TList below needs histograms we own, so a cached one is copied.
+  auto rebinned = [&](TH1 const* hist) {
+    return cache ? std::make_shared<TH1F>(*cache->GetTH1F(hist, true))
+                 : std::make_shared<TH1F>(TemplateCache::Convert(hist, true));
+  };
   // 2D array of all input histograms, size is (mass points * (nominal +
   // 2*shape-systs)). The factor of 2 needed for the Up and Down shapes
   multi_array<std::shared_ptr<TH1F>, 2> hist_arr(extents[m][1+ss*2]);
@@ -314,8 +282,7 @@ std::string BuildRooMorphing(RooWorkspace& ws, CombineHarvester& cb,
     // histogram to a uniform integer binning, because this is what
     // text2workspace will do for all the non-morphed processes in our datacard,
     // and we need the binning of these to be in sync.
-    hist_arr[mi][0] =
-        std::make_shared<TH1F>(RebinHist(AsTH1F(pr_arr[mi]->shape())));
+    hist_arr[mi][0] = rebinned(pr_arr[mi]->shape());
     // If the user supplied a TFile pointer we'll dump a bunch of info into it
     // for debugging
     if (file) {
@@ -327,10 +294,8 @@ std::string BuildRooMorphing(RooWorkspace& ws, CombineHarvester& cb,
     proc_hist->IntegralAndError(1, proc_hist->GetNbinsX(), rate_unc_arr[mi]);
     // Do the same for the Up and Down shapes
     for (unsigned ssi = 0; ssi < ss; ++ssi) {
-      hist_arr[mi][1 + 2 * ssi] =
-          std::make_shared<TH1F>(RebinHist(AsTH1F(ss_arr[ssi][mi]->shape_u())));
-      hist_arr[mi][2 + 2 * ssi] =
-          std::make_shared<TH1F>(RebinHist(AsTH1F(ss_arr[ssi][mi]->shape_d())));
+      hist_arr[mi][1 + 2 * ssi] = rebinned(ss_arr[ssi][mi]->shape_u());
+      hist_arr[mi][2 + 2 * ssi] = rebinned(ss_arr[ssi][mi]->shape_d());
       if (file) {
         file->WriteTObject(ss_arr[ssi][mi]->shape_u(),
                            key + "_" + m_str_vec[mi] + "_" + ss_vec[ssi] + "Up");
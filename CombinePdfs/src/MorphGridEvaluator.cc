@@ -0,0 +1,440 @@
+#include "CombineHarvester/CombinePdfs/interface/MorphGridEvaluator.h"
+#include <algorithm>
+#include <cmath>
+#include <memory>
+#include <set>
+#include <string>
+#include <vector>
+#include "boost/format.hpp"
+#include "TString.h"
+#include "RooAbsPdf.h"
+#include "CombineHarvester/CombineTools/interface/Logging.h"
+#include "CombineHarvester/CombineTools/interface/Parallel.h"
+#include "CombineHarvester/CombinePdfs/interface/MorphModelGrid.h"
+
+namespace ch {
+
+namespace {
+// The bin contents of a histogram scaled to unit sum (if it is not empty)
+std::vector<double> Normalised(TH1F const& h) {
+  std::vector<double> res(h.GetNbinsX());
+  double sum = 0.;
+  for (unsigned i = 0; i < res.size(); ++i) {
+    res[i] = h.GetBinContent(i + 1);
+    sum += res[i];
+  }
+  if (sum > 0.) {
+    for (double & val : res) val /= sum;
+  }
+  return res;
+}
+
+// The smooth step used in the vertical interpolation: a fifth-order
+// polynomial for |x| < q, and +/-1 beyond
+double SmoothStep(double x, double q) {
+  if (std::fabs(x) >= q) return x > 0. ? 1. : -1.;
+  double xn = x / q;
+  double xn2 = xn * xn;
+  return 0.125 * xn * (xn2 * (3. * xn2 - 10.) + 15.);
+}
+
+// Interpolate between two distributions h1 (w = 0) and h2 (w = 1) with the
+// same binning, by linear interpolation of their inverse cumulative
+// distributions. The result is normalised to unity. If either input is empty
+// we fall back to a simple linear interpolation of the bin contents.
+std::vector<double> CDFMorph(std::vector<double> const& edges,
+                             std::vector<double> const& h1,
+                             std::vector<double> const& h2, double w) {
+  unsigned n = h1.size();
+  std::vector<double> c1(n + 1, 0.);
+  std::vector<double> c2(n + 1, 0.);
+  for (unsigned i = 0; i < n; ++i) {
+    c1[i + 1] = c1[i] + h1[i];
+    c2[i + 1] = c2[i] + h2[i];
+  }
+  std::vector<double> res(n, 0.);
+  if (c1[n] <= 0. || c2[n] <= 0.) {
+    for (unsigned i = 0; i < n; ++i) res[i] = (1. - w) * h1[i] + w * h2[i];
+    return res;
+  }
+  for (unsigned i = 0; i <= n; ++i) {
+    c1[i] /= c1[n];
+    c2[i] /= c2[n];
+  }
+  // The set of cumulative levels at which both inverses are evaluated
+  std::vector<double> levels;
+  levels.reserve(2 * (n + 1));
+  std::merge(c1.begin(), c1.end(), c2.begin(), c2.end(),
+             std::back_inserter(levels));
+  levels.erase(std::unique(levels.begin(), levels.end()), levels.end());
+
+  // The inverse of a piecewise-linear cumulative distribution. The levels are
+  // increasing, so the segment index k only ever has to move forwards.
+  auto inverse = [&](std::vector<double> const& c, double y, unsigned & k) {
+    if (y >= 1.) {
+      unsigned last = n;
+      while (last > 1 && c[last - 1] >= 1.) --last;
+      return edges[last];
+    }
+    while (k + 1 < n && c[k + 1] <= y) ++k;
+    return edges[k] +
+           (y - c[k]) / (c[k + 1] - c[k]) * (edges[k + 1] - edges[k]);
+  };
+  std::vector<double> x(levels.size());
+  unsigned k1 = 0;
+  unsigned k2 = 0;
+  for (unsigned j = 0; j < levels.size(); ++j) {
+    x[j] = (1. - w) * inverse(c1, levels[j], k1) +
+           w * inverse(c2, levels[j], k2);
+  }
+
+  // Evaluate the interpolated cumulative distribution at each bin edge
+  std::vector<double> c(n + 1, 0.);
+  unsigned j = 0;
+  for (unsigned i = 0; i <= n; ++i) {
+    double e = edges[i];
+    if (e <= x.front()) {
+      c[i] = 0.;
+    } else if (e >= x.back()) {
+      c[i] = 1.;
+    } else {
+      while (j + 1 < x.size() && x[j + 1] <= e) ++j;
+      c[i] = levels[j] +
+             (e - x[j]) / (x[j + 1] - x[j]) * (levels[j + 1] - levels[j]);
+    }
+  }
+  for (unsigned i = 0; i < n; ++i) res[i] = std::max(0., c[i + 1] - c[i]);
+  return res;
+}
+
+// Same as AsymPow: kappa_hi^x for x >= 0, kappa_lo^-x for x < 0
+double AsymPowVal(double k_lo, double k_hi, double x) {
+  return x >= 0. ? std::pow(k_hi, x) : std::pow(k_lo, -x);
+}
+}
+
+MorphGridEvaluator::MorphGridEvaluator(CombineHarvester & cb,
+                                       std::string const& bin,
+                                       std::string const& process,
+                                       bool allow_morph,
+                                       bool force_template_limit,
+                                       TemplateCache * cache)
+    : key_(bin + "_" + process),
+      allow_morph_(allow_morph),
+      force_template_limit_(force_template_limit),
+      qrange_(1.) {
+  using boost::extents;
+  CombineHarvester cb_bp = cb.cp().bin({bin}).process({process});
+  MorphModelGrid grid(cb_bp, {"shape"}, true);
+  if (grid.m() == 0) {
+    throw std::runtime_error(
+        FNERROR("No Process entries found for " + bin + "," + process));
+  }
+  // Converted templates are only kept in the cache, if the user supplied one
+  auto converted = [&](TH1 const* h) {
+    return cache ? cache->GetTH1F(h, false)
+                 : std::make_shared<TH1F const>(TemplateCache::Convert(h, false));
+  };
+
+  unsigned m = grid.m();
+  unsigned ss = grid.ss();
+  m_vec_ = grid.m_vec;
+
+  // Take the input binning from the first nominal template, and the target
+  // binning from the observed data
+  std::shared_ptr<TH1F const> h0 = converted(grid.pr_arr[0]->shape());
+  unsigned nf = h0->GetNbinsX();
+  for (unsigned i = 1; i <= nf + 1; ++i) {
+    fine_edges_.push_back(h0->GetBinLowEdge(i));
+  }
+  target_ = cb_bp.GetObservedShape();
+  target_.SetDirectory(nullptr);
+  target_.Reset();
+  std::vector<double> target_edges;
+  for (int i = 1; i <= target_.GetNbinsX() + 1; ++i) {
+    target_edges.push_back(target_.GetBinLowEdge(i));
+  }
+  target_idx_.resize(nf);
+  for (unsigned i = 0; i < nf; ++i) {
+    double center = 0.5 * (fine_edges_[i] + fine_edges_[i + 1]);
+    int idx = int(std::upper_bound(target_edges.begin(), target_edges.end(),
+                                   center) - target_edges.begin()) - 1;
+    target_idx_[i] = (idx >= 0 && idx < target_.GetNbinsX()) ? idx : -1;
+  }
+
+  ss_vec_ = grid.ss_vec;
+  ss_val_vec_.assign(ss, 0.);
+  ss_scale_vec_.resize(ss);
+  for (unsigned ssi = 0; ssi < ss; ++ssi) {
+    ss_scale_vec_[ssi] = grid.ss_arr[ssi][0]->scale();
+    // Follow what ShapeTools.py does and set the smoothing region to the
+    // minimum of all of the shape scales
+    if (ss_scale_vec_[ssi] < qrange_) qrange_ = ss_scale_vec_[ssi];
+  }
+
+  nominal_arr_.resize(extents[m][nf]);
+  diff_arr_.resize(extents[m][ss][nf]);
+  sum_arr_.resize(extents[m][ss][nf]);
+  rate_vec_.resize(m);
+  ss_k_hi_arr_.resize(extents[ss][m]);
+  ss_k_lo_arr_.resize(extents[ss][m]);
+  auto normalised = [&](TH1 const* h) {
+    std::vector<double> res = Normalised(*converted(h));
+    if (res.size() != nf) {
+      throw std::runtime_error(FNERROR(
+          "All templates for " + bin + "," + process +
+          " must have the same binning"));
+    }
+    return res;
+  };
+  for (unsigned mi = 0; mi < m; ++mi) {
+    std::vector<double> nom = normalised(grid.pr_arr[mi]->shape());
+    std::copy(nom.begin(), nom.end(), nominal_arr_[mi].begin());
+    rate_vec_[mi] = grid.pr_arr[mi]->rate();
+    for (unsigned ssi = 0; ssi < ss; ++ssi) {
+      Systematic const* sys = grid.ss_arr[ssi][mi];
+      std::vector<double> hi = normalised(sys->shape_u());
+      std::vector<double> lo = normalised(sys->shape_d());
+      for (unsigned i = 0; i < nf; ++i) {
+        diff_arr_[mi][ssi][i] = 0.5 * (hi[i] - lo[i]);
+        sum_arr_[mi][ssi][i] = 0.5 * (hi[i] + lo[i]) - nom[i];
+      }
+      // For the normalisation we scale the kappa instead of the parameter
+      ss_k_hi_arr_[ssi][mi] = sys->value_u();
+      ss_k_lo_arr_[ssi][mi] = sys->value_d();
+      if (std::fabs(ss_scale_vec_[ssi] - 1.0) > 1E-6) {
+        ss_k_hi_arr_[ssi][mi] = std::pow(sys->value_u(), ss_scale_vec_[ssi]);
+        ss_k_lo_arr_[ssi][mi] = std::pow(sys->value_d(), ss_scale_vec_[ssi]);
+      }
+    }
+  }
+
+  // Only the lnN systematics with a value that varies with mass affect the
+  // yield here, the others are left as a normal lnN in the datacard
+  std::vector<unsigned> lms_idx;
+  for (unsigned lsi = 0; lsi < grid.ls(); ++lsi) {
+    std::set<double> k_hi;
+    std::set<double> k_lo;
+    for (unsigned mi = 0; mi < m; ++mi) {
+      Systematic const* n = grid.ls_arr[lsi][mi];
+      k_hi.insert(n->value_u());
+      if (n->asymm()) k_lo.insert(n->value_d());
+    }
+    if (k_hi.size() > 1 || k_lo.size() > 1) {
+      lms_vec_.push_back(grid.ls_vec[lsi]);
+      lms_idx.push_back(lsi);
+    }
+  }
+  lms_val_vec_.assign(lms_vec_.size(), 0.);
+  lms_k_hi_arr_.resize(extents[lms_vec_.size()][m]);
+  lms_k_lo_arr_.resize(extents[lms_vec_.size()][m]);
+  for (unsigned lmsi = 0; lmsi < lms_vec_.size(); ++lmsi) {
+    for (unsigned mi = 0; mi < m; ++mi) {
+      Systematic const* n = grid.ls_arr[lms_idx[lmsi]][mi];
+      lms_k_hi_arr_[lmsi][mi] = n->value_u();
+      lms_k_lo_arr_[lmsi][mi] = n->asymm() ? n->value_d() : 1. / n->value_u();
+    }
+  }
+}
+
+MorphGridEvaluator& MorphGridEvaluator::SetParameter(std::string const& name,
+                                                     double val) {
+  auto ss_it = std::find(ss_vec_.begin(), ss_vec_.end(), name);
+  if (ss_it != ss_vec_.end()) ss_val_vec_[ss_it - ss_vec_.begin()] = val;
+  auto lms_it = std::find(lms_vec_.begin(), lms_vec_.end(), name);
+  if (lms_it != lms_vec_.end()) lms_val_vec_[lms_it - lms_vec_.begin()] = val;
+  return *this;
+}
+
+MorphGridEvaluator& MorphGridEvaluator::ResetParameters() {
+  std::fill(ss_val_vec_.begin(), ss_val_vec_.end(), 0.);
+  std::fill(lms_val_vec_.begin(), lms_val_vec_.end(), 0.);
+  return *this;
+}
+
+std::vector<double> MorphGridEvaluator::VerticalMorph(unsigned mi) const {
+  unsigned nf = fine_edges_.size() - 1;
+  std::vector<double> res(nominal_arr_[mi].begin(), nominal_arr_[mi].end());
+  for (unsigned ssi = 0; ssi < ss_vec_.size(); ++ssi) {
+    double x = ss_val_vec_[ssi] * ss_scale_vec_[ssi];
+    if (x == 0.) continue;
+    double step = SmoothStep(x, qrange_);
+    for (unsigned i = 0; i < nf; ++i) {
+      res[i] += x * diff_arr_[mi][ssi][i] + step * sum_arr_[mi][ssi][i];
+    }
+  }
+  double sum = 0.;
+  for (double & val : res) {
+    if (val < 0.) val = 0.;
+    sum += val;
+  }
+  if (sum > 0.) {
+    for (double & val : res) val /= sum;
+  }
+  return res;
+}
+
+std::vector<double> MorphGridEvaluator::HorizontalMorph(
+    std::vector<std::vector<double>> const& vert, double mass) const {
+  if (m_vec_.size() == 1 || mass <= m_vec_.front()) return vert.front();
+  if (mass >= m_vec_.back()) return vert.back();
+  unsigned hi =
+      std::upper_bound(m_vec_.begin(), m_vec_.end(), mass) - m_vec_.begin();
+  unsigned lo = hi - 1;
+  if (!allow_morph_) {
+    return (mass - m_vec_[lo]) < (m_vec_[hi] - mass) ? vert[lo] : vert[hi];
+  }
+  double w = (mass - m_vec_[lo]) / (m_vec_[hi] - m_vec_[lo]);
+  return CDFMorph(fine_edges_, vert[lo], vert[hi], w);
+}
+
+std::vector<double> MorphGridEvaluator::ToTargetBinning(
+    std::vector<double> const& fine) const {
+  std::vector<double> res(target_.GetNbinsX(), 0.);
+  for (unsigned i = 0; i < fine.size(); ++i) {
+    if (target_idx_[i] >= 0) res[target_idx_[i]] += fine[i];
+  }
+  return res;
+}
+
+double MorphGridEvaluator::Interpolate(double const* vals, double mass) const {
+  if (m_vec_.size() == 1 || mass <= m_vec_.front()) return vals[0];
+  if (mass >= m_vec_.back()) return vals[m_vec_.size() - 1];
+  unsigned hi =
+      std::upper_bound(m_vec_.begin(), m_vec_.end(), mass) - m_vec_.begin();
+  unsigned lo = hi - 1;
+  double w = (mass - m_vec_[lo]) / (m_vec_[hi] - m_vec_[lo]);
+  return (1. - w) * vals[lo] + w * vals[hi];
+}
+
+std::vector<std::vector<double>> MorphGridEvaluator::Evaluate(
+    std::vector<double> const& masses, unsigned n_threads) const {
+  // The vertical interpolation only depends on the nuisance parameters, so is
+  // done once per mass point
+  std::vector<std::vector<double>> vert(m_vec_.size());
+  ParallelFor(vert.size(), n_threads,
+              [&](std::size_t mi) { vert[mi] = VerticalMorph(mi); });
+  std::vector<std::vector<double>> res(masses.size());
+  ParallelFor(masses.size(), n_threads, [&](std::size_t i) {
+    res[i] = ToTargetBinning(HorizontalMorph(vert, masses[i]));
+  });
+  return res;
+}
+
+std::vector<double> MorphGridEvaluator::EvaluateRates(
+    std::vector<double> const& masses) const {
+  std::vector<double> res(masses.size());
+  for (unsigned i = 0; i < masses.size(); ++i) {
+    double mass = masses[i];
+    double rate = Interpolate(rate_vec_.data(), mass);
+    // BuildRooMorphing adds extra points with zero yield just outside the
+    // range of mass points
+    if (force_template_limit_ && m_vec_.size() > 1) {
+      double dist = std::max(m_vec_.front() - mass, mass - m_vec_.back());
+      if (dist > 0.) rate *= std::max(0., 1. - dist / 1E-6);
+    }
+    for (unsigned ssi = 0; ssi < ss_vec_.size(); ++ssi) {
+      rate *= AsymPowVal(Interpolate(ss_k_lo_arr_[ssi].origin(), mass),
+                         Interpolate(ss_k_hi_arr_[ssi].origin(), mass),
+                         ss_val_vec_[ssi]);
+    }
+    for (unsigned lmsi = 0; lmsi < lms_vec_.size(); ++lmsi) {
+      rate *= AsymPowVal(Interpolate(lms_k_lo_arr_[lmsi].origin(), mass),
+                         Interpolate(lms_k_hi_arr_[lmsi].origin(), mass),
+                         lms_val_vec_[lmsi]);
+    }
+    res[i] = rate;
+  }
+  return res;
+}
+
+std::vector<TH1F> MorphGridEvaluator::EvaluateHists(
+    std::vector<double> const& masses, bool with_rate,
+    unsigned n_threads) const {
+  std::vector<std::vector<double>> shapes = Evaluate(masses, n_threads);
+  std::vector<double> rates;
+  if (with_rate) rates = EvaluateRates(masses);
+  std::vector<TH1F> res(masses.size(), target_);
+  for (unsigned i = 0; i < masses.size(); ++i) {
+    res[i].SetName(TString::Format("morph_point_%g", masses[i]));
+    for (unsigned b = 0; b < shapes[i].size(); ++b) {
+      res[i].SetBinContent(b + 1, shapes[i][b]);
+    }
+    if (with_rate) res[i].Scale(rates[i]);
+  }
+  return res;
+}
+
+double MorphGridEvaluator::Validate(RooWorkspace & ws, RooRealVar & mass_var,
+                                   std::vector<double> const& masses,
+                                   double tolerance,
+                                   std::string const& norm_postfix) const {
+  RooAbsPdf * pdf = ws.pdf((key_ + "_morph").c_str());
+  RooAbsReal * norm = ws.function((key_ + "_morph_" + norm_postfix).c_str());
+  RooRealVar * x = ws.var("CMS_th1x");
+  if (!pdf || !norm || !x) {
+    throw std::runtime_error(
+        FNERROR("Morphing model for " + key_ + " not found in workspace"));
+  }
+  std::vector<std::vector<double>> shapes = Evaluate(masses);
+  std::vector<double> rates = EvaluateRates(masses);
+
+  // Set the nuisance parameters, keeping the old values to restore at the end
+  std::vector<std::pair<RooRealVar *, double>> backup;
+  backup.emplace_back(&mass_var, mass_var.getVal());
+  backup.emplace_back(x, x->getVal());
+  auto set_param = [&](std::string const& name, double val) {
+    RooRealVar * var = ws.var(name.c_str());
+    if (!var) return;
+    backup.emplace_back(var, var->getVal());
+    var->setVal(val);
+  };
+  for (unsigned ssi = 0; ssi < ss_vec_.size(); ++ssi) {
+    set_param(ss_vec_[ssi], ss_val_vec_[ssi]);
+  }
+  for (unsigned lmsi = 0; lmsi < lms_vec_.size(); ++lmsi) {
+    set_param(lms_vec_[lmsi], lms_val_vec_[lmsi]);
+  }
+
+  // The pdf is evaluated at the bin centres of CMS_th1x, which has unit bin
+  // widths, and normalised to unity as in CombineHarvester::GetShape
+  double max_diff = 0.;
+  std::string error;
+  for (unsigned i = 0; i < masses.size() && error.empty(); ++i) {
+    mass_var.setVal(masses[i]);
+    double ws_rate = norm->getVal();
+    double rate_diff = std::fabs(rates[i] - ws_rate) /
+                       (ws_rate != 0. ? std::fabs(ws_rate) : 1.);
+    max_diff = std::max(max_diff, rate_diff);
+    if (rate_diff > tolerance) {
+      error = (boost::format("Yield differs at mass %g: %g (evaluator) vs %g "
+                             "(workspace)") % masses[i] % rates[i] % ws_rate)
+                  .str();
+      break;
+    }
+    std::vector<double> ws_shape(shapes[i].size());
+    double sum = 0.;
+    for (unsigned b = 0; b < ws_shape.size(); ++b) {
+      x->setVal(double(b) + 0.5);
+      ws_shape[b] = pdf->getVal();
+      sum += ws_shape[b];
+    }
+    for (unsigned b = 0; b < ws_shape.size(); ++b) {
+      if (sum > 0.) ws_shape[b] /= sum;
+      double diff = std::fabs(shapes[i][b] - ws_shape[b]);
+      max_diff = std::max(max_diff, diff);
+      if (diff > tolerance) {
+        error = (boost::format("Bin %i differs at mass %g: %g (evaluator) vs "
+                               "%g (workspace)") % (b + 1) % masses[i] %
+                 shapes[i][b] % ws_shape[b]).str();
+        break;
+      }
+    }
+  }
+  for (auto it = backup.rbegin(); it != backup.rend(); ++it) {
+    it->first->setVal(it->second);
+  }
+  if (!error.empty()) throw std::runtime_error(FNERROR(error));
+  return max_diff;
+}
+}
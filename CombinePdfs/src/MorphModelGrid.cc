@@ -0,0 +1,93 @@
+#include "CombineHarvester/CombinePdfs/interface/MorphModelGrid.h"
+#include <algorithm>
+#include <map>
+#include <set>
+#include <string>
+#include <vector>
+#include "boost/lexical_cast.hpp"
+#include "CombineHarvester/CombineTools/interface/Logging.h"
+
+namespace ch {
+
+MorphModelGrid::MorphModelGrid(CombineHarvester & cb,
+                               std::vector<std::string> const& shape_types,
+                               bool numeric_mass) {
+  using std::string;
+  using boost::lexical_cast;
+  using boost::extents;
+
+  std::set<string> m_set;
+  cb.ForEachProc([&](ch::Process *p) { m_set.insert(p->mass()); });
+  m_str_vec = Set2Vec(m_set);
+  if (numeric_mass || m_str_vec.size() > 1) {
+    // Sort on the numerical value. This also serves as our check that the mass
+    // values are float-convertible, as lexical_cast will throw if not.
+    std::vector<std::pair<double, string>> sorted;
+    for (auto const& s : m_str_vec) {
+      sorted.push_back(std::make_pair(lexical_cast<double>(s), s));
+    }
+    std::sort(sorted.begin(), sorted.end());
+    for (unsigned mi = 0; mi < sorted.size(); ++mi) {
+      m_vec.push_back(sorted[mi].first);
+      m_str_vec[mi] = sorted[mi].second;
+    }
+  }
+  std::map<string, unsigned> m_idx;
+  for (unsigned mi = 0; mi < m(); ++mi) m_idx[m_str_vec[mi]] = mi;
+
+  std::set<string> shape_set(shape_types.begin(), shape_types.end());
+  std::set<string> ss_set;
+  std::set<string> ls_set;
+  cb.ForEachSyst([&](ch::Systematic *n) {
+    if (shape_set.count(n->type())) {
+      ss_set.insert(n->name());
+    } else if (n->type() == "lnN") {
+      ls_set.insert(n->name());
+    }
+  });
+  ss_vec = Set2Vec(ss_set);
+  ls_vec = Set2Vec(ls_set);
+  std::map<string, unsigned> ss_idx;
+  for (unsigned ssi = 0; ssi < ss(); ++ssi) ss_idx[ss_vec[ssi]] = ssi;
+  std::map<string, unsigned> ls_idx;
+  for (unsigned lsi = 0; lsi < ls(); ++lsi) ls_idx[ls_vec[lsi]] = lsi;
+
+  pr_arr.resize(extents[m()]);
+  ss_arr.resize(extents[ss()][m()]);
+  ls_arr.resize(extents[ls()][m()]);
+  std::fill_n(pr_arr.data(), pr_arr.num_elements(), nullptr);
+  std::fill_n(ss_arr.data(), ss_arr.num_elements(), nullptr);
+  std::fill_n(ls_arr.data(), ls_arr.num_elements(), nullptr);
+
+  cb.ForEachProc([&](ch::Process *p) { pr_arr[m_idx.at(p->mass())] = p; });
+  cb.ForEachSyst([&](ch::Systematic *n) {
+    auto mi = m_idx.find(n->mass());
+    if (mi == m_idx.end()) return;
+    if (shape_set.count(n->type())) {
+      ss_arr[ss_idx.at(n->name())][mi->second] = n;
+    } else if (n->type() == "lnN") {
+      ls_arr[ls_idx.at(n->name())][mi->second] = n;
+    }
+  });
+
+  // Now check if all systematics are present for all mass points
+  for (unsigned ssi = 0; ssi < ss(); ++ssi) {
+    for (unsigned mi = 0; mi < m(); ++mi) {
+      if (!ss_arr[ssi][mi]) {
+        throw std::runtime_error(FNERROR(
+            "Some mass points do not have the full set of shape systematics, "
+            "this is currently unsupported"));
+      }
+    }
+  }
+  for (unsigned lsi = 0; lsi < ls(); ++lsi) {
+    for (unsigned mi = 0; mi < m(); ++mi) {
+      if (!ls_arr[lsi][mi]) {
+        throw std::runtime_error(FNERROR(
+            "The lnN systematic " + ls_vec[lsi] + " is missing for mass point " +
+            m_str_vec[mi] + ", this is currently unsupported"));
+      }
+    }
+  }
+}
+}
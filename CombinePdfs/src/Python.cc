@@ -1,5 +1,6 @@
 #include "CombineHarvester/CombinePdfs/interface/Python.h"
 #include "CombineHarvester/CombinePdfs/interface/MorphFunctions.h"
+#include "CombineHarvester/CombinePdfs/interface/MorphGridEvaluator.h"
 #include "boost/python.hpp"
 #include "TFile.h"
 namespace py = boost::python;
@@ -8,17 +9,77 @@ namespace py = boost::python;
 void BuildRooMorphingPy(bp::object & ws, ch::CombineHarvester& cb,
                       std::string const& bin, std::string const& process,
                       bp::object & mass_var, std::string norm_postfix,
-                      bool allow_morph, bool verbose, bool force_template_limit, bp::object & file) {
+                      bool allow_morph, bool verbose, bool force_template_limit, bp::object & file,
+                      bp::object & cache) {
   RooWorkspace *ws_ = (RooWorkspace*)(TPython::ObjectProxy_AsVoidPtr(ws.ptr()));
   RooAbsReal *mass_var_ = (RooAbsReal*)(TPython::ObjectProxy_AsVoidPtr(mass_var.ptr()));
   TFile *file_ = nullptr;
   if (!file.is_none()) {
     file_ = (TFile*)(TPython::ObjectProxy_AsVoidPtr(file.ptr()));
   }
-  BuildRooMorphing(*ws_, cb, bin, process, *mass_var_, norm_postfix, allow_morph, verbose, force_template_limit, file_);
+  ch::TemplateCache *cache_ = nullptr;
+  if (!cache.is_none()) {
+    cache_ = bp::extract<ch::TemplateCache*>(cache);
+  }
+  BuildRooMorphing(*ws_, cb, bin, process, *mass_var_, norm_postfix, allow_morph, verbose, force_template_limit, file_, cache_);
+}
+
+namespace {
+std::vector<double> ListToVector(bp::object const& list) {
+  std::vector<double> res;
+  for (int i = 0; i < bp::len(list); ++i) {
+    res.push_back(bp::extract<double>(list[i]));
+  }
+  return res;
+}
+}
+
+bp::list MorphGridEvaluatePy(ch::MorphGridEvaluator const& eval,
+                             bp::object const& masses, unsigned n_threads) {
+  bp::list res;
+  for (auto const& shape : eval.Evaluate(ListToVector(masses), n_threads)) {
+    bp::list bins;
+    for (double val : shape) bins.append(val);
+    res.append(bins);
+  }
+  return res;
+}
+
+bp::list MorphGridEvaluateRatesPy(ch::MorphGridEvaluator const& eval,
+                                  bp::object const& masses) {
+  bp::list res;
+  for (double val : eval.EvaluateRates(ListToVector(masses))) res.append(val);
+  return res;
+}
+
+double MorphGridValidatePy(ch::MorphGridEvaluator const& eval, bp::object & ws,
+                           bp::object & mass_var, bp::object const& masses,
+                           double tolerance, std::string const& norm_postfix) {
+  RooWorkspace *ws_ = (RooWorkspace*)(TPython::ObjectProxy_AsVoidPtr(ws.ptr()));
+  RooRealVar *mass_var_ = (RooRealVar*)(TPython::ObjectProxy_AsVoidPtr(mass_var.ptr()));
+  return eval.Validate(*ws_, *mass_var_, ListToVector(masses), tolerance,
+                       norm_postfix);
 }
 
 BOOST_PYTHON_MODULE(libCombineHarvesterCombinePdfs)
 {
+  py::class_<ch::TemplateCache, boost::noncopyable>("TemplateCache")
+      .def("Clear", &ch::TemplateCache::Clear)
+      .def("Size", &ch::TemplateCache::Size)
+      .def("Hits", &ch::TemplateCache::Hits)
+      .def("Misses", &ch::TemplateCache::Misses);
+  py::class_<ch::MorphGridEvaluator>("MorphGridEvaluator",
+      py::init<ch::CombineHarvester&, std::string const&, std::string const&,
+               py::optional<bool, bool>>())
+      .def("SetParameter", &ch::MorphGridEvaluator::SetParameter,
+           py::return_internal_reference<>())
+      .def("ResetParameters", &ch::MorphGridEvaluator::ResetParameters,
+           py::return_internal_reference<>())
+      .def("Evaluate", MorphGridEvaluatePy,
+           (py::arg("masses"), py::arg("n_threads") = 1))
+      .def("EvaluateRates", MorphGridEvaluateRatesPy)
+      .def("Validate", MorphGridValidatePy,
+           (py::arg("ws"), py::arg("mass_var"), py::arg("masses"),
+            py::arg("tolerance") = 1E-4, py::arg("norm_postfix") = "norm"));
   py::def("BuildRooMorphingX", BuildRooMorphingPy);
 }
@@ -0,0 +1,77 @@
+#include "CombineHarvester/CombinePdfs/interface/TemplateCache.h"
+#include <memory>
+#include <mutex>
+#include "TDirectory.h"
+#include "CombineHarvester/CombineTools/interface/Utilities.h"
+#include "CombineHarvester/CombinePdfs/interface/MorphFunctions.h"
+
+namespace ch {
+
+TH1F TemplateCache::Convert(TH1 const* hist, bool rebin) {
+  TDirectory::TContext no_dir(nullptr);
+  return rebin ? RebinHist(AsTH1F(hist)) : AsTH1F(hist);
+}
+
+std::shared_ptr<TH1F const> TemplateCache::GetTH1F(TH1 const* hist,
+                                                   bool rebin) {
+  auto key = std::make_pair(hist, rebin);
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto it = th1f_.find(key);
+    if (it != th1f_.end()) {
+      ++hits_;
+      return it->second;
+    }
+  }
+  // Do the conversion without holding the lock, so that other threads can
+  // still use the cache. If two threads convert the same template at once the
+  // first one to finish wins.
+  auto res = std::make_shared<TH1F>(Convert(hist, rebin));
+  res->SetDirectory(nullptr);
+  std::lock_guard<std::mutex> lock(mutex_);
+  ++misses_;
+  return th1f_.emplace(key, std::move(res)).first->second;
+}
+
+std::shared_ptr<RooDataHist const> TemplateCache::GetRooDataHist(
+    TH1 const* hist, RooRealVar const& x) {
+  auto key = std::make_pair(hist, &x);
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto it = rdh_.find(key);
+    if (it != rdh_.end()) {
+      ++hits_;
+      return it->second;
+    }
+  }
+  // TH1F2Data does its own conversion to a uniform integer binning
+  auto res = std::make_shared<RooDataHist>(
+      TH1F2Data(*GetTH1F(hist, false), x, hist->GetName()));
+  std::lock_guard<std::mutex> lock(mutex_);
+  ++misses_;
+  return rdh_.emplace(key, std::move(res)).first->second;
+}
+
+void TemplateCache::Clear() {
+  std::lock_guard<std::mutex> lock(mutex_);
+  th1f_.clear();
+  rdh_.clear();
+  hits_ = 0;
+  misses_ = 0;
+}
+
+std::size_t TemplateCache::Size() const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return th1f_.size() + rdh_.size();
+}
+
+std::size_t TemplateCache::Hits() const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return hits_;
+}
+
+std::size_t TemplateCache::Misses() const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return misses_;
+}
+}
@@ -0,0 +1,364 @@
+#include <string>
+#include <map>
+#include <vector>
+#include <memory>
+#include <chrono>
+#include <fstream>
+#include <iostream>
+#include <functional>
+#include <cmath>
+#include "boost/program_options.hpp"
+#include "boost/format.hpp"
+#include "boost/algorithm/string.hpp"
+#include "boost/lexical_cast.hpp"
+#include "TFile.h"
+#include "TH1F.h"
+#include "TRandom3.h"
+#include "RooRealVar.h"
+#include "RooArgList.h"
+#include "RooFitResult.h"
+#include "CombineHarvester/CombineTools/interface/CombineHarvester.h"
+#include "CombineHarvester/CombineTools/interface/Systematics.h"
+#include "CombineHarvester/CombineTools/interface/BinByBin.h"
+#include "CombineHarvester/CombineTools/interface/AutoRebin.h"
+#include "CombineHarvester/CombineTools/interface/TFileIO.h"
+#include "CombineHarvester/CombineTools/interface/Logging.h"
+#include "CombineHarvester/CombineTools/interface/json.hpp"
+
+namespace po = boost::program_options;
+
+using namespace std;
+using json = nlohmann::json;
+
+// The size of a synthetic model
+struct ModelScale {
+  unsigned categories;
+  unsigned processes;
+  unsigned systematics;
+  unsigned bins;
+};
+
+// Parse a scale of the form "N:M:K:B"
+ModelScale ParseScale(string const& str) {
+  vector<string> words;
+  boost::split(words, str, boost::is_any_of(":"));
+  if (words.size() != 4) {
+    throw runtime_error(FNERROR("Scale \"" + str +
+                                "\" is not of the form N:M:K:B"));
+  }
+  ModelScale scale;
+  scale.categories = boost::lexical_cast<unsigned>(words[0]);
+  scale.processes = boost::lexical_cast<unsigned>(words[1]);
+  scale.systematics = boost::lexical_cast<unsigned>(words[2]);
+  scale.bins = boost::lexical_cast<unsigned>(words[3]);
+  if (scale.categories == 0 || scale.processes == 0 || scale.bins == 0) {
+    throw runtime_error(FNERROR("Scale \"" + str +
+                                "\" must have at least one category, "
+                                "process and bin"));
+  }
+  return scale;
+}
+
+// Write the nominal, data and systematic templates of a synthetic model to
+// `filename`. Every category contains one signal ("sig") and M-1 background
+// ("bkg1", "bkg2", ...) processes, each with a falling spectrum of B bins.
+// The first `n_shape` systematics are shape uncertainties, for which up and
+// down templates are written for every process, and the rest are lnN.
+void WriteTemplates(string const& filename, ModelScale const& scale,
+                    unsigned n_shape, TRandom3& rng) {
+  TFile file(filename.c_str(), "RECREATE");
+  for (unsigned c = 0; c < scale.categories; ++c) {
+    string cat = "cat" + boost::lexical_cast<string>(c);
+    TH1F data("data_obs", "data_obs", scale.bins, 0., double(scale.bins));
+    for (unsigned p = 0; p < scale.processes; ++p) {
+      string proc = p == 0 ? "sig" : "bkg" + boost::lexical_cast<string>(p);
+      double norm = p == 0 ? 10. : 1000. / double(p);
+      TH1F nom(proc.c_str(), proc.c_str(), scale.bins, 0., double(scale.bins));
+      for (unsigned b = 1; b <= scale.bins; ++b) {
+        double val = norm * std::exp(-double(b) / double(scale.bins)) *
+                     rng.Uniform(0.8, 1.2);
+        nom.SetBinContent(b, val);
+        nom.SetBinError(b, std::sqrt(val) * rng.Uniform(0.05, 0.5));
+      }
+      if (p > 0) data.Add(&nom);
+      ch::WriteToTFile(&nom, &file, cat + "/" + proc);
+      for (unsigned s = 0; s < n_shape; ++s) {
+        string syst = "shape" + boost::lexical_cast<string>(s);
+        for (string const& dir : {"Up", "Down"}) {
+          TH1F shifted(nom);
+          double sign = dir == "Up" ? 1. : -1.;
+          for (unsigned b = 1; b <= scale.bins; ++b) {
+            double shift = 0.05 * (double(b) / double(scale.bins) - 0.5);
+            shifted.SetBinContent(
+                b, nom.GetBinContent(b) *
+                       (1. + sign * (shift + rng.Uniform(0., 0.02))));
+          }
+          ch::WriteToTFile(&shifted, &file, cat + "/" + proc + "_" + syst + dir);
+        }
+      }
+    }
+    for (unsigned b = 1; b <= scale.bins; ++b) {
+      data.SetBinContent(b, std::floor(data.GetBinContent(b) + 0.5));
+      data.SetBinError(b, std::sqrt(data.GetBinContent(b)));
+    }
+    ch::WriteToTFile(&data, &file, cat + "/data_obs");
+  }
+  file.Close();
+}
+
+// Define the observations, processes and systematics of the synthetic model
+void DefineModel(ch::CombineHarvester& cb, ModelScale const& scale,
+                 unsigned n_shape) {
+  ch::Categories cats;
+  for (unsigned c = 0; c < scale.categories; ++c) {
+    cats.push_back({int(c), "cat" + boost::lexical_cast<string>(c)});
+  }
+  vector<string> bkgs;
+  for (unsigned p = 1; p < scale.processes; ++p) {
+    bkgs.push_back("bkg" + boost::lexical_cast<string>(p));
+  }
+  cb.AddObservations({"*"}, {"bench"}, {"13TeV"}, {"syn"}, cats);
+  cb.AddProcesses({"*"}, {"bench"}, {"13TeV"}, {"syn"}, bkgs, cats, false);
+  cb.AddProcesses({"*"}, {"bench"}, {"13TeV"}, {"syn"}, {"sig"}, cats, true);
+  for (unsigned s = 0; s < scale.systematics; ++s) {
+    if (s < n_shape) {
+      cb.cp().AddSyst(cb, "shape" + boost::lexical_cast<string>(s), "shape",
+                      ch::syst::SystMap<>::init(1.0));
+    } else {
+      cb.cp().AddSyst(cb, "lnN" + boost::lexical_cast<string>(s), "lnN",
+                      ch::syst::SystMap<>::init(1.0 + 0.01 * double(s % 10 + 1)));
+    }
+  }
+}
+
+// Load the templates of the synthetic model from `filename`
+void LoadTemplates(ch::CombineHarvester& cb, string const& filename) {
+  cb.ExtractShapes(filename, "$BIN/$PROCESS", "$BIN/$PROCESS_$SYSTEMATIC");
+}
+
+// Times a single operation over a number of repetitions. The `setup`
+// function is called before each repetition but is not included in the
+// timing. The timed repetitions run with the ch::Profiler disabled, so that
+// its overhead is not included. One extra repetition is then run with the
+// profiler enabled to record the time spent in each instrumented function.
+class OperationTimer {
+ public:
+  OperationTimer(unsigned repeats, json& results)
+      : repeats_(repeats), results_(results) {}
+
+  void Time(string const& label, function<void()> setup,
+            function<void()> operation) {
+    double total = 0.;
+    double min = 0.;
+    ch::Profiler & profiler = ch::Profiler::Instance();
+    profiler.SetEnabled(false);
+    for (unsigned r = 0; r < repeats_; ++r) {
+      setup();
+      auto start = chrono::steady_clock::now();
+      operation();
+      auto end = chrono::steady_clock::now();
+      double elapsed = chrono::duration<double>(end - start).count();
+      total += elapsed;
+      if (r == 0 || elapsed < min) min = elapsed;
+    }
+    json & res = results_[label];
+    res["repeats"] = repeats_;
+    res["mean_s"] = total / double(repeats_);
+    res["min_s"] = min;
+    setup();
+    profiler.Reset();
+    profiler.SetEnabled(true);
+    operation();
+    profiler.SetEnabled(false);
+    for (auto const& it : profiler.Timers()) {
+      res["profile"][it.first] = {
+          {"calls", it.second.calls},
+          {"total_s", double(it.second.total_ns) * 1E-9}};
+    }
+    cout << boost::format("  %-30s mean [s]: %-12.5g min [s]: %-12.5g\n") %
+                label % (total / double(repeats_)) % min;
+  }
+
+  void Time(string const& label, function<void()> operation) {
+    Time(label, []() {}, operation);
+  }
+
+ private:
+  unsigned repeats_;
+  json & results_;
+};
+
+int main(int argc, char* argv[]) {
+  vector<string> scales = {"2:4:10:20", "5:8:30:50", "10:10:60:100"};
+  double shape_frac = 0.5;
+  unsigned repeats  = 3;
+  unsigned samples  = 100;
+  unsigned seed     = 1234;
+  string workdir    = ".";
+  string output     = "benchmark.json";
+
+  po::options_description help_config("Help");
+  help_config.add_options()
+    ("help,h", "produce help message");
+  po::options_description config("Configuration");
+  config.add_options()
+    ("scales",
+      po::value<vector<string>>(&scales)->multitoken(),
+      "Model sizes to benchmark, each in the format N:M:K:B for N categories, "
+      "M processes, K systematics and B bins per category "
+      "(default: 2:4:10:20 5:8:30:50 10:10:60:100)")
+    ("shape-fraction",
+      po::value<double>(&shape_frac)->default_value(shape_frac),
+      "Fraction of the systematics that are shape (rather than lnN) uncertainties")
+    ("repeats,r",
+      po::value<unsigned>(&repeats)->default_value(repeats),
+      "Number of times each operation is repeated")
+    ("samples",
+      po::value<unsigned>(&samples)->default_value(samples),
+      "Number of toys used for the sampled uncertainty")
+    ("seed",
+      po::value<unsigned>(&seed)->default_value(seed),
+      "Random seed for the template generation")
+    ("workdir",
+      po::value<string>(&workdir)->default_value(workdir),
+      "Directory in which the generated templates and datacards are written")
+    ("output,o",
+      po::value<string>(&output)->default_value(output),
+      "Name of the output json file containing the results");
+
+  po::variables_map vm;
+  po::store(po::command_line_parser(argc, argv)
+                .options(help_config)
+                .allow_unregistered()
+                .run(),
+            vm);
+  po::notify(vm);
+  if (vm.count("help")) {
+    cout << config << "\n";
+    cout << "Example usage: " << endl;
+    cout << "Benchmark --scales 2:4:10:20 10:10:60:100 --shape-fraction 0.3 "
+            "-r 5 -o benchmark.json\n";
+    return 1;
+  }
+  po::store(po::command_line_parser(argc, argv).options(config).run(), vm);
+  po::notify(vm);
+
+  if (repeats == 0) repeats = 1;
+  TRandom3 rng(seed);
+
+  json output_js;
+  output_js["config"] = {{"shape_fraction", shape_frac},
+                         {"repeats", repeats},
+                         {"samples", samples},
+                         {"seed", seed}};
+  output_js["results"] = json::array();
+
+  for (auto const& scale_str : scales) {
+    ModelScale scale = ParseScale(scale_str);
+    unsigned n_shape = unsigned(shape_frac * double(scale.systematics) + 0.5);
+    if (n_shape > scale.systematics) n_shape = scale.systematics;
+    cout << boost::format(
+                ">> Model with %i categories, %i processes, %i systematics "
+                "(%i shape) and %i bins\n") %
+                scale.categories % scale.processes % scale.systematics %
+                n_shape % scale.bins;
+
+    string tag = boost::replace_all_copy(scale_str, ":", "_");
+    string templates = workdir + "/benchmark_" + tag + "_input.root";
+    string card = workdir + "/benchmark_" + tag + ".txt";
+    string card_root = workdir + "/benchmark_" + tag + ".root";
+    WriteTemplates(templates, scale, n_shape, rng);
+
+    json scale_js;
+    scale_js["scale"] = {{"categories", scale.categories},
+                         {"processes", scale.processes},
+                         {"systematics", scale.systematics},
+                         {"shape_systematics", n_shape},
+                         {"bins", scale.bins}};
+    json & res = scale_js["operations"];
+    OperationTimer timer(repeats, res);
+
+    ch::CombineHarvester cb;
+    cb.SetVerbosity(0);
+    unique_ptr<ch::CombineHarvester> work;
+    auto fresh = [&]() { work.reset(new ch::CombineHarvester()); };
+    auto copy = [&]() { work.reset(new ch::CombineHarvester(cb.deep())); };
+
+    timer.Time("ExtractShapes",
+               [&]() {
+                 fresh();
+                 DefineModel(*work, scale, n_shape);
+               },
+               [&]() { LoadTemplates(*work, templates); });
+    DefineModel(cb, scale, n_shape);
+    LoadTemplates(cb, templates);
+
+    timer.Time("WriteDatacard",
+               [&]() { cb.cp().WriteDatacard(card, card_root); });
+
+    timer.Time("ParseDatacard", fresh, [&]() {
+      work->ParseDatacard(card, "bench", "13TeV", "syn", 0, "*");
+    });
+
+    vector<string> some_bins = {"cat0"};
+    vector<string> some_procs = {"sig", "bkg1"};
+    timer.Time("FilterChain", [&]() {
+      for (unsigned i = 0; i < 10; ++i) {
+        cb.cp().bin(some_bins).process(some_procs, false).syst_type({"shape"})
+            .signals().GetRate();
+      }
+    });
+
+    timer.Time("GetRate", [&]() { cb.cp().GetRate(); });
+    timer.Time("GetShape", [&]() { cb.cp().GetShape(); });
+    timer.Time("GetUncertainty", [&]() { cb.cp().GetUncertainty(); });
+
+    // A pre-fit result with unit uncertainties on every parameter is enough
+    // to exercise the sampling
+    vector<unique_ptr<RooRealVar>> vars;
+    RooArgList var_list;
+    for (auto const& par : cb.GetParameters()) {
+      vars.emplace_back(new RooRealVar(par.name().c_str(), "", 0., -7., 7.));
+      vars.back()->setError(1.);
+      var_list.add(*(vars.back()));
+    }
+    unique_ptr<RooFitResult> fit(RooFitResult::prefitResult(var_list));
+    timer.Time("GetUncertaintySampled",
+               [&]() { cb.cp().GetUncertainty(*fit, samples); });
+    timer.Time("GetShapeWithUncertaintySampled",
+               [&]() { cb.cp().GetShapeWithUncertainty(*fit, samples); });
+
+    timer.Time("BinByBin", copy, [&]() {
+      auto bbb = ch::BinByBinFactory()
+        .SetAddThreshold(0.1)
+        .SetMergeThreshold(0.5)
+        .SetFixNorm(true);
+      bbb.MergeAndAdd(work->cp().backgrounds(), *work);
+    });
+
+    timer.Time("AutoRebin", copy, [&]() {
+      auto rebin = ch::AutoRebin()
+        .SetBinThreshold(5.)
+        .SetBinUncertFraction(0.5)
+        .SetRebinMode(1)
+        .SetPerformRebin(true)
+        .SetVerbosity(0);
+      rebin.Rebin(*work, *work);
+    });
+
+    vector<double> new_bins;
+    for (unsigned b = 0; b <= scale.bins; b += 2) new_bins.push_back(double(b));
+    if (new_bins.back() != double(scale.bins)) {
+      new_bins.push_back(double(scale.bins));
+    }
+    timer.Time("VariableRebin", copy,
+               [&]() { work->VariableRebin(new_bins); });
+
+    output_js["results"].push_back(scale_js);
+  }
+
+  std::ofstream outfile(output);
+  outfile << std::setw(4) << output_js << std::endl;
+  cout << ">> Results written to " << output << "\n";
+  return 0;
+}
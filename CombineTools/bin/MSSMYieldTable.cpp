@@ -9,6 +9,7 @@
 #include "CombineHarvester/CombineTools/interface/CombineHarvester.h"
 #include "CombineHarvester/CombineTools/interface/Utilities.h"
 #include "CombineHarvester/CombineTools/interface/TFileIO.h"
+#include "CombineHarvester/CombineTools/interface/YieldTable.h"
 
 namespace po = boost::program_options;
 
@@ -41,6 +42,7 @@ int main(int argc, char* argv[]) {
   string tanb           = "";
   bool postfit          = true;
   std::string header    = "";
+  unsigned threads      = 1;
 
   po::options_description config("Configuration");
   config.add_options()
@@ -63,7 +65,9 @@ int main(int argc, char* argv[]) {
     ("header",
       po::value<string>(&header)->default_value(""), "header")
     ("postfit",
-      po::value<bool>(&postfit)->required(), "postfit");
+      po::value<bool>(&postfit)->required(), "postfit")
+    ("threads",
+      po::value<unsigned>(&threads)->default_value(threads), "threads");
   po::variables_map vm;
   po::store(po::command_line_parser(argc, argv)
                 .options(config)
@@ -197,24 +201,32 @@ int main(int argc, char* argv[]) {
   // Number of times to sample from the fit covariance matrix
   unsigned samples = 500;
 
+  // Evaluate all the yields together, such that the covariance matrix is
+  // only sampled once for the whole table
+  ch::YieldTable table(cmb);
   for (unsigned i = 0; i < n_cols; ++i) {
-    ch::CombineHarvester tmp_cmb =
-        std::move(cmb.cp().era({col_info[i].era}).bin_id(col_info[i].cats_int));
-    // tmp_cmb.cp().PrintAll();
-    data_yields[i] = tmp_cmb.cp().GetObservedRate();
-    sig_yields[i] = tmp_cmb.cp().process(signal_procs).GetRate();
-    sig_errors[i] = postfit ?
-        tmp_cmb.cp().process(signal_procs).GetUncertainty(fitresult, samples) :
-        tmp_cmb.cp().process(signal_procs).GetUncertainty();
-    tot_yields[i] = tmp_cmb.cp().process(total_bkg).GetRate();
-    tot_errors[i] = postfit ?
-        tmp_cmb.cp().process(total_bkg).GetUncertainty(fitresult, samples) :
-        tmp_cmb.cp().process(total_bkg).GetUncertainty();
+    ColInfo const& info = col_info[i];
+    table.AddColumn(info.label, [info](ch::CombineHarvester & cb) {
+      cb.era({info.era}).bin_id(info.cats_int);
+    });
+  }
+  for (unsigned j = 0; j < n_bkg; ++j) table.AddRow(bkgs[j].label, bkgs[j].procs);
+  table.AddRow("Total Background", total_bkg);
+  table.AddRow("Signal", signal_procs);
+  table.Evaluate(postfit ? fitresult : nullptr, samples, threads);
+
+  for (unsigned i = 0; i < n_cols; ++i) {
+    data_yields[i] = cmb.cp()
+                         .era({col_info[i].era})
+                         .bin_id(col_info[i].cats_int)
+                         .GetObservedRate();
+    sig_yields[i] = table.Rate(n_bkg + 1, i);
+    sig_errors[i] = table.Uncertainty(n_bkg + 1, i);
+    tot_yields[i] = table.Rate(n_bkg, i);
+    tot_errors[i] = table.Uncertainty(n_bkg, i);
     for (unsigned j = 0; j < n_bkg; ++j) {
-      bkg_yields[i][j] = tmp_cmb.cp().process(bkgs[j].procs).GetRate();
-      bkg_errors[i][j] = postfit ?
-          tmp_cmb.cp().process(bkgs[j].procs).GetUncertainty(fitresult, samples) :
-          tmp_cmb.cp().process(bkgs[j].procs).GetUncertainty();
+      bkg_yields[i][j] = table.Rate(j, i);
+      bkg_errors[i][j] = table.Uncertainty(j, i);
     }
     for (unsigned k = 0; k < n_sig; ++k) {
       signal_num[i][k] = sig_cmb.cp()
@@ -308,6 +308,46 @@ int main(int argc, char* argv[]) {
 
     map<string, TH1F> post_shapes_tot;
 
+    // With the sampling method all the process and total shapes are
+    // evaluated in one go, such that the parameter samples are only drawn
+    // once and shared between all the uncertainty bands. These are stored as
+    //   sampled_shapes[<bin>][<process>]
+    // with the totals summed over all bins under the bin "".
+    map<string, map<string, TH1F>> sampled_shapes;
+    if (sampling) {
+      std::vector<ch::CombineHarvester> groups;
+      std::vector<std::pair<string, string>> labels;
+      if (total_shapes) {
+        groups.push_back(cmb.cp().backgrounds());
+        labels.push_back(make_pair("", "TotalBkg"));
+        groups.push_back(cmb.cp().signals());
+        labels.push_back(make_pair("", "TotalSig"));
+        groups.push_back(cmb.cp());
+        labels.push_back(make_pair("", "TotalProcs"));
+      }
+      for (auto bin : bins) {
+        ch::CombineHarvester cmb_bin = cmb.cp().bin({bin});
+        if (!skip_proc_errs) {
+          for (auto proc : cmb_bin.process_set()) {
+            groups.push_back(cmb_bin.cp().process({proc}));
+            labels.push_back(make_pair(bin, proc));
+          }
+        }
+        groups.push_back(cmb_bin.cp().backgrounds());
+        labels.push_back(make_pair(bin, "TotalBkg"));
+        groups.push_back(cmb_bin.cp().signals());
+        labels.push_back(make_pair(bin, "TotalSig"));
+        groups.push_back(cmb_bin.cp());
+        labels.push_back(make_pair(bin, "TotalProcs"));
+      }
+      std::cout << ">> Doing postfit: sampling " << groups.size()
+                << " shapes" << std::endl;
+      auto shapes = cmb.GetShapesWithUncertainty(groups, res, samples);
+      for (unsigned i = 0; i < shapes.size(); ++i) {
+        sampled_shapes[labels[i].first][labels[i].second] = shapes[i];
+      }
+    }
+
     if(total_shapes){
       post_shapes_tot["data_obs"] = cmb.GetObservedShape();
       // Fill the total sig. and total bkg. hists
@@ -315,15 +355,15 @@ int main(int argc, char* argv[]) {
       auto cmb_sigs = cmb.cp().signals();
       std::cout << ">> Doing postfit: TotalBkg" << std::endl;
       post_shapes_tot["TotalBkg"] =
-          sampling ? cmb_bkgs.GetShapeWithUncertainty(res, samples)
+          sampling ? sampled_shapes[""]["TotalBkg"]
                    : cmb_bkgs.GetShapeWithUncertainty();
       std::cout << ">> Doing postfit: TotalSig" << std::endl;
       post_shapes_tot["TotalSig"] =
-          sampling ? cmb_sigs.GetShapeWithUncertainty(res, samples)
+          sampling ? sampled_shapes[""]["TotalSig"]
                    : cmb_sigs.GetShapeWithUncertainty();
       std::cout << ">> Doing postfit: TotalProcs" << std::endl;
       post_shapes_tot["TotalProcs"] =
-          sampling ? cmb.cp().GetShapeWithUncertainty(res, samples)
+          sampling ? sampled_shapes[""]["TotalProcs"]
                    : cmb.cp().GetShapeWithUncertainty();
 
       if (datacard != "") {
@@ -354,7 +394,7 @@ int main(int argc, char* argv[]) {
           post_shapes[bin][proc] = cmb_proc.GetShape();
         } else {
           post_shapes[bin][proc] =
-              sampling ? cmb_proc.GetShapeWithUncertainty(res, samples)
+              sampling ? sampled_shapes[bin][proc]
                        : cmb_proc.GetShapeWithUncertainty();
         }
       }
@@ -367,15 +407,15 @@ int main(int argc, char* argv[]) {
       auto cmb_sigs = cmb_bin.cp().signals();
       std::cout << ">> Doing postfit: " << bin << "," << "TotalBkg" << std::endl;
       post_shapes[bin]["TotalBkg"] =
-          sampling ? cmb_bkgs.GetShapeWithUncertainty(res, samples)
+          sampling ? sampled_shapes[bin]["TotalBkg"]
                    : cmb_bkgs.GetShapeWithUncertainty();
       std::cout << ">> Doing postfit: " << bin << "," << "TotalSig" << std::endl;
       post_shapes[bin]["TotalSig"] =
-          sampling ? cmb_sigs.GetShapeWithUncertainty(res, samples)
+          sampling ? sampled_shapes[bin]["TotalSig"]
                    : cmb_sigs.GetShapeWithUncertainty();
       std::cout << ">> Doing postfit: " << bin << "," << "TotalProcs" << std::endl;
       post_shapes[bin]["TotalProcs"] =
-          sampling ? cmb_bin.cp().GetShapeWithUncertainty(res, samples)
+          sampling ? sampled_shapes[bin]["TotalProcs"]
                    : cmb_bin.cp().GetShapeWithUncertainty();
 
       if (datacard != "") {
@@ -23,6 +23,7 @@
 #include "CombineHarvester/CombineTools/interface/Utilities.h"
 #include "CombineHarvester/CombineTools/interface/TFileIO.h"
 #include "CombineHarvester/CombineTools/interface/SOverBTools.h"
+#include "CombineHarvester/CombineTools/interface/YieldTable.h"
 
 namespace po = boost::program_options;
 
@@ -86,31 +87,20 @@ int main(int argc, char* argv[]){
   double s_over_root_sb = info.s/std::sqrt(info.s + info.b);
   double width = (info.x_hi-info.x_lo)/2.;
 
-  double tot_sig     = cmb.cp()
-      .process({"ggH", "qqH", "WH", "ZH"}).GetRate();
-  double tot_sig_err = 0.0;
-  if (fitresult) {
-    tot_sig_err = cmb.cp()
-        .process({"ggH", "qqH", "WH", "ZH"})
-        .GetUncertainty(fitresult, 500);
-  } else {
-    tot_sig_err = cmb.cp()
-        .process({"ggH", "qqH", "WH", "ZH"})
-        .GetUncertainty();
-  }
+  // The signal and background totals are evaluated from the same samples
+  ch::YieldTable table(cmb);
+  table.AddColumn("Total", [](ch::CombineHarvester &) {});
+  table.AddRow("Signal", {"ggH", "qqH", "WH", "ZH"});
+  table.AddRow("Background", [](ch::CombineHarvester & cb) {
+    cb.backgrounds();
+  });
+  table.Evaluate(fitresult, 500);
 
-  double tot_bkg     = cmb.cp()
-      .backgrounds().GetRate();
-  double tot_bkg_err = 0.0;
-  if (fitresult) {
-    tot_bkg_err = cmb.cp()
-        .backgrounds()
-        .GetUncertainty(fitresult, 500);
-  } else {
-    tot_bkg_err = cmb.cp()
-        .backgrounds()
-        .GetUncertainty();
-  }
+  double tot_sig     = table.Rate(0, 0);
+  double tot_sig_err = table.Uncertainty(0, 0);
+
+  double tot_bkg     = table.Rate(1, 0);
+  double tot_bkg_err = table.Uncertainty(1, 0);
 
   if (tot_bkg_err > 100.) {
     tot_bkg = std::floor((tot_bkg/10.) + 0.5) * 10.;
@@ -6,6 +6,7 @@
 #include <set>
 #include "CombineHarvester/CombineTools/interface/CombineHarvester.h"
 #include "CombineHarvester/CombineTools/interface/Object.h"
+#include "CombineHarvester/CombineTools/interface/NamePattern.h"
 
 namespace ch {
 
@@ -62,16 +63,15 @@ class CardWriter {
 
  private:
   typedef std::map<std::string, std::set<std::string>> PatternMap;
-  std::string text_pattern_;
-  std::string root_pattern_;
+  NamePattern text_pattern_;
+  NamePattern root_pattern_;
   mutable std::string tag_;
   std::vector<std::string> wildcard_masses_;
   unsigned v_;
   bool create_dirs_;
 
-  std::string Compile(std::string pattern, ch::Object const* obj,
-                      bool skip_mass = false) const;
-  PatternMap BuildMap(std::string const& pattern,
+  std::string Compile(NamePattern const& pattern, ch::Object const* obj) const;
+  PatternMap BuildMap(NamePattern const& pattern,
                       ch::CombineHarvester& cmb) const;
   void MakeDirs(PatternMap const& map) const;
 };
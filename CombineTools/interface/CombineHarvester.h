@@ -10,6 +10,7 @@
 #include <cmath>
 #include <set>
 #include <functional>
+#include <mutex>
 #include "boost/range/algorithm_ext/erase.hpp"
 #include "TFile.h"
 #include "TH1.h"
@@ -20,6 +21,8 @@
 #include "CombineHarvester/CombineTools/interface/Observation.h"
 #include "CombineHarvester/CombineTools/interface/Utilities.h"
 #include "CombineHarvester/CombineTools/interface/HistMapping.h"
+#include "CombineHarvester/CombineTools/interface/TFileIO.h"
+#include "CombineHarvester/CombineTools/interface/NamePattern.h"
 
 
 namespace ch {
@@ -96,6 +99,42 @@ class CombineHarvester {
   inline unsigned Verbosity() { return verbosity_; }
   /**@}*/
 
+  /**
+   * \name Memory accounting
+   */
+  /**@{*/
+  /**
+   * The number of objects of a given type and the estimated number of bytes
+   * they occupy
+   */
+  struct MemoryUsage {
+    std::size_t count = 0;
+    std::size_t bytes = 0;
+  };
+
+  /**
+   * Estimate the memory used by the objects this instance refers to
+   *
+   * Walks the Observation, Process, Systematic, Parameter and RooWorkspace
+   * entries and returns a map of category (e.g. "Process") to type (e.g.
+   * "TH1", "strings", "attributes") to the MemoryUsage. Objects are counted
+   * once per pointer, so entries shared with other CombineHarvester
+   * instances, or a RooWorkspace shared between several entries, are not
+   * double counted. Objects owned by a RooWorkspace (e.g. the pdf and data
+   * of a Process) are counted under the "Workspace" category, by ROOT class.
+   *
+   * \note The sizes are estimates: the object sizes are known exactly, but
+   * the heap allocations of ROOT classes other than TH1 and RooDataHist are
+   * not included and container overheads are approximate.
+   */
+  std::map<std::string, std::map<std::string, MemoryUsage>> MemoryReport() const;
+
+  /**
+   * Print the output of MemoryReport as a table
+   */
+  CombineHarvester& PrintMemoryReport();
+  /**@}*/
+
   /**
    * \name Datacards
    *
@@ -259,6 +298,37 @@ class CombineHarvester {
   void UpdateParameters(RooFitResult const& fit);
 
   std::vector<ch::Parameter> GetParameters() const;
+
+  /**
+   * The parameter names, sorted alphabetically
+   *
+   * Defines the order of the values in GetParameterValues() and
+   * SetParameterValues(), which remains valid as long as no parameter is
+   * added, removed or renamed.
+   */
+  std::vector<std::string> GetParameterNames() const;
+
+  /// The current value of each parameter, in the order of GetParameterNames()
+  std::vector<double> GetParameterValues() const;
+
+  /**
+   * Set the values of all parameters at once, in the order of
+   * GetParameterNames()
+   *
+   * Only the values are copied, which is much cheaper than
+   * UpdateParameters(std::vector<ch::Parameter> const&). The RooRealVars of
+   * any imported workspaces are only updated when a workspace object is
+   * next evaluated by this class, or by an explicit call to
+   * SyncParameterVars(). Frozen parameters are not modified.
+   */
+  CombineHarvester& SetParameterValues(std::vector<double> const& vals);
+
+  /**
+   * Update the workspace RooRealVars of any parameters whose values were set
+   * with SetParameterValues()
+   */
+  void SyncParameterVars() const;
+
   void RenameParameter(std::string const& oldname, std::string const& newname);
 
   template<typename Function>
@@ -334,10 +404,21 @@ class CombineHarvester {
    * available objects and evaluate the effect of all uncertainties. They
    * should be used at the end of a chain of filter methods to give the
    * desired yield, shape or uncertainty.
+   *
+   * \note GetRate(), GetShape(), GetObservedRate() and GetObservedShape() are
+   * const and do not change any global ROOT state, so independent instances
+   * (e.g. filtered views created with cp()) can be evaluated concurrently
+   * from several threads, provided that:
+   *  - `ROOT::EnableThreadSafety()` has been called, so that gDirectory is
+   *    local to each thread,
+   *  - the processes evaluated are histogram based (the RooFit pdfs and
+   *    parameters of a workspace are not thread-safe), and
+   *  - no parameter values are changed in the meantime. This includes the
+   *    uncertainty methods, which vary the parameters temporarily.
    */
   /**@{*/
-  double GetRate();
-  double GetObservedRate();
+  double GetRate() const;
+  double GetObservedRate() const;
   double GetUncertainty();
 
   /**
@@ -350,7 +431,7 @@ class CombineHarvester {
    */
   double GetUncertainty(RooFitResult const* fit, unsigned n_samples);
   double GetUncertainty(RooFitResult const& fit, unsigned n_samples);
-  TH1F GetShape();
+  TH1F GetShape() const;
   TH1F GetShapeWithUncertainty();
 
   /**
@@ -364,7 +445,47 @@ class CombineHarvester {
    */
   TH1F GetShapeWithUncertainty(RooFitResult const* fit, unsigned n_samples);
   TH1F GetShapeWithUncertainty(RooFitResult const& fit, unsigned n_samples);
-  TH1F GetObservedShape();
+
+  /**
+   * Sum the Process shapes of several groups and evaluate their bin-wise
+   * uncertainties by sampling from the fit covariance matrix
+   *
+   * Each group must only contain processes of this instance, and would
+   * typically be created with cp() and the filter methods, e.g. one group per
+   * (bin, process) plus the total signal and background in each bin. The
+   * parameter samples are drawn once and shared by all groups, and each
+   * Process is evaluated once per sample. This is much faster than calling
+   * GetShapeWithUncertainty on each group separately, and the resulting
+   * uncertainties are mutually consistent.
+   *
+   * @param groups The groups of processes to sum
+   * @param fit The fit result to sample the parameters from
+   * @param n_samples The number of samples to draw
+   * @param n_threads The number of threads used to evaluate the histogram
+   * based processes. Processes with a RooFit pdf are always evaluated serially.
+   * @return One histogram per group, in the same order as `groups`
+   */
+  std::vector<TH1F> GetShapesWithUncertainty(
+      std::vector<CombineHarvester> const& groups, RooFitResult const& fit,
+      unsigned n_samples, unsigned n_threads = 1);
+  TH1F GetObservedShape() const;
+
+  /**
+   * Sum the Process yields of several groups and evaluate their
+   * uncertainties by sampling from the fit covariance matrix
+   *
+   * The equivalent of GetShapesWithUncertainty for yields: the same
+   * parameter samples are used for every group, so the uncertainties of
+   * overlapping groups (e.g. a single background and the total background)
+   * are consistent. Processes that do not depend on any workspace object are
+   * evaluated directly from the sampled values over `n_threads` threads.
+   *
+   * @return The (yield, uncertainty) of each group, in the same order as
+   * `groups`
+   */
+  std::vector<std::pair<double, double>> GetRatesWithUncertainty(
+      std::vector<CombineHarvester> const& groups, RooFitResult const& fit,
+      unsigned n_samples, unsigned n_threads = 1);
 
   TH2F GetRateCovariance(RooFitResult const& fit, unsigned n_samples);
   TH2F GetRateCorrelation(RooFitResult const& fit, unsigned n_samples);
@@ -415,10 +536,91 @@ class CombineHarvester {
   void AddSyst(CombineHarvester & target, std::string const& name,
                std::string const& type, Map const& valmap);
 
+  /**
+   * Columnar description of a set of Process entries, with element i of each
+   * column describing entry i
+   *
+   * The process column determines the number of entries. Each of the other
+   * columns may instead be empty, in which case the default value of the
+   * Process property is used, or hold a single value that is used for all
+   * entries.
+   */
+  struct ProcessColumns {
+    std::vector<std::string> process;
+    std::vector<std::string> bin;
+    std::vector<int> bin_id;
+    std::vector<std::string> mass;
+    std::vector<std::string> analysis;
+    std::vector<std::string> era;
+    std::vector<std::string> channel;
+    std::vector<bool> signal;
+  };
+
+  /**
+   * Create one Process entry for each element of the columns
+   *
+   * A faster alternative to AddProcesses when the entries are not a simple
+   * cartesian product, or when there are very many of them.
+   */
+  void AddProcessColumns(ProcessColumns const& cols);
+
+  /**
+   * Columnar description of a set of Systematic entries, with element i of
+   * each column describing entry i
+   *
+   * The proc column gives the index of the Process entry in this instance
+   * (in the order of ForEachProc) from which each Systematic takes its
+   * properties, and determines the number of entries. The other columns may
+   * hold either one value per entry or a single value used for all entries,
+   * and the value_d, asymm, formula and args columns may also be empty. The
+   * names may contain the same placeholders as in AddSyst. If the asymm
+   * column is empty, the entries are asymmetric when value_d is given.
+   */
+  struct SystColumns {
+    std::vector<unsigned> proc;
+    std::vector<std::string> name;
+    std::vector<std::string> type;
+    std::vector<double> value_u;
+    std::vector<double> value_d;
+    std::vector<bool> asymm;
+    std::vector<std::string> formula;
+    std::vector<std::string> args;
+  };
+
+  /**
+   * Create one Systematic entry in target for each element of the columns
+   *
+   * Equivalent to calling AddSystFromProc for each entry, but the name
+   * templates are parsed once per distinct name and the storage is allocated
+   * once for all entries.
+   */
+  void AddSystColumns(CombineHarvester & target, SystColumns const& cols);
+
   void ExtractShapes(std::string const& file, std::string const& rule,
                      std::string const& syst_rule);
   void ExtractPdfs(CombineHarvester& target, std::string const& ws_name,
                    std::string const& rule, std::string norm_rule = "");
+
+  /**
+   * Set the pdf and normalisation terms of Process entries from workspace
+   * objects given explicitly by name
+   *
+   * Gives the same result as calling ExtractPdfs separately for each (bin,
+   * process) pair with the rules set to the exact object names, but resolves
+   * all entries in a single pass. The parameters of all pdfs and
+   * normalisation terms are found with one cached traversal of the server
+   * graph, so sub-graphs shared between processes are only visited once.
+   *
+   * @param target The instance into which the parameters are imported
+   * @param ws_name The name of a workspace in this instance
+   * @param names The (pdf, norm) object names for each (bin, process) pair.
+   * If a norm name is empty the pdf name + "_norm" is tried. Process entries
+   * not in this map, or that already have a pdf, are skipped.
+   */
+  void ExtractPdfsByName(
+      CombineHarvester& target, std::string const& ws_name,
+      std::map<std::pair<std::string, std::string>,
+               std::pair<std::string, std::string>> const& names);
   void ExtractData(std::string const& ws_name, std::string const& rule);
 
   void AddWorkspace(RooWorkspace const& ws, bool can_rename = false);
@@ -497,8 +699,40 @@ class CombineHarvester {
   };
 
   std::map<std::string, AutoMCStatsSettings> auto_stats_settings_;
+
+  // The normalised shape of a pdf-based Process, along with the binning of
+  // the observable and the values of the pdf parameters it was evaluated with
+  struct PdfShapeCache {
+    RooAbsReal const* pdf = nullptr;
+    RooRealVar const* observable = nullptr;
+    int nbins = 0;
+    double xmin = 0.;
+    double xmax = 0.;
+    std::vector<RooRealVar const*> params;
+    bool cacheable = false;
+    bool valid = false;
+    std::vector<double> values;
+    TH1F shape;
+  };
+
+  // Shared between shallow copies, so that the shapes are reused by the
+  // temporary instances created with cp(). Entries are keyed on the owning
+  // pointer of the Process, so a new Process allocated at the address of a
+  // deleted one never picks up its shape, and are dropped once no instance
+  // holds the Process any more.
+  struct PdfShapeStore {
+    std::mutex mutex;
+    std::map<std::weak_ptr<Process const>, PdfShapeCache,
+             std::owner_less<std::weak_ptr<Process const>>> shapes;
+  };
+  std::shared_ptr<PdfShapeStore> pdf_shapes_;
   std::vector<std::string> post_lines_;
 
+  // The parsed form of each shape mapping pattern seen by LoadShapes and
+  // PrefetchShapes. Not shared with copies, as the patterns are cheap to
+  // parse again.
+  std::unordered_map<std::string, NamePattern> mapping_patterns_;
+
   // ---------------------------------------------------------------
   // typedefs
   // ---------------------------------------------------------------
@@ -519,16 +753,33 @@ class CombineHarvester {
   // --> implementation in src/CombineHarvester.cc
   // ---------------------------------------------------------------
   void LoadShapes(Observation* entry,
-                     std::vector<HistMapping> const& mappings);
+                     std::vector<HistMapping> const& mappings,
+                     TH1Prefetcher* prefetch = nullptr);
   void LoadShapes(Process* entry,
-                     std::vector<HistMapping> const& mappings);
+                     std::vector<HistMapping> const& mappings,
+                     TH1Prefetcher* prefetch = nullptr);
   void LoadShapes(Systematic* entry,
-                     std::vector<HistMapping> const& mappings);
+                     std::vector<HistMapping> const& mappings,
+                     TH1Prefetcher* prefetch = nullptr);
+
+  // Queues the histograms LoadShapes will need for an entry. syst is the
+  // Systematic name, or empty for an Observation or Process
+  void PrefetchShapes(Object const* entry, std::string const& syst,
+                      std::vector<HistMapping> const& mappings,
+                      TH1Prefetcher & prefetch);
 
   HistMapping const& ResolveMapping(std::string const& process,
                                     std::string const& bin,
                                     std::vector<HistMapping> const& mappings);
 
+  // The parsed pattern, from mapping_patterns_ if it has been seen before
+  NamePattern const& MappingPattern(std::string const& pattern);
+
+  // As ResolveMapping, but returns nullptr if there is no matching mapping
+  HistMapping const* FindMapping(std::string const& process,
+                                 std::string const& bin,
+                                 std::vector<HistMapping> const& mappings);
+
   StrPairVec GenerateShapeMapAttempts(std::string process,
       std::string category);
 
@@ -537,7 +788,12 @@ class CombineHarvester {
 
   void ImportParameters(RooArgSet *vars);
 
-  RooAbsData const* FindMatchingData(Process const* proc);
+  RooAbsData const* FindMatchingData(Process const* proc) const;
+
+  // Creates the Systematic entries described by cols, where proc[i] is
+  // replaced by the pointer procs[i]
+  void AddSystsFromProcs(std::vector<Process const*> const& procs,
+                         SystColumns const& cols);
 
   ch::Parameter * SetupRateParamVar(std::string const& name, double val, bool is_ext_arg = false);
   void SetupRateParamFunc(std::string const& name, std::string const& formula,
@@ -563,13 +819,44 @@ void FillHistMappings(std::vector<HistMapping> & mappings);
   // --> implementation in src/CombineHarvester_Evaluate.cc
   // ---------------------------------------------------------------
   typedef std::vector<std::vector<Systematic const*>> ProcSystMap;
-  ProcSystMap GenerateProcSystMap();
+  ProcSystMap GenerateProcSystMap() const;
+
+  // For each parameter name, the indices of the processes whose rate or shape
+  // depends on it, either via a Systematic or via the parameters of the
+  // process pdf and normalisation terms
+  typedef std::map<std::string, std::vector<unsigned>> ParamProcMap;
+  ParamProcMap GenerateParamProcMap(ProcSystMap const& lookup);
+
+  // The Parameter controlling each entry of a ProcSystMap, with the same
+  // layout, so that the evaluation does not need to look them up by name.
+  // Entries are nullptr if the Parameter does not exist.
+  typedef std::vector<std::vector<Parameter*>> ProcParamMap;
+  ProcParamMap GenerateProcParamMap(ProcSystMap const& lookup) const;
+
+  // If subset is given only the processes with these indices are summed
+  double GetRateInternal(ProcSystMap const& lookup, ProcParamMap const& pars,
+    std::vector<unsigned> const* subset = nullptr) const;
+
+  TH1F GetShapeInternal(ProcSystMap const& lookup, ProcParamMap const& pars,
+    std::vector<unsigned> const* subset = nullptr) const;
+
+  double ParamValue(Systematic const* sys, Parameter const* par) const;
+
+  // Translate groups of processes into indices of procs_. Fills used_procs
+  // with the index of every process in any of the groups, and returns for
+  // each group the positions of its processes in used_procs.
+  std::vector<std::vector<unsigned>> GroupIndices(
+      std::vector<CombineHarvester> const& groups,
+      std::vector<unsigned> & used_procs) const;
+
+  // Calls SyncParameterVars() if any of the processes depends on workspace
+  // objects
+  void SyncParameterVars(std::vector<unsigned> const* subset) const;
 
-  double GetRateInternal(ProcSystMap const& lookup,
-    std::string const& single_sys = "");
+  TH1F GetPdfShape(std::shared_ptr<Process> const& proc) const;
 
-  TH1F GetShapeInternal(ProcSystMap const& lookup,
-    std::string const& single_sys = "");
+  // Removes the cached pdf shapes of processes that have been deleted
+  void PrunePdfShapes();
 
   inline double smoothStepFunc(double x) const {
     if (std::fabs(x) >= 1.0/*_smoothRegion*/) return x > 0 ? +1 : -1;
@@ -581,9 +868,9 @@ void FillHistMappings(std::vector<HistMapping> & mappings);
   double logKappaForX(double x, double k_low, double k_high) const;
 
   void ShapeDiff(double x, TH1F* target, TH1 const* nom, TH1 const* low,
-                 TH1 const* high, bool linear);
+                 TH1 const* high, bool linear) const;
   void ShapeDiff(double x, TH1F* target, RooDataHist const* nom,
-                 RooDataHist const* low, RooDataHist const* high);
+                 RooDataHist const* low, RooDataHist const* high) const;
 };
 
 
@@ -663,6 +950,7 @@ CombineHarvester& CombineHarvester::FilterProcs(Function func) {
   boost::remove_erase_if(
       procs_, [&](std::shared_ptr<Process> ptr) { return func(ptr.get());
   });
+  PrunePdfShapes();
   return *this;
 }
 template<typename Function>
@@ -688,6 +976,14 @@ void CombineHarvester::AddSyst(CombineHarvester& target,
   if (verbosity_ >= 1) {
     log() << (name + ":" + type) << "\n";
   }
+  // Collect the values for all matching processes, then create the
+  // Systematic entries in one go
+  SystColumns cols;
+  cols.name = {name};
+  cols.type = {type};
+  cols.asymm = {valmap.IsAsymm()};
+  std::vector<Process const*> procs;
+  procs.reserve(procs_.size());
   for (unsigned i = 0; i < procs_.size(); ++i) {
     if (!valmap.Contains(procs_[i].get())) {
       not_added_procs.push_back(procs_[i].get());
@@ -695,13 +991,13 @@ void CombineHarvester::AddSyst(CombineHarvester& target,
     }
     tuples.erase(valmap.GetTuple(procs_[i].get()));
     added_procs.push_back(procs_[i].get());
-    double val_u = valmap.ValU(procs_[i].get());
-    double val_d = valmap.ValD(procs_[i].get());
-    std::string formula = valmap.Formula(procs_[i].get());
-    std::string args = valmap.Args(procs_[i].get());
-    target.AddSystFromProc(*(procs_[i]), name, type, valmap.IsAsymm(),
-                           val_u, val_d, formula, args);
+    procs.push_back(procs_[i].get());
+    cols.value_u.push_back(valmap.ValU(procs_[i].get()));
+    cols.value_d.push_back(valmap.ValD(procs_[i].get()));
+    cols.formula.push_back(valmap.Formula(procs_[i].get()));
+    cols.args.push_back(valmap.Args(procs_[i].get()));
   }
+  target.AddSystsFromProcs(procs, cols);
   if (tuples.size() && verbosity_ >= 1) {
     log() << ">> Map keys that were not used to create a Systematic:\n";
     for (auto s : tuples) {
@@ -0,0 +1,95 @@
+#ifndef CombineTools_ContentHash_h
+#define CombineTools_ContentHash_h
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <vector>
+#include "TH1.h"
+
+namespace ch {
+
+/**
+ * Incrementally computes a 64-bit FNV-1a hash of a sequence of values
+ *
+ * Used wherever we need a cheap fingerprint of the content of an object, for
+ * example to decide if a histogram or a Systematic entry has changed since it
+ * was last seen. The hash is not cryptographic: two different inputs may
+ * collide, but will only do so with a negligible probability.
+ *
+ *     ch::ContentHash hash;
+ *     hash.Add(sys->name()).Add(sys->value_u()).Add(sys->shape_u());
+ *     std::string fingerprint = hash.Hex();
+ */
+class ContentHash {
+ public:
+  ContentHash() : value_(14695981039346656037ULL) {}
+
+  ContentHash& AddBytes(void const* data, std::size_t size) {
+    unsigned char const* bytes = static_cast<unsigned char const*>(data);
+    for (std::size_t i = 0; i < size; ++i) {
+      value_ ^= bytes[i];
+      value_ *= 1099511628211ULL;
+    }
+    return *this;
+  }
+
+  ContentHash& Add(std::string const& str) {
+    Add(std::uint64_t(str.size()));
+    return AddBytes(str.data(), str.size());
+  }
+
+  ContentHash& Add(char const* str) { return Add(std::string(str)); }
+
+  ContentHash& Add(double val) {
+    // Make sure +0 and -0 give the same result
+    if (val == 0.) val = 0.;
+    return AddBytes(&val, sizeof(val));
+  }
+
+  ContentHash& Add(int val) { return AddBytes(&val, sizeof(val)); }
+  ContentHash& Add(unsigned val) { return AddBytes(&val, sizeof(val)); }
+  ContentHash& Add(bool val) { return Add(int(val)); }
+  ContentHash& Add(std::uint64_t val) { return AddBytes(&val, sizeof(val)); }
+
+  ContentHash& Add(std::vector<double> const& vec) {
+    Add(std::uint64_t(vec.size()));
+    for (double val : vec) Add(val);
+    return *this;
+  }
+
+  /**
+   * Adds the binning, bin contents and bin errors (including the under- and
+   * overflow bins) of a histogram. A null pointer is hashed as an empty
+   * histogram with zero bins.
+   */
+  ContentHash& Add(TH1 const* h) {
+    if (!h) return Add(int(-1));
+    int n = h->GetNbinsX();
+    Add(n);
+    for (int i = 1; i <= n + 1; ++i) Add(h->GetBinLowEdge(i));
+    for (int i = 0; i <= n + 1; ++i) {
+      Add(h->GetBinContent(i));
+      Add(h->GetBinError(i));
+    }
+    return *this;
+  }
+
+  std::uint64_t Value() const { return value_; }
+
+  std::string Hex() const {
+    static char const* digits = "0123456789abcdef";
+    std::string res(16, '0');
+    std::uint64_t val = value_;
+    for (int i = 15; i >= 0; --i) {
+      res[i] = digits[val & 0xf];
+      val >>= 4;
+    }
+    return res;
+  }
+
+ private:
+  std::uint64_t value_;
+};
+}
+
+#endif
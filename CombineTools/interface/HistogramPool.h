@@ -0,0 +1,61 @@
+#ifndef CombineTools_HistogramPool_h
+#define CombineTools_HistogramPool_h
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+#include "TH1.h"
+
+namespace ch {
+
+/**
+ * True if two histograms have the same type, binning, bin contents and bin
+ * errors, including the underflow and overflow bins
+ */
+bool SameContent(TH1 const* a, TH1 const* b);
+
+/**
+ * Stores immutable histograms such that identical ones are shared
+ *
+ * Systematic templates are often bit-identical between entries, e.g. when
+ * the same shape file is used for several mass points, or when entries are
+ * duplicated with ch::CloneSysts. Passing each new histogram through Share()
+ * returns a shared pointer to an existing histogram with the same content if
+ * there is one, and the new histogram is then deleted. Histograms are found
+ * by a ch::ContentHash of their binning, contents and errors, and then
+ * compared bin-by-bin, so different histograms are never merged.
+ *
+ * The pool only holds weak references: a histogram is deleted as soon as the
+ * last object using it releases it. The histograms returned are shared
+ * between unrelated objects and must never be modified. To change a shape,
+ * clone it and set the modified copy instead.
+ */
+class HistogramPool {
+ public:
+  static HistogramPool& Instance();
+
+  /**
+   * Take ownership of a histogram and return a shared histogram with the same
+   * content, which may be the input histogram itself
+   */
+  std::shared_ptr<TH1 const> Share(std::unique_ptr<TH1> hist);
+
+  /// The number of distinct histograms currently in use
+  std::size_t Size();
+
+ private:
+  HistogramPool() : n_inserted_(0) {}
+  HistogramPool(HistogramPool const&) = delete;
+  HistogramPool& operator=(HistogramPool const&) = delete;
+
+  // Drop the entries for histograms that have since been deleted
+  void Purge();
+
+  std::mutex mutex_;
+  std::unordered_multimap<std::uint64_t, std::weak_ptr<TH1 const>> hists_;
+  // Insertions since the last Purge()
+  std::size_t n_inserted_;
+};
+}
+
+#endif
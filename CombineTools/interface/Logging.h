@@ -3,6 +3,12 @@
 #include <string>
 #include <iostream>
 #include <chrono>
+#include <atomic>
+#include <cstdint>
+#include <map>
+#include <mutex>
+#include <thread>
+#include <vector>
 
 namespace ch {
 
@@ -79,6 +85,10 @@ std::string GetQualififedName(std::string const& str);
  * of the program the FnTimer destructor will write a message to the screen
  * summarising the number of calls and the time information.
  *
+ * The time is measured with a monotonic clock and accumulated atomically,
+ * so the same FnTimer may be used from several threads. If the ch::Profiler
+ * is enabled each call is also recorded there.
+ *
  *  \note A simple way of using this class is via the LAUNCH_FUNCTION_TIMER(x,y)
  *  macro
  */
@@ -90,21 +100,175 @@ class FnTimer {
       ~Token();
     private:
       FnTimer *src_;
+      std::chrono::steady_clock::time_point start_;
   };
 
   explicit FnTimer(std::string name);
   ~FnTimer();
   Token Inc();
-  void StartTimer();
-  void StopTimer();
+  void AddElapsed(std::chrono::steady_clock::time_point start,
+                  std::chrono::steady_clock::time_point end);
 
  private:
   std::string name_;
-  unsigned calls_;
-  std::chrono::time_point<std::chrono::system_clock> start_;
-  std::chrono::time_point<std::chrono::system_clock> end_;
-  double elapsed_;
+  std::atomic<unsigned> calls_;
+  std::atomic<std::int64_t> elapsed_ns_;
+};
+
+/**
+ * A process-wide registry of timing and counter information
+ *
+ * The profiler is disabled by default, in which case the instrumentation
+ * placed in the code (via the PROFILE_FUNCTION, PROFILE_SCOPE and
+ * PROFILE_COUNT macros) costs only a single atomic load. It can be switched
+ * on and off at runtime, either from code:
+ *
+ *     ch::Profiler::Instance().SetEnabled(true);
+ *     ... // run the workflow
+ *     ch::Profiler::Instance().WriteJSON("profile.json");
+ *
+ * or by setting the environment variables `CH_PROFILE` and/or
+ * `CH_PROFILE_TRACE` to an output filename, in which case the summary (see
+ * WriteJSON) and/or the trace (see WriteChromeTrace) are written to these
+ * files when the program exits.
+ *
+ * For each timed region the number of calls and the total, minimum and
+ * maximum durations are accumulated. Times are measured with
+ * `std::chrono::steady_clock` and stored in nanoseconds. All methods are
+ * thread-safe.
+ */
+class Profiler {
+ public:
+  struct Stat {
+    std::uint64_t calls = 0;
+    std::int64_t total_ns = 0;
+    std::int64_t min_ns = 0;
+    std::int64_t max_ns = 0;
+  };
+
+  static Profiler& Instance();
+
+  bool Enabled() const { return enabled_.load(std::memory_order_relaxed); }
+  void SetEnabled(bool enabled) { enabled_ = enabled; }
+
+  /**
+   * Also keep every individual timed region, as needed by WriteChromeTrace
+   *
+   * Enabling tracing also enables the profiler. Note that the memory used
+   * grows with the number of calls.
+   */
+  void SetTracing(bool tracing);
+  bool Tracing() const { return tracing_.load(std::memory_order_relaxed); }
+
+  /** Add the duration of one call of the region `name` */
+  void AddTime(std::string const& name,
+               std::chrono::steady_clock::time_point start,
+               std::chrono::steady_clock::time_point end);
+
+  /** Increment the counter `name` by `n` */
+  void AddCount(std::string const& name, std::int64_t n = 1);
+
+  /** Clear all timing, counter and trace information */
+  void Reset();
+
+  std::map<std::string, Stat> Timers() const;
+  std::map<std::string, std::int64_t> Counters() const;
+
+  /** Write a table of the timers and counters to a stream */
+  void Print(std::ostream& out = std::cout) const;
+
+  /**
+   * Write the timers and counters as a json file, of the form
+   * `{"timers": {name: {"calls", "total_ns", "min_ns", "max_ns"}},
+   * "counters": {name: value}}`
+   */
+  void WriteJSON(std::string const& filename) const;
+
+  /**
+   * Write the recorded regions in the Chrome trace event format, which can
+   * be viewed in `chrome://tracing` or https://ui.perfetto.dev
+   */
+  void WriteChromeTrace(std::string const& filename) const;
+
+  ~Profiler();
+
+ private:
+  struct Event {
+    std::string const* name;
+    unsigned thread;
+    std::int64_t start_ns;
+    std::int64_t dur_ns;
+  };
+
+  Profiler();
+  Profiler(Profiler const&) = delete;
+  Profiler& operator=(Profiler const&) = delete;
+
+  std::atomic<bool> enabled_;
+  std::atomic<bool> tracing_;
+  std::chrono::steady_clock::time_point origin_;
+  mutable std::mutex mutex_;
+  std::map<std::string, Stat> timers_;
+  std::map<std::string, std::int64_t> counters_;
+  std::map<std::thread::id, unsigned> thread_ids_;
+  std::vector<Event> events_;
+  std::string json_file_;
+  std::string trace_file_;
+};
+
+/**
+ * Records the time between construction and destruction in the ch::Profiler,
+ * if it was enabled at the time of construction
+ */
+class ProfileScope {
+ public:
+  explicit ProfileScope(std::string const& name)
+      : name_(Profiler::Instance().Enabled() ? &name : nullptr) {
+    if (name_) start_ = std::chrono::steady_clock::now();
+  }
+  ~ProfileScope() {
+    if (name_) {
+      Profiler::Instance().AddTime(*name_, start_,
+                                   std::chrono::steady_clock::now());
+    }
+  }
+  ProfileScope(ProfileScope const&) = delete;
+  ProfileScope& operator=(ProfileScope const&) = delete;
+
+ private:
+  std::string const* name_;
+  std::chrono::steady_clock::time_point start_;
 };
+
+#define CH_PROFILE_CAT_(x, y) x##y
+#define CH_PROFILE_CAT(x, y) CH_PROFILE_CAT_(x, y)
+
+/**
+ * Time the rest of the enclosing scope in the ch::Profiler under the label
+ * `x`, which should be a string literal
+ */
+#define PROFILE_SCOPE(x)                                               \
+  static const std::string CH_PROFILE_CAT(__ch_prof_name_, __LINE__)(x); \
+  ch::ProfileScope CH_PROFILE_CAT(__ch_prof_scope_, __LINE__)(         \
+      CH_PROFILE_CAT(__ch_prof_name_, __LINE__));
+
+/**
+ * Time the rest of the enclosing function in the ch::Profiler, labelled with
+ * the qualified function name
+ */
+#define PROFILE_FUNCTION()                                              \
+  static const std::string __ch_prof_fn__(                              \
+      ch::GetQualififedName(__PRETTY_FUNCTION__));                      \
+  ch::ProfileScope __ch_prof_fn_scope__(__ch_prof_fn__);
+
+/**
+ * Increment the ch::Profiler counter `x` by `n`, if the profiler is enabled
+ */
+#define PROFILE_COUNT(x, n)                                              \
+  do {                                                                   \
+    if (ch::Profiler::Instance().Enabled())                              \
+      ch::Profiler::Instance().AddCount(x, n);                           \
+  } while (0)
 }
 
 #endif
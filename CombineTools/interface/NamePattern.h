@@ -0,0 +1,108 @@
+#ifndef CombineTools_NamePattern_h
+#define CombineTools_NamePattern_h
+#include <array>
+#include <map>
+#include <string>
+#include <vector>
+#include "CombineHarvester/CombineTools/interface/Object.h"
+
+namespace ch {
+
+/**
+ * A name containing placeholders such as `$BIN`, `$PROCESS` or `$MASS`,
+ * parsed once into literal and placeholder segments
+ *
+ * Many names are built by substituting the properties of each object into
+ * the same pattern, e.g. for systematic names, shape mappings and output
+ * files. Instead of scanning the full pattern for every placeholder each
+ * time, the pattern is split up front and each rendering just concatenates
+ * the segments into a reusable buffer:
+ *
+ *     ch::NamePattern pattern("CMS_$ANALYSIS_$BIN_$PROCESS_bin_$#");
+ *     ch::NamePattern::Values vals;
+ *     std::string name;
+ *     vals.SetObject(*proc);
+ *     for (unsigned i = 1; i <= n_bins; ++i) {
+ *       vals.Set(ch::NamePattern::kIndex, std::to_string(i));
+ *       pattern.Render(vals, name);
+ *     }
+ *
+ * The recognised placeholders are `$BINID`, `$BIN`, `$PROCESS`, `$MASS`,
+ * `$ERA`, `$CHANNEL`, `$ANALYSIS`, `$TAG`, `$SYSTEMATIC`, `$#` and
+ * `$ATTR(label)`. A placeholder for which no value is set is kept unchanged
+ * in the output, so different callers can substitute different subsets.
+ */
+class NamePattern {
+ public:
+  enum Placeholder {
+    kBinId, kBin, kProcess, kMass, kEra, kChannel, kAnalysis, kTag,
+    kSystematic, kIndex, kNumPlaceholders
+  };
+
+  /**
+   * The values to substitute for each placeholder
+   *
+   * Values set with SetObject refer to the strings of the Object, which must
+   * therefore outlive any rendering that uses them. An instance is meant to
+   * be reused between renderings, so is neither copyable nor movable.
+   */
+  class Values {
+   public:
+    Values();
+    Values(Values const&) = delete;
+    Values& operator=(Values const&) = delete;
+
+    /// Set the value of a placeholder to a copy of val
+    Values& Set(Placeholder p, std::string const& val);
+
+    /// Leave a placeholder unchanged when rendering
+    Values& Unset(Placeholder p);
+
+    /**
+     * Set the bin, bin_id, process, mass, era, channel and analysis values,
+     * and the attributes, from an Object
+     */
+    Values& SetObject(Object const& obj);
+
+    std::string const* Get(Placeholder p) const { return vals_[p]; }
+    std::map<std::string, std::string> const* attributes() const {
+      return attrs_;
+    }
+
+   private:
+    std::array<std::string const*, kNumPlaceholders> vals_;
+    std::array<std::string, kNumPlaceholders> owned_;
+    std::map<std::string, std::string> const* attrs_;
+  };
+
+  explicit NamePattern(std::string const& pattern = "");
+
+  /// Replace the contents of out with the rendered pattern
+  void Render(Values const& vals, std::string & out) const;
+
+  std::string Render(Values const& vals) const;
+
+  /// True if the pattern contains the placeholder p
+  bool Contains(Placeholder p) const;
+
+  /// True if the pattern contains no placeholders at all
+  bool IsLiteral() const;
+
+  std::string const& pattern() const { return pattern_; }
+
+ private:
+  enum class Kind { kLiteral, kPlaceholder, kAttribute };
+  struct Segment {
+    Kind kind;
+    Placeholder placeholder;
+    // The literal text, or the original text of the placeholder
+    std::string text;
+    // The label of an attribute placeholder
+    std::string label;
+  };
+  std::string pattern_;
+  std::vector<Segment> segments_;
+};
+}
+
+#endif
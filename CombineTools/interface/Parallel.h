@@ -0,0 +1,73 @@
+#ifndef CombineTools_Parallel_h
+#define CombineTools_Parallel_h
+#include <algorithm>
+#include <cstddef>
+#include <exception>
+#include <thread>
+#include <vector>
+
+namespace ch {
+
+/**
+ * The number of worker threads to use when none is specified explicitly
+ *
+ * Returns the number of concurrent threads supported by the hardware, or one
+ * if this cannot be determined.
+ */
+inline unsigned DefaultNumThreads() {
+  unsigned n = std::thread::hardware_concurrency();
+  return n > 0 ? n : 1;
+}
+
+/**
+ * Call `func(i)` for every index `i` in `[0, n)`, spreading the calls over
+ * up to `n_threads` threads
+ *
+ * The index range is split into contiguous blocks, one per thread, and this
+ * function only returns once every call has completed. If `n_threads` is
+ * less than two, or there is only a single index, everything is run serially
+ * in the calling thread. If any call throws, the first exception caught is
+ * re-thrown in the calling thread after all threads have joined.
+ *
+ * \note It is the caller's responsibility to ensure `func` is safe to run
+ * concurrently. In particular it should not create, modify or delete ROOT
+ * objects (e.g. TH1 or RooFit classes) that are shared between indices;
+ * const access to existing histograms is fine.
+ *
+ * @param n The number of indices
+ * @param n_threads The maximum number of threads to use
+ * @param func A callable with a single `std::size_t` argument
+ */
+template <typename Function>
+void ParallelFor(std::size_t n, unsigned n_threads, Function func) {
+  if (n == 0) return;
+  std::size_t n_workers = std::min<std::size_t>(std::max(n_threads, 1u), n);
+  if (n_workers == 1) {
+    for (std::size_t i = 0; i < n; ++i) func(i);
+    return;
+  }
+  std::vector<std::exception_ptr> errors(n_workers);
+  std::vector<std::thread> workers;
+  workers.reserve(n_workers);
+  std::size_t block = n / n_workers;
+  std::size_t extra = n % n_workers;
+  std::size_t start = 0;
+  for (std::size_t w = 0; w < n_workers; ++w) {
+    std::size_t stop = start + block + (w < extra ? 1 : 0);
+    workers.emplace_back([&func, &errors, w, start, stop]() {
+      try {
+        for (std::size_t i = start; i < stop; ++i) func(i);
+      } catch (...) {
+        errors[w] = std::current_exception();
+      }
+    });
+    start = stop;
+  }
+  for (auto & t : workers) t.join();
+  for (auto const& e : errors) {
+    if (e) std::rethrow_exception(e);
+  }
+}
+}
+
+#endif
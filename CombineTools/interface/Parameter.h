@@ -26,6 +26,30 @@ class Parameter {
     for (unsigned i = 0; i < vars_.size(); ++i) {
       vars_[i]->setVal(val);
     }
+    vars_dirty_ = false;
+  }
+
+  /**
+   * Set the value without updating the linked RooRealVars, which are only
+   * updated on the next call to sync_vars()
+   *
+   * Used when many values are changed in bulk, e.g. for each toy when
+   * sampling a fit result, where most of the time no workspace object is
+   * evaluated.
+   */
+  void set_val_lazy(double const& val) {
+    if (frozen_) return;
+    val_ = val;
+    vars_dirty_ = !vars_.empty();
+  }
+
+  /// Push the value to the linked RooRealVars if it was set lazily
+  void sync_vars() {
+    if (!vars_dirty_) return;
+    for (unsigned i = 0; i < vars_.size(); ++i) {
+      vars_[i]->setVal(val_);
+    }
+    vars_dirty_ = false;
   }
 
   double val() const { return val_; }
@@ -64,6 +88,7 @@ class Parameter {
   double range_u_;
   double range_d_;
   bool frozen_;
+  bool vars_dirty_;
   std::vector<RooRealVar *> vars_;
   std::set<std::string> groups_;
   friend void swap(Parameter& first, Parameter& second);
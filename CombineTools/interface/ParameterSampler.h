@@ -0,0 +1,82 @@
+#ifndef CombineTools_ParameterSampler_h
+#define CombineTools_ParameterSampler_h
+#include <cstdint>
+#include <string>
+#include <vector>
+#include "RooFitResult.h"
+
+namespace ch {
+
+/**
+ * Draws correlated random parameter values from the covariance matrix of a
+ * RooFitResult
+ *
+ * The covariance matrix is extracted and Cholesky-decomposed once in the
+ * constructor. Each toy is then generated as \f$\vec{x} = \vec{\mu} +
+ * L\vec{z}\f$, where \f$\vec{\mu}\f$ are the post-fit parameter values,
+ * \f$L\f$ the lower-triangular Cholesky factor and \f$\vec{z}\f$ a vector of
+ * independent standard normal numbers. This is statistically equivalent to
+ * calling RooFitResult::randomizePars() for each toy, but avoids the RooFit
+ * overhead and writes the values directly into a dense array. As with
+ * RooRealVar::setVal(), values outside the range of a parameter are clamped
+ * to its limits.
+ *
+ * Toys are generated in fixed-size blocks, each with its own random number
+ * engine seeded from the sampler seed, the number of previous calls and the
+ * block index. The toys are therefore reproducible for a given seed,
+ * independent of the number of threads used, and successive calls continue
+ * with new toys:
+ *
+ *     ch::ParameterSampler sampler(fit, 1234);
+ *     auto toys = sampler.Generate(10000, 4);
+ *     // the value of parameter j in toy i:
+ *     double val = toys[i * sampler.NumParameters() + j];
+ */
+class ParameterSampler {
+ public:
+  /**
+   * Extract and decompose the covariance matrix of the floating parameters
+   *
+   * Throws an exception if the covariance matrix is not positive definite.
+   */
+  explicit ParameterSampler(RooFitResult const& fit, std::uint64_t seed = 0);
+
+  /// The number of floating parameters in the fit
+  unsigned NumParameters() const { return names_.size(); }
+
+  /// The parameter names, in the order they appear in each toy
+  std::vector<std::string> const& Names() const { return names_; }
+
+  /// The post-fit parameter values
+  std::vector<double> const& Means() const { return means_; }
+
+  /**
+   * Generate a number of toys
+   *
+   * @param n_toys The number of toys
+   * @param n_threads The number of threads to use
+   * @return A row-major array of n_toys * NumParameters() values
+   */
+  std::vector<double> Generate(unsigned n_toys, unsigned n_threads = 1);
+
+  /**
+   * Generate a number of toys into an existing array, which must hold at
+   * least n_toys * NumParameters() values
+   */
+  void Generate(unsigned n_toys, double * out, unsigned n_threads = 1);
+
+ private:
+  void GenerateBlock(std::uint64_t block, unsigned n_toys, double * out) const;
+
+  std::vector<std::string> names_;
+  std::vector<double> means_;
+  std::vector<double> min_;
+  std::vector<double> max_;
+  // Lower-triangular Cholesky factor, row-major with row i of length i + 1
+  std::vector<double> chol_;
+  std::uint64_t seed_;
+  std::uint64_t n_calls_;
+};
+}
+
+#endif
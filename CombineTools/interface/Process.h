@@ -1,5 +1,6 @@
 #ifndef CombineTools_Process_h
 #define CombineTools_Process_h
+#include <atomic>
 #include <memory>
 #include <string>
 #include "TH1.h"
@@ -25,10 +26,7 @@ class Process : public Object {
   double rate() const {
     double base = 1.;
     if (pdf_ && !dynamic_cast<RooAbsPdf*>(pdf_) && cached_obs_) {
-      if (!cached_int_) {
-        cached_int_ = pdf_->createIntegral(RooArgSet(*cached_obs_));
-      }
-      base = cached_int_->getVal();
+      base = PdfIntegral()->getVal();
     }
     return norm_ ? base * norm_->getVal() * rate_ : base * rate_;
   }
@@ -78,7 +76,10 @@ class Process : public Object {
   RooAbsData* data_;
   RooAbsReal* norm_;
   RooRealVar* cached_obs_;
-  mutable RooAbsReal* cached_int_;
+  // Created on first use by PdfIntegral()
+  mutable std::atomic<RooAbsReal*> cached_int_;
+
+  RooAbsReal* PdfIntegral() const;
 
   friend void swap(Process& first, Process& second);
 };
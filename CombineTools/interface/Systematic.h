@@ -70,8 +70,9 @@ class Systematic : public Object {
   double value_d_;
   double scale_;
   bool asymm_;
-  std::unique_ptr<TH1> shape_u_;
-  std::unique_ptr<TH1> shape_d_;
+  // Shared with other Systematic entries via ch::HistogramPool
+  std::shared_ptr<TH1 const> shape_u_;
+  std::shared_ptr<TH1 const> shape_d_;
   RooDataHist * data_u_;
   RooDataHist * data_d_;
 
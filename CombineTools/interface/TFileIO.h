@@ -1,7 +1,9 @@
 #ifndef CombineTools_TFileIO_h
 #define CombineTools_TFileIO_h
+#include <map>
 #include <memory>
 #include <string>
+#include <utility>
 #include <vector>
 #include "boost/algorithm/string.hpp"
 #include "TFile.h"
@@ -11,8 +13,69 @@
 
 namespace ch {
 
+/**
+ * Read the TH1 at `path` in `file` into a new histogram that is not attached
+ * to any directory
+ *
+ * The object is read directly from its TKey, so gDirectory is never changed
+ * and the file is only read once. A trailing `;N` in the path selects cycle
+ * N, otherwise the highest cycle is used. As with TDirectory::Get, if no
+ * cycle is given an object held in memory by the directory, e.g. one that has
+ * not been written yet, is copied instead.
+ */
 std::unique_ptr<TH1> GetClonedTH1(TFile* file, std::string const& path);
 
+/**
+ * Reads a known set of histograms from ROOT files in a few large reads
+ *
+ * Reading histograms one at a time with GetClonedTH1 costs at least one
+ * round trip to the storage per histogram, which dominates the time taken on
+ * high-latency (e.g. network-mounted) file systems. Instead every histogram
+ * needed can be queued with Add(), then Run() fetches the raw records of each
+ * file with TFile::ReadBuffers, in batches sorted by their offset in the
+ * file, and only afterwards unpacks them into TH1 objects.
+ *
+ * Paths that cannot be prefetched, e.g. because the object is missing or is
+ * not a TH1, are skipped without an error. GetClonedTH1() falls back to
+ * ch::GetClonedTH1 for these, which will then report the problem.
+ */
+class TH1Prefetcher {
+ public:
+  /**
+   * @param batch_bytes The approximate maximum number of bytes fetched by
+   * each TFile::ReadBuffers call
+   */
+  explicit TH1Prefetcher(std::size_t batch_bytes = 32 * 1024 * 1024);
+
+  /// Queue the histogram at `path` in `file` to be read by Run()
+  void Add(TFile* file, std::string const& path);
+
+  /// Read all the histograms queued since the last call
+  void Run();
+
+  /**
+   * Return a prefetched histogram, or read it directly with
+   * ch::GetClonedTH1 if it was not prefetched
+   *
+   * Each call uses up one of the Add() calls for the path. The prefetched
+   * histogram is copied for every call but the last, which takes the
+   * histogram itself.
+   */
+  std::unique_ptr<TH1> GetClonedTH1(TFile* file, std::string const& path);
+
+  /// The number of prefetched histograms that have not been taken yet
+  std::size_t size() const { return hists_.size(); }
+
+ private:
+  typedef std::pair<TFile*, std::string> Key;
+  std::size_t batch_bytes_;
+  std::vector<Key> queue_;
+  std::map<Key, std::unique_ptr<TH1>> hists_;
+  // The number of Add() calls for each path not yet matched by a
+  // GetClonedTH1() call
+  std::map<Key, unsigned> uses_;
+};
+
 template <class T>
 void WriteToTFile(T * ptr, TFile* file, std::string const& path);
 
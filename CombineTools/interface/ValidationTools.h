@@ -6,6 +6,8 @@
 #include <set>
 #include <string>
 #include <sstream>
+#include <functional>
+#include <utility>
 #include "boost/algorithm/string.hpp"
 #include "boost/lexical_cast.hpp"
 #include "boost/regex.hpp"
@@ -39,6 +41,125 @@ void CheckSmallSignals(CombineHarvester& cb, double minSigFrac);
 void ValidateShapeTemplates(CombineHarvester& cb, json &jsobj);
 void ValidateShapeTemplates(CombineHarvester& cb);
 void ValidateCards(CombineHarvester& cb, std::string const& filename, double maxNormEff, double minSigFrac);
+void ValidateCardsIncremental(CombineHarvester& cb, std::string const& filename, double maxNormEff, double minSigFrac, std::string const& cache_file);
+
+/**
+ * Runs the datacard validation checks in a single pass over the model
+ *
+ * The standalone check functions above each do their own traversal of the
+ * Process and Systematic entries. This class instead builds a summary of
+ * every Process once (yield, normalised nominal template per (bin, process)
+ * and the per-bin background and signal totals), then visits each
+ * Systematic exactly once, running every registered check on that visit.
+ * The Systematic visits are spread over several threads and the results are
+ * merged into the json report afterwards, in the original Systematic order.
+ *
+ * Typical usage:
+ *
+ *     ch::ValidationEngine()
+ *         .SetMaxNormEff(0.1)
+ *         .SetMinSigFrac(0.001)
+ *         .Run(cb, jsobj);
+ *
+ * The json keys filled are the same as those of ValidateCards. Additional
+ * Systematic-level checks can be registered with AddSystCheck.
+ *
+ * If a cache file is set with SetCacheFile the validation becomes
+ * incremental: a content hash of every Process and Systematic (metadata,
+ * yields, values and histogram contents) is stored in the file together
+ * with the findings for each Systematic. On the next run the checks are
+ * skipped for any Systematic whose hash, and that of its nominal template,
+ * is unchanged, and the stored findings are used instead. The cache is
+ * ignored if the thresholds or the list of checks have changed.
+ *
+ * Only the Systematic-level checks are incremental. The Process-level checks
+ * (emptyProcessShape, emptyBkgBin and smallSignalProc) need the totals over
+ * all processes in a bin, which are summed in the same pass that computes
+ * the Process hashes, so they are always run in full. The Process hashes are
+ * only used to report which processes changed.
+ */
+class ValidationEngine {
+ public:
+  /**
+   * The information available to a Systematic-level check
+   */
+  struct SystInput {
+    ch::Systematic const* sys;
+    /** The matching Process entry has zero yield */
+    bool proc_empty;
+    /**
+     * The summed nominal template of all processes with the same bin and
+     * process name, normalised to unity, or null if no shapes are available
+     */
+    std::vector<double> const* nominal;
+  };
+
+  /**
+   * A check returns true if the Systematic should be reported, in which case
+   * it should also fill the json object that will be stored under
+   * `[label][name][bin][process]` in the report
+   */
+  typedef std::function<bool(SystInput const&, json&)> SystCheck;
+
+  ValidationEngine();
+
+  ValidationEngine& SetNumThreads(unsigned n_threads) {
+    n_threads_ = n_threads;
+    return *this;
+  }
+
+  ValidationEngine& SetMaxNormEff(double max_norm_eff) {
+    max_norm_eff_ = max_norm_eff;
+    return *this;
+  }
+
+  ValidationEngine& SetMinSigFrac(double min_sig_frac) {
+    min_sig_frac_ = min_sig_frac;
+    return *this;
+  }
+
+  /**
+   * Read and write the incremental validation cache from/to this file. An
+   * empty string (the default) disables the cache.
+   */
+  ValidationEngine& SetCacheFile(std::string const& cache_file) {
+    cache_file_ = cache_file;
+    return *this;
+  }
+
+  /**
+   * Register an additional Systematic-level check, run after the built-in
+   * ones
+   *
+   * \note When using a cache file the label is used to identify the check,
+   * so a check whose logic changes should be given a new label.
+   */
+  ValidationEngine& AddSystCheck(std::string const& label, SystCheck check) {
+    checks_.push_back(std::make_pair(label, check));
+    return *this;
+  }
+
+  /**
+   * Run the checks, filling the report `jsobj`
+   *
+   * If `diff` is not null and a cache file is set it is filled with a
+   * summary of the changes with respect to the cached run: the number of
+   * new, changed, removed and reused Process and Systematic entries, and
+   * the lists of findings that were `added` and `resolved`, each given as a
+   * "/"-separated path into the report.
+   */
+  void Run(CombineHarvester& cb, json& jsobj, json* diff = nullptr) const;
+
+ private:
+  unsigned n_threads_;
+  double max_norm_eff_;
+  double min_sig_frac_;
+  std::string cache_file_;
+  std::vector<std::pair<std::string, SystCheck>> checks_;
+
+  std::vector<std::pair<std::string, SystCheck>> BuiltinSystChecks(
+      bool shape_checks) const;
+};
 
 }
 
@@ -0,0 +1,83 @@
+#ifndef CombineTools_YieldTable_h
+#define CombineTools_YieldTable_h
+#include <functional>
+#include <string>
+#include <vector>
+#include "RooFitResult.h"
+#include "CombineHarvester/CombineTools/interface/CombineHarvester.h"
+
+namespace ch {
+
+/**
+ * Computes a table of yields and uncertainties, with each cell defined by
+ * the combination of a row and a column selection
+ *
+ * Rows and columns are given as functions that apply filters to a copy of
+ * the CombineHarvester instance. The cell (i, j) contains the processes
+ * passing both the filters of row i and those of column j. All cells are
+ * evaluated together in Evaluate(): with a fit result, the uncertainties are
+ * obtained from a single set of parameter samples shared by all cells, so
+ * that they are consistent with each other.
+ *
+ *     ch::YieldTable table(cb);
+ *     table.AddColumn("No B-Tag", [](ch::CombineHarvester & c) {
+ *       c.bin_id({8});
+ *     });
+ *     table.AddRow("QCD", [](ch::CombineHarvester & c) {
+ *       c.process({"QCD"});
+ *     });
+ *     table.Evaluate(&fit, 500, 4);
+ *     double yield = table.Rate(0, 0);
+ *     double error = table.Uncertainty(0, 0);
+ */
+class YieldTable {
+ public:
+  typedef std::function<void(CombineHarvester &)> Selector;
+
+  explicit YieldTable(CombineHarvester & cb);
+
+  YieldTable& AddRow(std::string const& label, Selector const& selector);
+
+  /// Add a row containing the given processes
+  YieldTable& AddRow(std::string const& label,
+                     std::vector<std::string> const& processes);
+
+  YieldTable& AddColumn(std::string const& label, Selector const& selector);
+
+  /**
+   * Compute the yield and uncertainty of every cell
+   *
+   * @param fit If given, the uncertainties are evaluated by sampling from
+   * this fit result. Otherwise the uncertainties are the sum in quadrature of
+   * the effect of each parameter, as in CombineHarvester::GetUncertainty().
+   * @param n_samples The number of parameter samples
+   * @param n_threads The number of threads to use with a fit result
+   */
+  YieldTable& Evaluate(RooFitResult const* fit = nullptr,
+                       unsigned n_samples = 500, unsigned n_threads = 1);
+
+  unsigned NumRows() const { return row_labels_.size(); }
+  unsigned NumColumns() const { return col_labels_.size(); }
+  std::string const& RowLabel(unsigned row) const { return row_labels_[row]; }
+  std::string const& ColumnLabel(unsigned col) const {
+    return col_labels_[col];
+  }
+
+  double Rate(unsigned row, unsigned col) const;
+  double Uncertainty(unsigned row, unsigned col) const;
+
+ private:
+  std::size_t CellIndex(unsigned row, unsigned col) const;
+
+  CombineHarvester & cb_;
+  std::vector<std::string> row_labels_;
+  std::vector<Selector> rows_;
+  std::vector<std::string> col_labels_;
+  std::vector<Selector> cols_;
+  // Row-major yields and uncertainties, filled by Evaluate()
+  std::vector<double> rates_;
+  std::vector<double> errors_;
+};
+}
+
+#endif
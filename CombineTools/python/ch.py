@@ -29,6 +29,14 @@ def AddProcesses(self, mass=[''], analysis=[''], era=[''], channel=[''], procs=[
     return self.__AddProcesses__(mass, analysis, era, channel, procs, bin, signal)
 
 
+def AddProcessColumns(self, process, bin=[], bin_id=[], mass=[], analysis=[], era=[], channel=[], signal=[]):
+    return self.__AddProcessColumns__(process, bin, bin_id, mass, analysis, era, channel, signal)
+
+
+def AddSystColumns(self, target, proc, name, type, value_u, value_d=[], asymm=[], formula=[], args=[]):
+    return self.__AddSystColumns__(target, proc, name, type, value_u, value_d, asymm, formula, args)
+
+
 def SetFromAll(self, func):
     res = set()
     self.ForEachObj(lambda x: res.add(func(x)))
@@ -92,7 +100,10 @@ def AddSyst(self, target, name, type, valmap):
     self.ForEachProc(lambda x: procs.append(x))
     if self.Verbosity() >= 1:
         print name + ':' + type
-    for proc in procs:
+    # Collect the values for all matching processes, then create the
+    # Systematic entries in a single call
+    cols = {'proc': [], 'value_u': [], 'value_d': [], 'asymm': [], 'formula': [], 'args': []}
+    for i, proc in enumerate(procs):
         if not valmap.Contains(proc):
             not_added_procs.append(proc)
             continue
@@ -115,9 +126,13 @@ def AddSyst(self, target, name, type, valmap):
             args = val[1]
         else:
             raise RuntimeError('Systematic value not recognised')
-
-        target.AddSystFromProc(
-            proc, name, type, is_asymm, val_u, val_d, formula, args)
+        cols['proc'].append(i)
+        cols['value_u'].append(val_u)
+        cols['value_d'].append(val_d)
+        cols['asymm'].append(is_asymm)
+        cols['formula'].append(formula)
+        cols['args'].append(args)
+    self.AddSystColumns(target, name=[name], type=[type], **cols)
     if len(tuples) > 0 and self.Verbosity() >= 1:
         print '>> Map keys that were not used to create a Systematic:'
         for tup in tuples:
@@ -135,6 +150,8 @@ def AddSyst(self, target, name, type, valmap):
 CombineHarvester.ParseDatacard = ParseDatacard
 CombineHarvester.AddObservations = AddObservations
 CombineHarvester.AddProcesses = AddProcesses
+CombineHarvester.AddProcessColumns = AddProcessColumns
+CombineHarvester.AddSystColumns = AddSystColumns
 CombineHarvester.SetFromAll = SetFromAll
 CombineHarvester.SetFromObs = SetFromObs
 CombineHarvester.SetFromProcs = SetFromProcs
@@ -31,6 +31,8 @@ parser.add_argument('--jsonFile', default='validation.json',
                     help='Path to the json file to read/write results from (default:validation.json)')
 parser.add_argument('--mass', default='*',
                     help='Signal mass to use (default:*)')
+parser.add_argument('--cacheFile', default='',
+                    help='Path to a cache file used to skip the checks on processes and systematics that are unchanged since the last run, and to report only the changes in the findings (default: no cache)')
 
 args = parser.parse_args()
 
@@ -109,7 +111,10 @@ cb.SetFlag('workspaces-use-clone', True)
 if not args.readOnly: 
   cb.ParseDatacard(args.cards,"","",mass=args.mass)
 
-  ch.ValidateCards(cb,args.jsonFile,args.checkUncertOver,args.reportSigUnder)
+  if args.cacheFile:
+    ch.ValidateCardsIncremental(cb,args.jsonFile,args.checkUncertOver,args.reportSigUnder,args.cacheFile)
+  else:
+    ch.ValidateCards(cb,args.jsonFile,args.checkUncertOver,args.reportSigUnder)
 
 if args.printLevel > 0:
   print "================================" 
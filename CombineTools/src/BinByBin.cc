@@ -5,6 +5,7 @@
 #include "boost/format.hpp"
 #include "boost/lexical_cast.hpp"
 #include "Math/QuantFunc.h"
+#include "CombineHarvester/CombineTools/interface/NamePattern.h"
 
 namespace ch {
 
@@ -20,6 +21,7 @@ BinByBinFactory::BinByBinFactory()
 
 
 void BinByBinFactory::MergeBinErrors(CombineHarvester &cb) {
+  PROFILE_FUNCTION();
   // Reduce merge_threshold very slightly to avoid numerical issues
   // E.g. two backgrounds each with bin error 1.0. merge_threshold of
   // 0.5 should not result in merging - but can do depending on
@@ -103,11 +105,14 @@ void BinByBinFactory::MergeBinErrors(CombineHarvester &cb) {
 }
 
 void BinByBinFactory::AddBinByBin(CombineHarvester &src, CombineHarvester &dest) {
+  PROFILE_FUNCTION();
   unsigned bbb_added = 0;
   std::vector<Process *> procs;
   src.ForEachProc([&](Process *p) { 
     procs.push_back(p);
   });
+  NamePattern pattern(BinByBinFactory::GetPattern());
+  NamePattern::Values pattern_vals;
   for (unsigned i = 0; i < procs.size(); ++i) {
     if (!procs[i]->shape()) continue;
     TH1 const* h = procs[i]->shape();
@@ -166,16 +171,9 @@ void BinByBinFactory::AddBinByBin(CombineHarvester &src, CombineHarvester &dest)
         ch::Systematic sys;
         ch::SetProperties(&sys, procs[i]);
         sys.set_type("shape");
-        std::string name = BinByBinFactory::GetPattern();
-        boost::replace_all(name, "$ANALYSIS", sys.analysis());
-        boost::replace_all(name, "$CHANNEL", sys.channel());
-        boost::replace_all(name, "$BIN", sys.bin());
-        boost::replace_all(name, "$BINID", boost::lexical_cast<std::string>(sys.bin_id()));
-        boost::replace_all(name, "$ERA", sys.era());
-        boost::replace_all(name, "$PROCESS", sys.process());
-        boost::replace_all(name, "$MASS", sys.mass());
-        boost::replace_all(name, "$#", boost::lexical_cast<std::string>(j));
-        sys.set_name(name);
+        pattern_vals.SetObject(*(procs[i]))
+            .Set(NamePattern::kIndex, boost::lexical_cast<std::string>(j));
+        sys.set_name(pattern.Render(pattern_vals));
         sys.set_asymm(true);
         std::unique_ptr<TH1> h_d(static_cast<TH1 *>(h->Clone()));
         std::unique_ptr<TH1> h_u(static_cast<TH1 *>(h->Clone()));
@@ -197,6 +195,7 @@ void BinByBinFactory::AddBinByBin(CombineHarvester &src, CombineHarvester &dest)
     }
   }
   // std::cout << "bbb added: " << bbb_added << std::endl;
+  PROFILE_COUNT("BinByBinFactory systematics added", bbb_added);
 }
 
 void BinByBinFactory::MergeAndAdd(CombineHarvester &src, CombineHarvester &dest) {
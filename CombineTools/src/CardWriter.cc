@@ -34,43 +34,40 @@ CardWriter& CardWriter::SetWildcardMasses(
   return *this;
 }
 
-auto CardWriter::BuildMap(std::string const& pattern,
+auto CardWriter::BuildMap(NamePattern const& pattern,
                           ch::CombineHarvester& cmb) const -> PatternMap {
   PatternMap f_map;
+  NamePattern::Values vals;
+  vals.Set(NamePattern::kTag, tag_);
   // We first filter Objects having a mass value in the wildcard list
   cmb.cp().mass(wildcard_masses_, false)
     .ForEachObj([&](ch::Object const* obj) {
       // Build the fully-compiled key
-      std::string key = Compile(pattern, obj);
+      vals.SetObject(*obj);
+      std::string key = pattern.Render(vals);
       if (f_map.count(key)) return;
       std::set<std::string> mappings;
       // The fully-compiled pattern always goes in
       mappings.insert(key);
-      // Compile again, but this time skipping the $MASS substitution
-      std::string maps_pattern = Compile(pattern, obj, true);
       // Create a set of patterns by substituting each mass wildcard
       for (auto m : wildcard_masses_) {
-        std::string tmp = maps_pattern;
-        boost::replace_all(tmp, "$MASS", m);
-        mappings.insert(tmp);
+        vals.Set(NamePattern::kMass, m);
+        mappings.insert(pattern.Render(vals));
       }
       f_map[key] = mappings;
     });
   auto masses = cmb.cp().mass(wildcard_masses_, false).mass_set();
   cmb.cp().mass(wildcard_masses_, true)
     .ForEachObj([&](ch::Object const* obj) {
-      // Build the fully-compiled key
-      std::string key = Compile(pattern, obj, true);
+      vals.SetObject(*obj);
+      // The pattern for this object goes in as-is
+      std::string wildcard_key = pattern.Render(vals);
       for (auto m : masses) {
-        std::string full_key = key;
-        boost::replace_all(full_key, "$MASS", m);
+        // Build the fully-compiled key for each mass value
+        vals.Set(NamePattern::kMass, m);
+        std::string full_key = pattern.Render(vals);
         if (f_map.count(full_key)) continue;
-        std::set<std::string> mappings;
-        // The fully-compiled pattern always goes in
-        std::string wildcard_key = key;
-        boost::replace_all(wildcard_key, "$MASS", obj->mass());
-        mappings.insert(wildcard_key);
-        f_map[full_key] = mappings;
+        f_map[full_key] = {wildcard_key};
       }
     });
   /*for (auto const& it : f_map) {
@@ -163,20 +160,13 @@ std::map<std::string, CombineHarvester> CardWriter::WriteCards(std::string const
   return datacards;
 }
 
-std::string CardWriter::Compile(std::string pattern, ch::Object const* obj,
-                                bool skip_mass) const {
+std::string CardWriter::Compile(NamePattern const& pattern,
+                                ch::Object const* obj) const {
   #ifdef TIME_FUNCTIONS
     LAUNCH_FUNCTION_TIMER(__timer__, __token__)
   #endif
-  boost::replace_all(pattern, "$TAG", tag_);
-  boost::replace_all(pattern, "$BINID",
-                     boost::lexical_cast<std::string>(obj->bin_id()));
-  boost::replace_all(pattern, "$BIN", obj->bin());
-  boost::replace_all(pattern, "$PROCESS", obj->process());
-  if (!skip_mass) boost::replace_all(pattern, "$MASS", obj->mass());
-  boost::replace_all(pattern, "$ERA", obj->era());
-  boost::replace_all(pattern, "$CHANNEL", obj->channel());
-  boost::replace_all(pattern, "$ANALYSIS", obj->analysis());
-  return pattern;
+  NamePattern::Values vals;
+  vals.SetObject(*obj).Set(NamePattern::kTag, tag_);
+  return pattern.Render(vals);
 }
 }
@@ -10,10 +10,31 @@
 #include "CombineHarvester/CombineTools/interface/Parameter.h"
 #include "CombineHarvester/CombineTools/interface/Logging.h"
 #include "CombineHarvester/CombineTools/interface/TFileIO.h"
+#include "CombineHarvester/CombineTools/interface/NamePattern.h"
 
 namespace ch {
 
-CombineHarvester::CombineHarvester() : verbosity_(0), log_(&(std::cout)) {
+namespace {
+// Substitute the properties of an entry into a shape mapping pattern. As in
+// the shapes lines of a datacard, $CHANNEL also stands for the bin name.
+void SetMappingValues(NamePattern::Values & vals, Object const* entry) {
+  vals.Set(NamePattern::kChannel, entry->bin())
+      .Set(NamePattern::kBin, entry->bin())
+      .Set(NamePattern::kProcess, entry->process())
+      .Set(NamePattern::kMass, entry->mass());
+}
+
+std::unique_ptr<TH1> ReadTH1(TFile* file, std::string const& path,
+                             TH1Prefetcher* prefetch) {
+  return prefetch ? prefetch->GetClonedTH1(file, path)
+                  : GetClonedTH1(file, path);
+}
+}
+
+CombineHarvester::CombineHarvester()
+    : pdf_shapes_(std::make_shared<PdfShapeStore>()),
+      verbosity_(0),
+      log_(&(std::cout)) {
   // if (verbosity_ >= 3) {
     // log() << "[CombineHarvester] Constructor called: " << this << "\n";
   // }
@@ -24,11 +45,28 @@ CombineHarvester::CombineHarvester() : verbosity_(0), log_(&(std::cout)) {
   flags_["workspace-uuid-recycle"] = true;
   flags_["import-parameter-err"] = true;
   flags_["filters-use-regex"] = false;
+  flags_["prefetch-shapes-on-import"] = true;
   // std::cout << "[CombineHarvester] Constructor called for " << this << "\n";
 }
 
 CombineHarvester::~CombineHarvester() {
   // std::cout << "[CombineHarvester] Destructor called for " << this << "\n";
+  procs_.clear();
+  PrunePdfShapes();
+}
+
+void CombineHarvester::PrunePdfShapes() {
+  // Can be null in an instance that has been swapped with a moved-from one
+  if (!pdf_shapes_) return;
+  std::lock_guard<std::mutex> lock(pdf_shapes_->mutex);
+  auto & shapes = pdf_shapes_->shapes;
+  for (auto it = shapes.begin(); it != shapes.end();) {
+    if (it->first.expired()) {
+      it = shapes.erase(it);
+    } else {
+      ++it;
+    }
+  }
 }
 
 void swap(CombineHarvester& first, CombineHarvester& second) {
@@ -45,6 +83,7 @@ void swap(CombineHarvester& first, CombineHarvester& second) {
   swap(first.post_lines_, second.post_lines_);
   swap(first.log_, second.log_);
   swap(first.auto_stats_settings_, second.auto_stats_settings_);
+  swap(first.pdf_shapes_, second.pdf_shapes_);
 }
 
 CombineHarvester::CombineHarvester(CombineHarvester const& other)
@@ -55,6 +94,7 @@ CombineHarvester::CombineHarvester(CombineHarvester const& other)
       wspaces_(other.wspaces_),
       flags_(other.flags_),
       auto_stats_settings_(other.auto_stats_settings_),
+      pdf_shapes_(other.pdf_shapes_),
       post_lines_(other.post_lines_),
       verbosity_(other.verbosity_),
       log_(other.log_) {
@@ -278,7 +318,9 @@ CombineHarvester & CombineHarvester::PrintParams() {
  *     the histogram, discarding any existing value.
  */
 void CombineHarvester::LoadShapes(Observation* entry,
-                                     std::vector<HistMapping> const& mappings) {
+                                     std::vector<HistMapping> const& mappings,
+                                     TH1Prefetcher* prefetch) {
+  PROFILE_FUNCTION();
   // Pre-condition #1
   if (entry->shape() || entry->data()) {
     throw std::runtime_error(FNERROR("Observation already contains a shape"));
@@ -299,10 +341,9 @@ void CombineHarvester::LoadShapes(Observation* entry,
   }
   HistMapping mapping =
       ResolveMapping(entry->process(), entry->bin(), mappings);
-  boost::replace_all(mapping.pattern, "$CHANNEL", entry->bin());
-  boost::replace_all(mapping.pattern, "$BIN", entry->bin());
-  boost::replace_all(mapping.pattern, "$PROCESS", entry->process());
-  boost::replace_all(mapping.pattern, "$MASS", entry->mass());
+  NamePattern::Values vals;
+  SetMappingValues(vals, entry);
+  mapping.pattern = MappingPattern(mapping.pattern).Render(vals);
 
   if (verbosity_ >= 2) {
     LOGLINE(log(), "Resolved Mapping:");
@@ -314,8 +355,9 @@ void CombineHarvester::LoadShapes(Observation* entry,
   } else if (mapping.IsHist()) {
     if (verbosity_ >= 2) LOGLINE(log(), "Mapping type in TH1");
     // Pre-condition #3
-    // GetClonedTH1 will throw if this fails
-    std::unique_ptr<TH1> h = GetClonedTH1(mapping.file.get(), mapping.pattern);
+    // ReadTH1 will throw if this fails
+    std::unique_ptr<TH1> h =
+        ReadTH1(mapping.file.get(), mapping.pattern, prefetch);
     // Post-conditions #1 and #2
     entry->set_shape(std::move(h), true);
   } else if (mapping.IsData()) {
@@ -362,7 +404,9 @@ void CombineHarvester::LoadShapes(Observation* entry,
  *     CombineHarvester instance.
  */
 void CombineHarvester::LoadShapes(Process* entry,
-                                     std::vector<HistMapping> const& mappings) {
+                                     std::vector<HistMapping> const& mappings,
+                                     TH1Prefetcher* prefetch) {
+  PROFILE_FUNCTION();
   // Pre-condition #1
   if (entry->shape() || entry->pdf()) {
     throw std::runtime_error(FNERROR("Process already contains a shape"));
@@ -383,10 +427,9 @@ void CombineHarvester::LoadShapes(Process* entry,
   }
   HistMapping mapping =
       ResolveMapping(entry->process(), entry->bin(), mappings);
-  boost::replace_all(mapping.pattern, "$CHANNEL", entry->bin());
-  boost::replace_all(mapping.pattern, "$BIN", entry->bin());
-  boost::replace_all(mapping.pattern, "$PROCESS", entry->process());
-  boost::replace_all(mapping.pattern, "$MASS", entry->mass());
+  NamePattern::Values vals;
+  SetMappingValues(vals, entry);
+  mapping.pattern = MappingPattern(mapping.pattern).Render(vals);
 
   if (verbosity_ >= 2) {
     LOGLINE(log(), "Resolved Mapping:");
@@ -398,8 +441,9 @@ void CombineHarvester::LoadShapes(Process* entry,
   } else if (mapping.IsHist()) {
     if (verbosity_ >= 2) LOGLINE(log(), "Mapping type is TH1");
     // Pre-condition #3
-    // GetClonedTH1 will throw if this fails
-    std::unique_ptr<TH1> h = GetClonedTH1(mapping.file.get(), mapping.pattern);
+    // ReadTH1 will throw if this fails
+    std::unique_ptr<TH1> h =
+        ReadTH1(mapping.file.get(), mapping.pattern, prefetch);
 
     if (flags_.at("check-negative-bins-on-import")) {
       if (HasNegativeBins(h.get())) {
@@ -446,10 +490,7 @@ void CombineHarvester::LoadShapes(Process* entry,
       // For when we're not parsing a datacard, syst_pattern is being using to
       // note a different mapping for the normalisation term
       norm_mapping.pattern = norm_mapping.syst_pattern;
-      boost::replace_all(norm_mapping.pattern, "$CHANNEL", entry->bin());
-      boost::replace_all(norm_mapping.pattern, "$BIN", entry->bin());
-      boost::replace_all(norm_mapping.pattern, "$PROCESS", entry->process());
-      boost::replace_all(norm_mapping.pattern, "$MASS", entry->mass());
+      norm_mapping.pattern = MappingPattern(norm_mapping.pattern).Render(vals);
     } else {
       norm_mapping.pattern += "_norm";
     }
@@ -509,7 +550,9 @@ void CombineHarvester::LoadShapes(Process* entry,
 }
 
 void CombineHarvester::LoadShapes(Systematic* entry,
-                                     std::vector<HistMapping> const& mappings) {
+                                     std::vector<HistMapping> const& mappings,
+                                     TH1Prefetcher* prefetch) {
+  PROFILE_FUNCTION();
   if (entry->shape_u() || entry->shape_d() ||
       entry->data_u() || entry->data_d()) {
     throw std::runtime_error(FNERROR("Systematic already contains a shape"));
@@ -526,25 +569,21 @@ void CombineHarvester::LoadShapes(Systematic* entry,
   // ResolveMapping will throw if this fails
   HistMapping mapping =
       ResolveMapping(entry->process(), entry->bin(), mappings);
-  boost::replace_all(mapping.pattern, "$CHANNEL", entry->bin());
-  boost::replace_all(mapping.pattern, "$BIN", entry->bin());
-  boost::replace_all(mapping.pattern, "$PROCESS", entry->process());
-  boost::replace_all(mapping.pattern, "$MASS", entry->mass());
-  std::string p_s =
-      mapping.IsPdf() ? mapping.SystWorkspaceObj() : mapping.syst_pattern;
-  boost::replace_all(p_s, "$CHANNEL", entry->bin());
-  boost::replace_all(p_s, "$BIN", entry->bin());
-  boost::replace_all(p_s, "$PROCESS", entry->process());
-  boost::replace_all(p_s, "$MASS", entry->mass());
-  std::string p_s_hi = p_s;
-  std::string p_s_lo = p_s;
-  boost::replace_all(p_s_hi, "$SYSTEMATIC", entry->name() + "Up");
-  boost::replace_all(p_s_lo, "$SYSTEMATIC", entry->name() + "Down");
+  NamePattern::Values vals;
+  SetMappingValues(vals, entry);
+  mapping.pattern = MappingPattern(mapping.pattern).Render(vals);
+  NamePattern const& p_s = MappingPattern(
+      mapping.IsPdf() ? mapping.SystWorkspaceObj() : mapping.syst_pattern);
+  std::string p_s_hi = p_s.Render(
+      vals.Set(NamePattern::kSystematic, entry->name() + "Up"));
+  std::string p_s_lo = p_s.Render(
+      vals.Set(NamePattern::kSystematic, entry->name() + "Down"));
   if (mapping.IsHist()) {
     if (verbosity_ >= 2) LOGLINE(log(), "Mapping type is TH1");
-    std::unique_ptr<TH1> h = GetClonedTH1(mapping.file.get(), mapping.pattern);
-    std::unique_ptr<TH1> h_u = GetClonedTH1(mapping.file.get(), p_s_hi);
-    std::unique_ptr<TH1> h_d = GetClonedTH1(mapping.file.get(), p_s_lo);
+    std::unique_ptr<TH1> h =
+        ReadTH1(mapping.file.get(), mapping.pattern, prefetch);
+    std::unique_ptr<TH1> h_u = ReadTH1(mapping.file.get(), p_s_hi, prefetch);
+    std::unique_ptr<TH1> h_d = ReadTH1(mapping.file.get(), p_s_lo, prefetch);
 
     if (flags_.at("check-negative-bins-on-import")) {
       if (HasNegativeBins(h.get())) {
@@ -598,6 +637,31 @@ void CombineHarvester::LoadShapes(Systematic* entry,
   }
 }
 
+/**
+ * Queue the histograms that LoadShapes would read for the entry
+ *
+ * Entries without a matching HistMapping, or whose mapping is not to a TH1,
+ * are skipped silently so that LoadShapes can report any error itself.
+ */
+void CombineHarvester::PrefetchShapes(Object const* entry,
+                                      std::string const& syst,
+                                      std::vector<HistMapping> const& mappings,
+                                      TH1Prefetcher & prefetch) {
+  HistMapping const* mapping =
+      FindMapping(entry->process(), entry->bin(), mappings);
+  if (!mapping || mapping->is_fake || !mapping->IsHist()) return;
+  NamePattern::Values vals;
+  SetMappingValues(vals, entry);
+  prefetch.Add(mapping->file.get(),
+               MappingPattern(mapping->pattern).Render(vals));
+  if (syst.empty()) return;
+  NamePattern const& p_s = MappingPattern(mapping->syst_pattern);
+  prefetch.Add(mapping->file.get(),
+               p_s.Render(vals.Set(NamePattern::kSystematic, syst + "Up")));
+  prefetch.Add(mapping->file.get(),
+               p_s.Render(vals.Set(NamePattern::kSystematic, syst + "Down")));
+}
+
 /**
  * Determines the best-matched HistMapping for a given process
  *
@@ -620,22 +684,39 @@ void CombineHarvester::LoadShapes(Systematic* entry,
 HistMapping const& CombineHarvester::ResolveMapping(
     std::string const& process, std::string const& bin,
     std::vector<HistMapping> const& mappings) {
+  HistMapping const* mapping = FindMapping(process, bin, mappings);
+  if (mapping) return *mapping;
+  // If we get this far then we didn't find a valid mapping
+  FNLOG(log()) << "Searching for mapping for (" << bin << "," << process << ")\n";
+  FNLOG(log()) << "Avaiable mappings:\n";
+  for (auto const& m : mappings) {
+    FNLOG(log()) << m << "\n";
+  }
+  throw std::runtime_error(FNERROR("Valid mapping not found"));
+}
+
+NamePattern const& CombineHarvester::MappingPattern(
+    std::string const& pattern) {
+  auto it = mapping_patterns_.find(pattern);
+  if (it == mapping_patterns_.end()) {
+    it = mapping_patterns_.emplace(pattern, NamePattern(pattern)).first;
+  }
+  return it->second;
+}
+
+HistMapping const* CombineHarvester::FindMapping(
+    std::string const& process, std::string const& bin,
+    std::vector<HistMapping> const& mappings) {
   StrPairVec attempts = GenerateShapeMapAttempts(process, bin);
   for (unsigned a = 0; a < attempts.size(); ++a) {
     for (unsigned m = 0; m < mappings.size(); ++m) {
       if ((attempts[a].first == mappings[m].process) &&
         (attempts[a].second == mappings[m].category)) {
-        return mappings[m];
+        return &(mappings[m]);
       }
     }
   }
-  // If we get this far then we didn't find a valid mapping
-  FNLOG(log()) << "Searching for mapping for (" << bin << "," << process << ")\n";
-  FNLOG(log()) << "Avaiable mappings:\n";
-  for (auto const& m : mappings) {
-    FNLOG(log()) << m << "\n";
-  }
-  throw std::runtime_error(FNERROR("Valid mapping not found"));
+  return nullptr;
 }
 
 CombineHarvester::StrPairVec CombineHarvester::GenerateShapeMapAttempts(
@@ -765,7 +846,8 @@ void CombineHarvester::ImportParameters(RooArgSet *vars) {
   } while (x->Next());
 }
 
-RooAbsData const* CombineHarvester::FindMatchingData(Process const* proc) {
+RooAbsData const* CombineHarvester::FindMatchingData(
+    Process const* proc) const {
   RooAbsData const* data_obj = nullptr;
   for (unsigned i = 0; i < obs_.size(); ++i) {
     if (proc->bin() == obs_[i]->bin() &&
@@ -6,8 +6,17 @@
 #include <iostream>
 #include <utility>
 #include <algorithm>
+#include <set>
+#include <unordered_map>
+#include <stdexcept>
+#include "boost/lexical_cast.hpp"
 #include "TDirectory.h"
 #include "TH1.h"
+#include "RooAbsArg.h"
+#include "RooAbsData.h"
+#include "RooArgSet.h"
+#include "RooRealVar.h"
+#include "RooWorkspace.h"
 #include "CombineHarvester/CombineTools/interface/Observation.h"
 #include "CombineHarvester/CombineTools/interface/Process.h"
 #include "CombineHarvester/CombineTools/interface/Systematic.h"
@@ -15,8 +24,35 @@
 #include "CombineHarvester/CombineTools/interface/Utilities.h"
 #include "CombineHarvester/CombineTools/interface/Logging.h"
 #include "CombineHarvester/CombineTools/interface/BinByBin.h"
+#include "CombineHarvester/CombineTools/interface/NamePattern.h"
 
 namespace ch {
+
+namespace {
+// Throws unless a column holds n values, a single value, or (if optional) no
+// values at all
+void CheckColumn(std::size_t size, std::size_t n, bool optional,
+                 std::string const& name) {
+  if (size == n || size == 1 || (optional && size == 0)) return;
+  throw std::runtime_error(FNERROR(
+      "Column " + name + " has " + boost::lexical_cast<std::string>(size) +
+      " entries, expected " + boost::lexical_cast<std::string>(n)));
+}
+
+// The element of a column for entry i, where a single value applies to all
+template <typename T>
+T const& ColumnValue(std::vector<T> const& col, std::size_t i) {
+  return col.size() == 1 ? col[0] : col[i];
+}
+
+// As above, for columns that may also be empty
+template <typename T>
+T ColumnValue(std::vector<T> const& col, std::size_t i, T const& def) {
+  if (col.empty()) return def;
+  return col.size() == 1 ? col[0] : col[i];
+}
+}
+
 void CombineHarvester::AddObservations(
     std::vector<std::string> mass,
     std::vector<std::string> analysis,
@@ -30,6 +66,7 @@ void CombineHarvester::AddObservations(
       unsigned(channel.size()),
       unsigned(bin.size())};
   auto comb = ch::GenerateCombinations(lengths);
+  obs_.reserve(obs_.size() + comb.size());
   for (auto const& c : comb) {
     auto obs = std::make_shared<Observation>();
     obs->set_mass(mass[c[0]]);
@@ -57,6 +94,7 @@ void CombineHarvester::AddProcesses(
       unsigned(channel.size()),
       unsigned(bin.size())};
   auto comb = ch::GenerateCombinations(lengths);
+  procs_.reserve(procs_.size() + comb.size() * procs.size());
   for (auto const& c : comb) {
     for (unsigned i = 0; i < procs.size(); ++i) {
       auto proc = std::make_shared<Process>();
@@ -73,65 +111,132 @@ void CombineHarvester::AddProcesses(
   }
 }
 
+void CombineHarvester::AddProcessColumns(ProcessColumns const& cols) {
+  std::size_t n = cols.process.size();
+  CheckColumn(cols.bin.size(), n, true, "bin");
+  CheckColumn(cols.bin_id.size(), n, true, "bin_id");
+  CheckColumn(cols.mass.size(), n, true, "mass");
+  CheckColumn(cols.analysis.size(), n, true, "analysis");
+  CheckColumn(cols.era.size(), n, true, "era");
+  CheckColumn(cols.channel.size(), n, true, "channel");
+  CheckColumn(cols.signal.size(), n, true, "signal");
+  std::string const empty;
+  procs_.reserve(procs_.size() + n);
+  for (std::size_t i = 0; i < n; ++i) {
+    auto proc = std::make_shared<Process>();
+    proc->set_process(cols.process[i]);
+    proc->set_bin(ColumnValue(cols.bin, i, empty));
+    proc->set_bin_id(ColumnValue(cols.bin_id, i, 0));
+    proc->set_mass(ColumnValue(cols.mass, i, empty));
+    proc->set_analysis(ColumnValue(cols.analysis, i, empty));
+    proc->set_era(ColumnValue(cols.era, i, empty));
+    proc->set_channel(ColumnValue(cols.channel, i, empty));
+    proc->set_signal(ColumnValue<bool>(cols.signal, i, false));
+    procs_.push_back(proc);
+  }
+}
+
 void CombineHarvester::AddSystFromProc(Process const& proc,
                                        std::string const& name,
                                        std::string const& type, bool asymm,
                                        double val_u, double val_d,
                                        std::string const& formula,
                                        std::string const& args) {
-  std::string subbed_name = name;
-  boost::replace_all(subbed_name, "$BINID",
-                     boost::lexical_cast<std::string>(proc.bin_id()));
-  boost::replace_all(subbed_name, "$BIN", proc.bin());
-  boost::replace_all(subbed_name, "$PROCESS", proc.process());
-  boost::replace_all(subbed_name, "$MASS", proc.mass());
-  boost::replace_all(subbed_name, "$ERA", proc.era());
-  boost::replace_all(subbed_name, "$CHANNEL", proc.channel());
-  boost::replace_all(subbed_name, "$ANALYSIS", proc.analysis());
-  std::map<std::string,std::string> attrs = proc.all_attributes();
-  for( const auto it : attrs){
-      boost::replace_all(subbed_name, "$ATTR("+it.first+")",proc.attribute(it.first));
+  SystColumns cols;
+  cols.name = {name};
+  cols.type = {type};
+  cols.value_u = {val_u};
+  cols.value_d = {val_d};
+  cols.asymm = {asymm};
+  cols.formula = {formula};
+  cols.args = {args};
+  AddSystsFromProcs({&proc}, cols);
+}
+
+void CombineHarvester::AddSystColumns(CombineHarvester & target,
+                                      SystColumns const& cols) {
+  std::vector<Process const*> procs(cols.proc.size());
+  for (std::size_t i = 0; i < procs.size(); ++i) {
+    if (cols.proc[i] >= procs_.size()) {
+      throw std::runtime_error(
+          FNERROR("Process index " +
+                  boost::lexical_cast<std::string>(cols.proc[i]) +
+                  " is out of range"));
+    }
+    procs[i] = procs_[cols.proc[i]].get();
   }
-  auto sys = std::make_shared<Systematic>();
-  ch::SetProperties(sys.get(), &proc);
-  sys->set_name(subbed_name);
-  sys->set_type(type);
-  if (type == "lnN" || type == "lnU") {
-    sys->set_asymm(asymm);
-    sys->set_value_u(val_u);
-    sys->set_value_d(val_d);
-    CreateParameterIfEmpty(sys->name());
-  } else if (type == "shape" || type == "shapeN2" || type == "shapeU") {
-    sys->set_asymm(true);
-    sys->set_value_u(1.0);
-    sys->set_value_d(1.0);
-    sys->set_scale(val_u);
-    CreateParameterIfEmpty(sys->name());
-  } else if (type == "rateParam") {
-    sys->set_asymm(false);
-    if (formula == "" && args == "") {
-      SetupRateParamVar(subbed_name, val_u);
-    } else {
-      std::string subbed_args = args;
-      boost::replace_all(subbed_args, "$BINID",
-                         boost::lexical_cast<std::string>(proc.bin_id()));
-      boost::replace_all(subbed_args, "$BIN", proc.bin());
-      boost::replace_all(subbed_args, "$PROCESS", proc.process());
-      boost::replace_all(subbed_args, "$MASS", proc.mass());
-      boost::replace_all(subbed_args, "$ERA", proc.era());
-      boost::replace_all(subbed_args, "$CHANNEL", proc.channel());
-      boost::replace_all(subbed_args, "$ANALYSIS", proc.analysis());
-      for( const auto it : attrs){
-          boost::replace_all(subbed_args, "$ATTR("+it.first+")",proc.attribute(it.first));
+  target.AddSystsFromProcs(procs, cols);
+}
+
+void CombineHarvester::AddSystsFromProcs(
+    std::vector<Process const*> const& procs, SystColumns const& cols) {
+  std::size_t n = procs.size();
+  if (n == 0) return;
+  CheckColumn(cols.name.size(), n, false, "name");
+  CheckColumn(cols.type.size(), n, false, "type");
+  CheckColumn(cols.value_u.size(), n, false, "value_u");
+  CheckColumn(cols.value_d.size(), n, true, "value_d");
+  CheckColumn(cols.asymm.size(), n, true, "asymm");
+  CheckColumn(cols.formula.size(), n, true, "formula");
+  CheckColumn(cols.args.size(), n, true, "args");
+
+  // Each distinct name or argument template is only parsed once
+  std::unordered_map<std::string, NamePattern> patterns;
+  auto get_pattern = [&](std::string const& pattern) -> NamePattern const& {
+    auto it = patterns.find(pattern);
+    if (it == patterns.end()) {
+      it = patterns.emplace(pattern, NamePattern(pattern)).first;
+    }
+    return it->second;
+  };
+  NamePattern const* common_name =
+      cols.name.size() == 1 ? &get_pattern(cols.name[0]) : nullptr;
+
+  std::string const empty;
+  NamePattern::Values vals;
+  std::string subbed_name;
+  systs_.reserve(systs_.size() + n);
+  for (std::size_t i = 0; i < n; ++i) {
+    Process const& proc = *(procs[i]);
+    vals.SetObject(proc);
+    std::string const& type = ColumnValue(cols.type, i);
+    double val_u = ColumnValue(cols.value_u, i);
+    double val_d = ColumnValue(cols.value_d, i, 0.);
+    bool asymm = ColumnValue<bool>(cols.asymm, i, !cols.value_d.empty());
+    std::string const& formula = ColumnValue(cols.formula, i, empty);
+    std::string const& args = ColumnValue(cols.args, i, empty);
+    (common_name ? *common_name : get_pattern(ColumnValue(cols.name, i)))
+        .Render(vals, subbed_name);
+    auto sys = std::make_shared<Systematic>();
+    ch::SetProperties(sys.get(), &proc);
+    sys->set_name(subbed_name);
+    sys->set_type(type);
+    if (type == "lnN" || type == "lnU") {
+      sys->set_asymm(asymm);
+      sys->set_value_u(val_u);
+      sys->set_value_d(val_d);
+      CreateParameterIfEmpty(sys->name());
+    } else if (type == "shape" || type == "shapeN2" || type == "shapeU") {
+      sys->set_asymm(true);
+      sys->set_value_u(1.0);
+      sys->set_value_d(1.0);
+      sys->set_scale(val_u);
+      CreateParameterIfEmpty(sys->name());
+    } else if (type == "rateParam") {
+      sys->set_asymm(false);
+      if (formula == "" && args == "") {
+        SetupRateParamVar(subbed_name, val_u);
+      } else {
+        SetupRateParamFunc(subbed_name, formula,
+                           get_pattern(args).Render(vals));
       }
-      SetupRateParamFunc(subbed_name, formula, subbed_args);
     }
+    if (sys->type() == "lnU" || sys->type() == "shapeU") {
+      params_.at(sys->name())->set_err_d(0.);
+      params_.at(sys->name())->set_err_u(0.);
+    }
+    systs_.push_back(sys);
   }
-  if (sys->type() == "lnU" || sys->type() == "shapeU") {
-    params_.at(sys->name())->set_err_d(0.);
-    params_.at(sys->name())->set_err_u(0.);
-  }
-  systs_.push_back(sys);
 }
 
 void CombineHarvester::RenameSystematic(CombineHarvester &target, std::string const& old_name,
@@ -154,22 +259,43 @@ void CombineHarvester::ExtractShapes(std::string const& file,
   mapping[0].pattern = rule;
   mapping[0].syst_pattern = syst_rule;
 
+  auto is_shape_syst = [](Systematic const* sys) {
+    return sys->type() == "shape" || sys->type() == "shapeN2" ||
+           sys->type() == "shapeU";
+  };
+
+  // Read all the histograms needed up front in a few batched reads
+  TH1Prefetcher prefetch;
+  if (flags_.at("prefetch-shapes-on-import")) {
+    for (unsigned  i = 0; i < obs_.size(); ++i) {
+      if (obs_[i]->shape() || obs_[i]->data()) continue;
+      PrefetchShapes(obs_[i].get(), "", mapping, prefetch);
+    }
+    for (unsigned  i = 0; i < procs_.size(); ++i) {
+      if (procs_[i]->shape() || procs_[i]->pdf()) continue;
+      PrefetchShapes(procs_[i].get(), "", mapping, prefetch);
+    }
+    for (unsigned  i = 0; i < systs_.size() && syst_rule != ""; ++i) {
+      if (!is_shape_syst(systs_[i].get())) continue;
+      PrefetchShapes(systs_[i].get(), systs_[i]->name(), mapping, prefetch);
+    }
+    prefetch.Run();
+  }
+
   // Note that these LoadShapes calls will fail if we encounter
   // any object that already has shapes
   for (unsigned  i = 0; i < obs_.size(); ++i) {
     if (obs_[i]->shape() || obs_[i]->data()) continue;
-    LoadShapes(obs_[i].get(), mapping);
+    LoadShapes(obs_[i].get(), mapping, &prefetch);
   }
   for (unsigned  i = 0; i < procs_.size(); ++i) {
     if (procs_[i]->shape() || procs_[i]->pdf()) continue;
-    LoadShapes(procs_[i].get(), mapping);
+    LoadShapes(procs_[i].get(), mapping, &prefetch);
   }
   if (syst_rule == "") return;
   for (unsigned  i = 0; i < systs_.size(); ++i) {
-    if (systs_[i]->type() != "shape" && systs_[i]->type() != "shapeN2" &&
-        systs_[i]->type() != "shapeU")
-      continue;
-    LoadShapes(systs_[i].get(), mapping);
+    if (!is_shape_syst(systs_[i].get())) continue;
+    LoadShapes(systs_[i].get(), mapping, &prefetch);
   }
 }
 
@@ -196,6 +322,115 @@ void CombineHarvester::ExtractPdfs(CombineHarvester& target,
   }
 }
 
+namespace {
+// Finds the RooRealVar leaves of a RooFit expression graph. The result is
+// remembered for every node visited, so that sub-graphs shared between
+// several pdfs are only traversed once.
+class LeafVarCache {
+ public:
+  std::vector<RooRealVar*> const& Get(RooAbsArg const* node) {
+    auto it = cache_.find(node);
+    if (it != cache_.end()) return it->second;
+    std::vector<RooRealVar*> res;
+    bool is_leaf = true;
+    RooFIter server_it = node->serverMIterator();
+    RooAbsArg *server = nullptr;
+    while ((server = server_it.next())) {
+      is_leaf = false;
+      std::vector<RooRealVar*> const& sub = Get(server);
+      res.insert(res.end(), sub.begin(), sub.end());
+    }
+    if (is_leaf) {
+      RooRealVar *var = dynamic_cast<RooRealVar*>(const_cast<RooAbsArg*>(node));
+      if (var) res.push_back(var);
+    }
+    std::sort(res.begin(), res.end());
+    res.erase(std::unique(res.begin(), res.end()), res.end());
+    return cache_[node] = std::move(res);
+  }
+
+ private:
+  std::unordered_map<RooAbsArg const*, std::vector<RooRealVar*>> cache_;
+};
+}
+
+void CombineHarvester::ExtractPdfsByName(
+    CombineHarvester& target, std::string const& ws_name,
+    std::map<std::pair<std::string, std::string>,
+             std::pair<std::string, std::string>> const& names) {
+  PROFILE_FUNCTION();
+  if (!wspaces_.count(ws_name)) return;
+  RooWorkspace *ws = wspaces_.at(ws_name).get();
+
+  // Same logic as FindMatchingData, but for all the entries at once
+  std::map<std::pair<std::string, int>, RooAbsData const*> data_map;
+  for (auto const& obs : obs_) {
+    data_map[std::make_pair(obs->bin(), obs->bin_id())] = obs->data();
+  }
+  // The names of the observables for each data object, or CMS_th1x if we
+  // don't have one
+  std::map<RooAbsData const*, std::set<std::string>> obs_names;
+  obs_names[nullptr] = {"CMS_th1x"};
+
+  LeafVarCache leaves;
+  std::set<RooRealVar*> imported;
+  auto import_params = [&](RooAbsReal const* func,
+                           std::set<std::string> const& exclude) {
+    RooArgSet argset;
+    for (RooRealVar *var : leaves.Get(func)) {
+      if (exclude.count(var->GetName()) || imported.count(var)) continue;
+      argset.add(*var);
+      imported.insert(var);
+    }
+    if (argset.getSize()) target.ImportParameters(&argset);
+  };
+
+  for (auto const& proc : procs_) {
+    if (proc->pdf()) continue;
+    auto it = names.find(std::make_pair(proc->bin(), proc->process()));
+    if (it == names.end()) continue;
+    if (verbosity_ >= 2) {
+      LOGLINE(log(), "Extracting pdf for Process:");
+      log() << Process::PrintHeader << *proc << "\n";
+    }
+    RooAbsReal* pdf = ws->function(it->second.first.c_str());
+    if (pdf) {
+      proc->set_pdf(pdf);
+    } else if (flags_.at("allow-missing-shapes")) {
+      LOGLINE(log(), "Warning, shape missing:");
+      log() << Process::PrintHeader << *proc << "\n";
+    } else {
+      throw std::runtime_error(FNERROR("RooAbsPdf " + it->second.first +
+                                       " not found in workspace"));
+    }
+    std::string norm_name = it->second.second != ""
+                                ? it->second.second
+                                : it->second.first + "_norm";
+    RooAbsReal* norm = ws->function(norm_name.c_str());
+    if (norm) proc->set_norm(norm);
+
+    auto data_it = data_map.find(std::make_pair(proc->bin(), proc->bin_id()));
+    RooAbsData const* data_obj =
+        data_it != data_map.end() ? data_it->second : nullptr;
+    if (!obs_names.count(data_obj)) {
+      RooFIter dat_it = data_obj->get()->fwdIterator();
+      RooAbsArg *dat_arg = nullptr;
+      while ((dat_arg = dat_it.next())) {
+        obs_names[data_obj].insert(dat_arg->GetName());
+      }
+    }
+    std::set<std::string> const& exclude = obs_names[data_obj];
+    if (pdf) {
+      import_params(pdf, exclude);
+      if (data_obj && !proc->observable()) {
+        proc->set_observable(dynamic_cast<RooRealVar*>(
+            pdf->findServer(data_obj->get()->first()->GetName())));
+      }
+    }
+    if (norm) import_params(norm, exclude);
+  }
+}
+
 void CombineHarvester::ExtractData(std::string const &ws_name,
                                    std::string const &rule) {
   std::vector<HistMapping> mapping(1);
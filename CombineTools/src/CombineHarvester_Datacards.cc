@@ -26,9 +26,55 @@
 #include "CombineHarvester/CombineTools/interface/TFileIO.h"
 #include "CombineHarvester/CombineTools/interface/Algorithm.h"
 #include "CombineHarvester/CombineTools/interface/GitVersion.h"
+#include "CombineHarvester/CombineTools/interface/NamePattern.h"
 
 namespace ch {
 
+namespace {
+typedef std::vector<std::vector<std::string>> CardWords;
+
+// Line i has the observed yields, and the line before it the bin names
+bool IsObservationLine(CardWords const& words, unsigned i) {
+  return i >= 1 && boost::iequals(words[i][0], "observation") &&
+         boost::iequals(words[i-1][0], "bin") &&
+         words[i].size() == words[i-1].size();
+}
+
+// Line i has the process rates, and the three lines before it the bin names,
+// the process names and the process ids
+bool IsRateLine(CardWords const& words, unsigned i) {
+  return i >= 3 && boost::iequals(words[i][0], "rate") &&
+         boost::iequals(words[i-1][0], "process") &&
+         boost::iequals(words[i-2][0], "process") &&
+         boost::iequals(words[i-3][0], "bin") &&
+         words[i].size() == words[i-1].size() &&
+         words[i].size() == words[i-2].size() &&
+         words[i].size() == words[i-3].size();
+}
+
+// Set the bin, process and signal flag of an entry from column p of the
+// lines above the rate line r. The process names and ids can be given in
+// either order.
+void SetProcessColumn(Object * obj, CardWords const& words, unsigned r,
+                      unsigned p) {
+  obj->set_bin(words[r-3][p]);
+  try {
+    int process_id = boost::lexical_cast<int>(words[r-2][p]);
+    obj->set_signal(process_id <= 0);
+    obj->set_process(words[r-1][p]);
+  } catch(boost::bad_lexical_cast &) {
+    int process_id = boost::lexical_cast<int>(words[r-1][p]);
+    obj->set_signal(process_id <= 0);
+    obj->set_process(words[r-2][p]);
+  }
+}
+
+bool IsShapeType(std::string const& type) {
+  return contains(
+      std::vector<std::string>{"shape", "shape?", "shapeN2", "shapeU"}, type);
+}
+}
+
 // Extract info from filename using parse rule like:
 // ".*{MASS}/{ANALYSIS}_{CHANNEL}_{BINID}_{ERA}.txt"
 int CombineHarvester::ParseDatacard(std::string const& filename,
@@ -57,6 +103,7 @@ int CombineHarvester::ParseDatacard(std::string const& filename,
     std::string const& channel,
     int bin_id,
     std::string const& mass) {
+  PROFILE_FUNCTION();
   TH1::AddDirectory(kFALSE);
   // Load the entire datacard into memory as a vector of strings
   std::vector<std::string> lines = ch::ParseFileLines(filename);
@@ -200,6 +247,48 @@ int CombineHarvester::ParseDatacard(std::string const& filename,
     }
   }
 
+  // Queue the histograms that the observation, process and shape
+  // systematic entries below will load, so that they can be read from the
+  // shape files in a few batched reads instead of one at a time. The lines
+  // are recognised with the same helpers as in the main loop, and anything
+  // missed is just read individually by LoadShapes.
+  TH1Prefetcher prefetch;
+  if (flags_.at("prefetch-shapes-on-import") && hist_mapping.size() > 0) {
+    unsigned pr = 0;
+    for (unsigned i = 1; i < words.size(); ++i) {
+      if (words[i].size() <= 1) continue;
+      if (IsObservationLine(words, i)) {
+        for (unsigned p = 1; p < words[i].size(); ++p) {
+          Observation obs;
+          obs.set_bin(words[i-1][p]);
+          obs.set_mass(mass);
+          PrefetchShapes(&obs, "", hist_mapping, prefetch);
+        }
+      }
+      if (IsRateLine(words, i)) {
+        pr = i;
+        for (unsigned p = 1; p < words[i].size(); ++p) {
+          Process proc;
+          SetProcessColumn(&proc, words, i, p);
+          proc.set_mass(mass);
+          PrefetchShapes(&proc, "", hist_mapping, prefetch);
+        }
+        continue;
+      }
+      if (pr > 0 && words[i].size() - 1 == words[pr].size() &&
+          IsShapeType(words[i][1])) {
+        for (unsigned p = 2; p < words[i].size(); ++p) {
+          if (words[i][p] == "-") continue;
+          Systematic sys;
+          SetProcessColumn(&sys, words, pr, p - 1);
+          sys.set_mass(mass);
+          PrefetchShapes(&sys, words[i][0], hist_mapping, prefetch);
+        }
+      }
+    }
+    prefetch.Run();
+  }
+
   // Loop through the vector of word vectors
   for (unsigned i = 0; i < words.size(); ++i) {
     // Ignore line if it only has one word
@@ -210,9 +299,7 @@ int CombineHarvester::ParseDatacard(std::string const& filename,
     // the previous line then we've found the entries for data, and
     // can add Observation objects
     if (i >= 1) {
-      if (  boost::iequals(words[i][0], "observation") &&
-            boost::iequals(words[i-1][0], "bin") &&
-            words[i].size() == words[i-1].size()) {
+      if (IsObservationLine(words, i)) {
         for (unsigned p = 1; p < words[i].size(); ++p) {
           auto obs = std::make_shared<Observation>();
           obs->set_bin(words[i-1][p]);
@@ -223,7 +310,7 @@ int CombineHarvester::ParseDatacard(std::string const& filename,
           obs->set_bin_id(bin_id);
           obs->set_mass(mass);
 
-          LoadShapes(obs.get(), hist_mapping);
+          LoadShapes(obs.get(), hist_mapping, &prefetch);
 
           obs_.push_back(obs);
         }
@@ -253,26 +340,11 @@ int CombineHarvester::ParseDatacard(std::string const& filename,
     // line that follows is a nuisance parameter
 
     if (i >= 3) {
-      if (  boost::iequals(words[i][0], "rate") &&
-            boost::iequals(words[i-1][0], "process") &&
-            boost::iequals(words[i-2][0], "process") &&
-            boost::iequals(words[i-3][0], "bin") &&
-            words[i].size() == words[i-1].size() &&
-            words[i].size() == words[i-2].size() &&
-            words[i].size() == words[i-3].size()) {
+      if (IsRateLine(words, i)) {
         for (unsigned p = 1; p < words[i].size(); ++p) {
           auto proc = std::make_shared<Process>();
-          proc->set_bin(words[i-3][p]);
-          bin_names.insert(words[i-3][p]);
-          try {
-            int process_id = boost::lexical_cast<int>(words[i-2][p]);
-            proc->set_signal(process_id <= 0);
-            proc->set_process(words[i-1][p]);
-          } catch(boost::bad_lexical_cast &) {
-            int process_id = boost::lexical_cast<int>(words[i-1][p]);
-            proc->set_signal(process_id <= 0);
-            proc->set_process(words[i-2][p]);
-          }
+          SetProcessColumn(proc.get(), words, i, p);
+          bin_names.insert(proc->bin());
           proc->set_rate(boost::lexical_cast<double>(words[i][p]));
           proc->set_analysis(analysis);
           proc->set_era(era);
@@ -280,7 +352,7 @@ int CombineHarvester::ParseDatacard(std::string const& filename,
           proc->set_bin_id(bin_id);
           proc->set_mass(mass);
 
-          LoadShapes(proc.get(), hist_mapping);
+          LoadShapes(proc.get(), hist_mapping, &prefetch);
 
           procs_.push_back(proc);
         }
@@ -433,20 +505,10 @@ int CombineHarvester::ParseDatacard(std::string const& filename,
       for (unsigned p = 2; p < words[i].size(); ++p) {
         if (words[i][p] == "-") continue;
         auto sys = std::make_shared<Systematic>();
-        sys->set_bin(words[r-3][p-1]);
-        try {
-          int process_id = boost::lexical_cast<int>(words[r-2][p-1]);
-          sys->set_signal(process_id <= 0);
-          sys->set_process(words[r-1][p-1]);
-        } catch(boost::bad_lexical_cast &) {
-          int process_id = boost::lexical_cast<int>(words[r-1][p-1]);
-          sys->set_signal(process_id <= 0);
-          sys->set_process(words[r-2][p-1]);
-        }
+        SetProcessColumn(sys.get(), words, r, p - 1);
         sys->set_name(words[i][0]);
         std::string type = words[i][1];
-        if (!contains(std::vector<std::string>{"shape", "shape?", "shapeN2", "shapeU", "lnN", "lnU"},
-                      type)) {
+        if (!IsShapeType(type) && type != "lnN" && type != "lnU") {
           throw std::runtime_error(
               FNERROR("Systematic type " + type + " not supported"));
         }
@@ -472,11 +534,11 @@ int CombineHarvester::ParseDatacard(std::string const& filename,
         if (sys->type() == "shape" || sys->type() == "shapeN2" ||
             sys->type() == "shapeU") {
           sys->set_scale(boost::lexical_cast<double>(words[i][p]));
-          LoadShapes(sys.get(), hist_mapping);
+          LoadShapes(sys.get(), hist_mapping, &prefetch);
         } else if (sys->type() == "shape?") {
           // This might fail, so we have to "try"
           try {
-            LoadShapes(sys.get(), hist_mapping);
+            LoadShapes(sys.get(), hist_mapping, &prefetch);
           } catch (std::exception & e) {
             if (verbosity_ > 0) {
               LOGLINE(log(), "Systematic with shape? did not resolve to a shape");
@@ -506,7 +568,7 @@ int CombineHarvester::ParseDatacard(std::string const& filename,
   if (single_obs) {
     if (bin_names.size() == 1) {
       single_obs->set_bin(*(bin_names.begin()));
-      LoadShapes(single_obs.get(), hist_mapping);
+      LoadShapes(single_obs.get(), hist_mapping, &prefetch);
       obs_.push_back(single_obs);
     } else {
       throw std::runtime_error(FNERROR(
@@ -702,6 +764,7 @@ void CombineHarvester::FillHistMappings(std::vector<HistMapping> & mappings) {
 
 void CombineHarvester::WriteDatacard(std::string const& name,
                                      TFile& root_file) {
+  PROFILE_FUNCTION();
   using boost::format;
 
   // First figure out if this is a counting-experiment only
@@ -869,13 +932,9 @@ void CombineHarvester::WriteDatacard(std::string const& name,
     for (auto const& obs : obs_) {
       txt_file << format("%-15s ") % obs->bin();
       if (obs->shape()) {
-        bool add_dir = TH1::AddDirectoryStatus();
-        TH1::AddDirectory(false);
-        std::unique_ptr<TH1> h((TH1*)(obs->shape()->Clone()));
-        h->Scale(obs->rate());
+        std::unique_ptr<TH1> h = obs->ClonedScaledShape();
         WriteHistToFile(h.get(), &root_file, mappings, obs->bin(), "data_obs",
                         obs->mass(), "", 0);
-        TH1::AddDirectory(add_dir);
       }
     }
     txt_file << "\n";
@@ -909,12 +968,9 @@ void CombineHarvester::WriteDatacard(std::string const& name,
   txt_file << format("%-"+sys_str_long+"s") % "bin";
   for (auto const& proc : procs_) {
     if (proc->shape()) {
-      bool add_dir = TH1::AddDirectoryStatus();
-      TH1::AddDirectory(false);
       std::unique_ptr<TH1> h = proc->ClonedScaledShape();
       WriteHistToFile(h.get(), &root_file, mappings, proc->bin(),
                       proc->process(), proc->mass(), "", 0);
-      TH1::AddDirectory(add_dir);
     }
     txt_file << format("%-15s ") % proc->bin();
   }
@@ -1015,8 +1071,6 @@ void CombineHarvester::WriteDatacard(std::string const& name,
           if (tp == "shapeU") seen_shapeU = true;
           line[p + 2] = (format("%g") % ptr->scale()).str();
           if (ptr->shape_u() && ptr->shape_d()) {
-            bool add_dir = TH1::AddDirectoryStatus();
-            TH1::AddDirectory(false);
             std::unique_ptr<TH1> h_d = ptr->ClonedShapeD();
             h_d->Scale(procs_[p]->rate() * ptr->value_d());
             WriteHistToFile(h_d.get(), &root_file, mappings, ptr->bin(),
@@ -1025,7 +1079,6 @@ void CombineHarvester::WriteDatacard(std::string const& name,
             h_u->Scale(procs_[p]->rate() * ptr->value_u());
             WriteHistToFile(h_u.get(), &root_file, mappings, ptr->bin(),
                             ptr->process(), ptr->mass(), ptr->name(), 2);
-            TH1::AddDirectory(add_dir);
             break;
           } else if (ptr->data_u() && ptr->data_d()) {
           } else {
@@ -1277,14 +1330,15 @@ void CombineHarvester::WriteHistToFile(
     for (unsigned m = 0; m < mappings.size(); ++m) {
       if ((attempts[a].first == mappings[m].process) &&
         (attempts[a].second == mappings[m].category)) {
-        std::string p = (type == 0 ?
-            mappings[m].pattern : mappings[m].syst_pattern);
-        boost::replace_all(p, "$CHANNEL", bin);
-        boost::replace_all(p, "$PROCESS", process);
-        boost::replace_all(p, "$MASS", mass);
-        if (type == 1) boost::replace_all(p, "$SYSTEMATIC", nuisance+"Down");
-        if (type == 2) boost::replace_all(p, "$SYSTEMATIC", nuisance+"Up");
-        WriteToTFile(hist, file, p);
+        NamePattern pattern(type == 0 ? mappings[m].pattern
+                                      : mappings[m].syst_pattern);
+        NamePattern::Values vals;
+        vals.Set(NamePattern::kChannel, bin)
+            .Set(NamePattern::kProcess, process)
+            .Set(NamePattern::kMass, mass);
+        if (type == 1) vals.Set(NamePattern::kSystematic, nuisance + "Down");
+        if (type == 2) vals.Set(NamePattern::kSystematic, nuisance + "Up");
+        WriteToTFile(hist, file, pattern.Render(vals));
         return;
       }
     }
@@ -6,6 +6,7 @@
 #include <utility>
 #include <set>
 #include <fstream>
+#include <limits>
 #include "boost/lexical_cast.hpp"
 #include "boost/algorithm/string.hpp"
 #include "boost/range/algorithm_ext/erase.hpp"
@@ -14,6 +15,8 @@
 #include "TDirectory.h"
 #include "TH1.h"
 #include "TH2.h"
+#include "TROOT.h"
+#include "RooRandom.h"
 #include "CombineHarvester/CombineTools/interface/Observation.h"
 #include "CombineHarvester/CombineTools/interface/Process.h"
 #include "CombineHarvester/CombineTools/interface/Systematic.h"
@@ -21,6 +24,8 @@
 #include "CombineHarvester/CombineTools/interface/MakeUnique.h"
 #include "CombineHarvester/CombineTools/interface/Utilities.h"
 #include "CombineHarvester/CombineTools/interface/Algorithm.h"
+#include "CombineHarvester/CombineTools/interface/Parallel.h"
+#include "CombineHarvester/CombineTools/interface/ParameterSampler.h"
 
 // #include "TMath.h"
 // #include "boost/format.hpp"
@@ -29,7 +34,40 @@
 
 namespace ch {
 
-CombineHarvester::ProcSystMap CombineHarvester::GenerateProcSystMap() {
+namespace {
+// Draw n_samples parameter sets from the fit covariance matrix, in chunks,
+// and call func(i) after setting the parameters of cb to the values of
+// sample i. The sampler seed is taken from the RooFit random generator, so
+// RooRandom::randomGenerator()->SetSeed() still controls the sampling.
+template <typename Function>
+void ForEachSample(CombineHarvester & cb, RooFitResult const& fit,
+                   unsigned n_samples, Function func) {
+  const unsigned kChunkSize = 1024;
+  ParameterSampler sampler(
+      fit, RooRandom::integer(std::numeric_limits<unsigned>::max()));
+  unsigned n_pars = sampler.NumParameters();
+  std::vector<ch::Parameter*> p_vec(n_pars, nullptr);
+  for (unsigned n = 0; n < n_pars; ++n) {
+    p_vec[n] = cb.GetParameter(sampler.Names()[n]);
+  }
+  std::vector<double> toys;
+  for (unsigned first = 0; first < n_samples; first += kChunkSize) {
+    unsigned n_toys = std::min(kChunkSize, n_samples - first);
+    toys.resize(std::size_t(n_toys) * n_pars);
+    sampler.Generate(n_toys, toys.data());
+    for (unsigned t = 0; t < n_toys; ++t) {
+      double const* vals = &(toys[std::size_t(t) * n_pars]);
+      for (unsigned n = 0; n < n_pars; ++n) {
+        if (p_vec[n]) p_vec[n]->set_val_lazy(vals[n]);
+      }
+      func(first + t);
+    }
+  }
+}
+}
+
+CombineHarvester::ProcSystMap CombineHarvester::GenerateProcSystMap() const {
+  PROFILE_FUNCTION();
   ProcSystMap lookup(procs_.size());
   for (unsigned i = 0; i < systs_.size(); ++i) {
     for (unsigned j = 0; j < procs_.size(); ++j) {
@@ -41,15 +79,115 @@ CombineHarvester::ProcSystMap CombineHarvester::GenerateProcSystMap() {
   return lookup;
 }
 
+CombineHarvester::ProcParamMap CombineHarvester::GenerateProcParamMap(
+    ProcSystMap const& lookup) const {
+  ProcParamMap result(lookup.size());
+  for (unsigned i = 0; i < lookup.size(); ++i) {
+    result[i].resize(lookup[i].size(), nullptr);
+    for (unsigned j = 0; j < lookup[i].size(); ++j) {
+      auto it = params_.find(lookup[i][j]->name());
+      if (it != params_.end()) result[i][j] = it->second.get();
+    }
+  }
+  return result;
+}
+
+double CombineHarvester::ParamValue(Systematic const* sys,
+                                    Parameter const* par) const {
+  if (!par) {
+    throw std::runtime_error(
+        FNERROR("Parameter " + sys->name() +
+                " not found in CombineHarvester instance"));
+  }
+  return par->val();
+}
+
+void CombineHarvester::SyncParameterVars(
+    std::vector<unsigned> const* subset) const {
+  // Only needed if one of the processes depends on workspace objects
+  unsigned n_procs = subset ? subset->size() : procs_.size();
+  bool needed = false;
+  for (unsigned k = 0; k < n_procs && !needed; ++k) {
+    unsigned i = subset ? (*subset)[k] : k;
+    needed = procs_[i]->pdf() || procs_[i]->norm();
+  }
+  if (needed) SyncParameterVars();
+}
+
+void CombineHarvester::SyncParameterVars() const {
+  for (auto const& it : params_) it.second->sync_vars();
+}
+
+std::vector<std::string> CombineHarvester::GetParameterNames() const {
+  std::vector<std::string> result;
+  result.reserve(params_.size());
+  for (auto const& it : params_) result.push_back(it.first);
+  return result;
+}
+
+std::vector<double> CombineHarvester::GetParameterValues() const {
+  std::vector<double> result;
+  result.reserve(params_.size());
+  for (auto const& it : params_) result.push_back(it.second->val());
+  return result;
+}
+
+CombineHarvester& CombineHarvester::SetParameterValues(
+    std::vector<double> const& vals) {
+  if (vals.size() != params_.size()) {
+    throw std::runtime_error(FNERROR(
+        "Expected " + boost::lexical_cast<std::string>(params_.size()) +
+        " values but received " + boost::lexical_cast<std::string>(vals.size())));
+  }
+  unsigned i = 0;
+  for (auto const& it : params_) it.second->set_val_lazy(vals[i++]);
+  return *this;
+}
+
+CombineHarvester::ParamProcMap CombineHarvester::GenerateParamProcMap(
+    ProcSystMap const& lookup) {
+  PROFILE_FUNCTION();
+  ParamProcMap result;
+  RooRealVar mx("CMS_th1x" , "CMS_th1x", 0, 1);
+  RooArgSet tmp_set(mx);
+  auto add_params = [&](RooAbsReal const* func, RooArgSet const* dat_vars,
+                        std::set<std::string> & names) {
+    RooArgSet argset = ParametersByName(func, dat_vars);
+    RooFIter par_it = argset.fwdIterator();
+    RooAbsArg *par = nullptr;
+    while ((par = par_it.next())) {
+      if (params_.count(par->GetName())) names.insert(par->GetName());
+    }
+  };
+  for (unsigned i = 0; i < procs_.size(); ++i) {
+    std::set<std::string> names;
+    for (Systematic const* sys : lookup[i]) names.insert(sys->name());
+    if (procs_[i]->pdf() || procs_[i]->norm()) {
+      RooAbsData const* data_obj = FindMatchingData(procs_[i].get());
+      RooArgSet const* dat_vars = data_obj ? data_obj->get() : &tmp_set;
+      if (procs_[i]->pdf()) add_params(procs_[i]->pdf(), dat_vars, names);
+      if (procs_[i]->norm()) add_params(procs_[i]->norm(), dat_vars, names);
+    }
+    for (auto const& name : names) result[name].push_back(i);
+  }
+  return result;
+}
+
 double CombineHarvester::GetUncertainty() {
   auto lookup = GenerateProcSystMap();
+  auto pars = GenerateProcParamMap(lookup);
+  auto affected = GenerateParamProcMap(lookup);
   double err_sq = 0.0;
   for (auto param_it : params_) {
+    // The processes that do not depend on this parameter would cancel in the
+    // difference below, so only sum the ones that do
+    auto aff_it = affected.find(param_it.first);
+    if (aff_it == affected.end()) continue;
     double backup = param_it.second->val();
     param_it.second->set_val(backup+param_it.second->err_d());
-    double rate_d = this->GetRateInternal(lookup, param_it.first);
+    double rate_d = this->GetRateInternal(lookup, pars, &(aff_it->second));
     param_it.second->set_val(backup+param_it.second->err_u());
-    double rate_u = this->GetRateInternal(lookup, param_it.first);
+    double rate_u = this->GetRateInternal(lookup, pars, &(aff_it->second));
     double err = std::fabs(rate_u-rate_d) / 2.0;
     err_sq += err * err;
     param_it.second->set_val(backup);
@@ -65,53 +203,39 @@ double CombineHarvester::GetUncertainty(RooFitResult const* fit,
 double CombineHarvester::GetUncertainty(RooFitResult const& fit,
                                         unsigned n_samples) {
   auto lookup = GenerateProcSystMap();
-  double rate = GetRateInternal(lookup);
+  auto pars = GenerateProcParamMap(lookup);
+  double rate = GetRateInternal(lookup, pars);
   double err_sq = 0.0;
 
   // Create a backup copy of the current parameter values
-  auto backup = GetParameters();
-
-  // Calling randomizePars() ensures that the RooArgList of sampled parameters
-  // is already created within the RooFitResult
-  RooArgList const& rands = fit.randomizePars();
-
-  // Now create two aligned vectors of the RooRealVar parameters and the
-  // corresponding ch::Parameter pointers
-  int n_pars = rands.getSize();
-  std::vector<RooRealVar const*> r_vec(n_pars, nullptr);
-  std::vector<ch::Parameter*> p_vec(n_pars, nullptr);
-  for (unsigned n = 0; n < p_vec.size(); ++n) {
-    r_vec[n] = dynamic_cast<RooRealVar const*>(rands.at(n));
-    p_vec[n] = GetParameter(r_vec[n]->GetName());
-  }
-
-  for (unsigned i = 0; i < n_samples; ++i) {
-    // Randomise and update values
-    fit.randomizePars();
-    for (int n = 0; n < n_pars; ++n) {
-      if (p_vec[n]) p_vec[n]->set_val(r_vec[n]->getVal());
-    }
+  auto backup = GetParameterValues();
 
-    double rand_rate = this->GetRateInternal(lookup);
+  ForEachSample(*this, fit, n_samples, [&](unsigned) {
+    double rand_rate = this->GetRateInternal(lookup, pars);
     double err = std::fabs(rand_rate-rate);
     err_sq += (err*err);
-  }
-  this->UpdateParameters(backup);
+  });
+  this->SetParameterValues(backup);
+  this->SyncParameterVars();
   return std::sqrt(err_sq/double(n_samples));
 }
 
 TH1F CombineHarvester::GetShapeWithUncertainty() {
   auto lookup = GenerateProcSystMap();
-  TH1F shape = GetShape();
+  auto pars = GenerateProcParamMap(lookup);
+  auto affected = GenerateParamProcMap(lookup);
+  TH1F shape = GetShapeInternal(lookup, pars);
   for (int i = 1; i <= shape.GetNbinsX(); ++i) {
     shape.SetBinError(i, 0.0);
   }
   for (auto param_it : params_) {
+    auto aff_it = affected.find(param_it.first);
+    if (aff_it == affected.end()) continue;
     double backup = param_it.second->val();
     param_it.second->set_val(backup+param_it.second->err_d());
-    TH1F shape_d = this->GetShapeInternal(lookup, param_it.first);
+    TH1F shape_d = this->GetShapeInternal(lookup, pars, &(aff_it->second));
     param_it.second->set_val(backup+param_it.second->err_u());
-    TH1F shape_u = this->GetShapeInternal(lookup, param_it.first);
+    TH1F shape_u = this->GetShapeInternal(lookup, pars, &(aff_it->second));
     for (int i = 1; i <= shape.GetNbinsX(); ++i) {
       double err =
           std::fabs(shape_u.GetBinContent(i) - shape_d.GetBinContent(i)) / 2.0;
@@ -133,49 +257,269 @@ TH1F CombineHarvester::GetShapeWithUncertainty(RooFitResult const* fit,
 TH1F CombineHarvester::GetShapeWithUncertainty(RooFitResult const& fit,
                                                unsigned n_samples) {
   auto lookup = GenerateProcSystMap();
-  TH1F shape = GetShapeInternal(lookup);
+  auto pars = GenerateProcParamMap(lookup);
+  TH1F shape = GetShapeInternal(lookup, pars);
   for (int i = 1; i <= shape.GetNbinsX(); ++i) {
     shape.SetBinError(i, 0.0);
   }
   // Create a backup copy of the current parameter values
-  auto backup = GetParameters();
-
-  // Calling randomizePars() ensures that the RooArgList of sampled parameters
-  // is already created within the RooFitResult
-  RooArgList const& rands = fit.randomizePars();
-
-  // Now create two aligned vectors of the RooRealVar parameters and the
-  // corresponding ch::Parameter pointers
-  int n_pars = rands.getSize();
-  std::vector<RooRealVar const*> r_vec(n_pars, nullptr);
-  std::vector<ch::Parameter*> p_vec(n_pars, nullptr);
-  for (unsigned n = 0; n < p_vec.size(); ++n) {
-    r_vec[n] = dynamic_cast<RooRealVar const*>(rands.at(n));
-    p_vec[n] = GetParameter(r_vec[n]->GetName());
-  }
+  auto backup = GetParameterValues();
 
   // Main loop through n_samples
-  for (unsigned i = 0; i < n_samples; ++i) {
-    // Randomise and update values
-    fit.randomizePars();
-    for (int n = 0; n < n_pars; ++n) {
-      if (p_vec[n]) p_vec[n]->set_val(r_vec[n]->getVal());
-    }
-
-    TH1F rand_shape = this->GetShapeInternal(lookup);
+  ForEachSample(*this, fit, n_samples, [&](unsigned) {
+    TH1F rand_shape = this->GetShapeInternal(lookup, pars);
     for (int i = 1; i <= shape.GetNbinsX(); ++i) {
       double err =
           std::fabs(rand_shape.GetBinContent(i) - shape.GetBinContent(i));
       shape.SetBinError(i, err*err + shape.GetBinError(i));
     }
-  }
+  });
   for (int i = 1; i <= shape.GetNbinsX(); ++i) {
     shape.SetBinError(i, std::sqrt(shape.GetBinError(i)/double(n_samples)));
   }
-  this->UpdateParameters(backup);
+  this->SetParameterValues(backup);
+  this->SyncParameterVars();
   return shape;
 }
 
+std::vector<TH1F> CombineHarvester::GetShapesWithUncertainty(
+    std::vector<CombineHarvester> const& groups, RooFitResult const& fit,
+    unsigned n_samples, unsigned n_threads) {
+  PROFILE_FUNCTION();
+  // Unset gDirectory before any worker threads are started, see
+  // GetShapeInternal
+  TDirectory::TContext no_dir(nullptr);
+  auto lookup = GenerateProcSystMap();
+  auto pars = GenerateProcParamMap(lookup);
+
+  std::vector<unsigned> used_procs;
+  auto group_procs = GroupIndices(groups, used_procs);
+  std::vector<std::vector<unsigned>> singles(used_procs.size());
+  // Only processes with a plain TH1 template and no RooFit normalisation
+  // term are evaluated in the worker threads. RooFit is not thread-safe, so
+  // anything that goes through a pdf, a RooDataHist or a norm() function is
+  // evaluated serially.
+  std::vector<unsigned> hist_procs;
+  std::vector<unsigned> serial_procs;
+  for (unsigned k = 0; k < used_procs.size(); ++k) {
+    Process const* proc = procs_[used_procs[k]].get();
+    singles[k] = {used_procs[k]};
+    if (proc->shape() && !proc->norm()) {
+      hist_procs.push_back(k);
+    } else {
+      serial_procs.push_back(k);
+    }
+  }
+  // The worker threads below create TH1F objects
+  if (n_threads > 1 && hist_procs.size() > 1) ROOT::EnableThreadSafety();
+
+  // Evaluate the shape of every used process at the current parameter values
+  std::vector<TH1F> proc_shapes(used_procs.size());
+  auto eval_procs = [&]() {
+    // Update any RooRealVars here, and not in the threads below
+    SyncParameterVars(&used_procs);
+    for (unsigned k : serial_procs) {
+      proc_shapes[k] = GetShapeInternal(lookup, pars, &(singles[k]));
+    }
+    ParallelFor(hist_procs.size(), n_threads, [&](std::size_t k) {
+      proc_shapes[hist_procs[k]] =
+          GetShapeInternal(lookup, pars, &(singles[hist_procs[k]]));
+    });
+  };
+  auto sum_group = [&](unsigned g, TH1F & target) {
+    bool init = false;
+    for (unsigned k : group_procs[g]) {
+      if (!init) {
+        proc_shapes[k].Copy(target);
+        init = true;
+      } else {
+        target.Add(&(proc_shapes[k]));
+      }
+    }
+  };
+
+  eval_procs();
+  std::vector<TH1F> result(groups.size());
+  for (unsigned g = 0; g < groups.size(); ++g) {
+    if (group_procs[g].empty()) continue;
+    sum_group(g, result[g]);
+    for (int i = 1; i <= result[g].GetNbinsX(); ++i) {
+      result[g].SetBinError(i, 0.0);
+    }
+  }
+
+  auto backup = GetParameterValues();
+
+  // Accumulate the squared deviations from the nominal for each group
+  std::vector<std::vector<double>> err_sq(groups.size());
+  for (unsigned g = 0; g < groups.size(); ++g) {
+    err_sq[g].resize(result[g].GetNbinsX() + 1, 0.);
+  }
+  // Every group is evaluated from the same parameter samples
+  TH1F rand_shape;
+  ForEachSample(*this, fit, n_samples, [&](unsigned) {
+    eval_procs();
+    for (unsigned g = 0; g < groups.size(); ++g) {
+      if (group_procs[g].empty()) continue;
+      sum_group(g, rand_shape);
+      for (int b = 1; b <= result[g].GetNbinsX(); ++b) {
+        double err = rand_shape.GetBinContent(b) - result[g].GetBinContent(b);
+        err_sq[g][b] += err * err;
+      }
+    }
+  });
+  for (unsigned g = 0; g < groups.size(); ++g) {
+    if (group_procs[g].empty()) continue;
+    for (int b = 1; b <= result[g].GetNbinsX(); ++b) {
+      result[g].SetBinError(b, std::sqrt(err_sq[g][b] / double(n_samples)));
+    }
+  }
+  this->SetParameterValues(backup);
+  this->SyncParameterVars();
+  return result;
+}
+
+std::vector<std::vector<unsigned>> CombineHarvester::GroupIndices(
+    std::vector<CombineHarvester> const& groups,
+    std::vector<unsigned> & used_procs) const {
+  std::map<Process const*, unsigned> proc_idx;
+  for (unsigned i = 0; i < procs_.size(); ++i) proc_idx[procs_[i].get()] = i;
+  std::vector<std::vector<unsigned>> group_procs(groups.size());
+  std::map<unsigned, unsigned> used;
+  used_procs.clear();
+  for (unsigned g = 0; g < groups.size(); ++g) {
+    for (auto const& proc : groups[g].procs_) {
+      auto it = proc_idx.find(proc.get());
+      if (it == proc_idx.end()) {
+        throw std::runtime_error(FNERROR(
+            "Process in group " + boost::lexical_cast<std::string>(g) +
+            " is not contained in this CombineHarvester instance"));
+      }
+      auto ins = used.emplace(it->second, used_procs.size());
+      if (ins.second) used_procs.push_back(it->second);
+      group_procs[g].push_back(ins.first->second);
+    }
+  }
+  return group_procs;
+}
+
+std::vector<std::pair<double, double>>
+CombineHarvester::GetRatesWithUncertainty(
+    std::vector<CombineHarvester> const& groups, RooFitResult const& fit,
+    unsigned n_samples, unsigned n_threads) {
+  PROFILE_FUNCTION();
+  auto lookup = GenerateProcSystMap();
+  auto pars = GenerateProcParamMap(lookup);
+  std::vector<unsigned> used_procs;
+  auto group_procs = GroupIndices(groups, used_procs);
+  unsigned n_used = used_procs.size();
+
+  ParameterSampler sampler(
+      fit, RooRandom::integer(std::numeric_limits<unsigned>::max()));
+  unsigned n_pars = sampler.NumParameters();
+  std::vector<ch::Parameter*> p_vec(n_pars, nullptr);
+  std::map<Parameter const*, int> sample_idx;
+  for (unsigned n = 0; n < n_pars; ++n) {
+    p_vec[n] = GetParameter(sampler.Names()[n]);
+    if (p_vec[n] && !p_vec[n]->frozen()) sample_idx[p_vec[n]] = n;
+  }
+
+  // The yield of a process without any workspace objects is just the
+  // nominal rate times the product of the lnN-style terms. For these we
+  // record, for each term, the index of the sampled parameter (or -1 if it
+  // is not sampled) so that the toys can be evaluated directly from the
+  // sampled values, and in parallel. The others go through GetRateInternal.
+  struct Term {
+    Systematic const* sys;
+    int idx;
+    double x;
+  };
+  std::vector<double> base(n_used, 0.);
+  std::vector<std::vector<Term>> terms(n_used);
+  std::vector<std::vector<unsigned>> singles(n_used);
+  std::vector<unsigned> ws_procs;
+  for (unsigned k = 0; k < n_used; ++k) {
+    unsigned i = used_procs[k];
+    singles[k] = {i};
+    if (procs_[i]->pdf() || procs_[i]->norm()) {
+      ws_procs.push_back(k);
+      continue;
+    }
+    base[k] = procs_[i]->rate();
+    for (unsigned j = 0; j < lookup[i].size(); ++j) {
+      Systematic const* sys = lookup[i][j];
+      if (sys->type() == "rateParam") continue;
+      auto it = sample_idx.find(pars[i][j]);
+      terms[k].push_back({sys, it != sample_idx.end() ? it->second : -1,
+                          ParamValue(sys, pars[i][j])});
+    }
+  }
+
+  std::vector<std::pair<double, double>> result(groups.size());
+  std::vector<double> nominal(n_used);
+  for (unsigned k = 0; k < n_used; ++k) {
+    nominal[k] = GetRateInternal(lookup, pars, &(singles[k]));
+  }
+  for (unsigned g = 0; g < groups.size(); ++g) {
+    for (unsigned k : group_procs[g]) result[g].first += nominal[k];
+  }
+
+  auto backup = GetParameterValues();
+  const unsigned kChunkSize = 1024;
+  std::vector<double> err_sq(groups.size(), 0.);
+  std::vector<double> toys;
+  std::vector<double> rates;
+  for (unsigned first = 0; first < n_samples; first += kChunkSize) {
+    unsigned n_toys = std::min(kChunkSize, n_samples - first);
+    toys.resize(std::size_t(n_toys) * n_pars);
+    rates.resize(std::size_t(n_toys) * n_used);
+    sampler.Generate(n_toys, toys.data(), n_threads);
+    ParallelFor(n_toys, n_threads, [&](std::size_t t) {
+      double const* vals = &(toys[t * n_pars]);
+      double * t_rates = &(rates[t * n_used]);
+      for (unsigned k = 0; k < n_used; ++k) {
+        double p_rate = base[k];
+        for (Term const& term : terms[k]) {
+          double x = term.idx >= 0 ? vals[term.idx] : term.x;
+          if (term.sys->asymm()) {
+            p_rate *= logKappaForX(x * term.sys->scale(), term.sys->value_d(),
+                                   term.sys->value_u());
+          } else {
+            p_rate *= std::pow(term.sys->value_u(), x * term.sys->scale());
+          }
+        }
+        t_rates[k] = p_rate;
+      }
+    });
+    if (!ws_procs.empty()) {
+      for (unsigned t = 0; t < n_toys; ++t) {
+        double const* vals = &(toys[std::size_t(t) * n_pars]);
+        for (unsigned n = 0; n < n_pars; ++n) {
+          if (p_vec[n]) p_vec[n]->set_val_lazy(vals[n]);
+        }
+        for (unsigned k : ws_procs) {
+          rates[std::size_t(t) * n_used + k] =
+              GetRateInternal(lookup, pars, &(singles[k]));
+        }
+      }
+    }
+    ParallelFor(groups.size(), n_threads, [&](std::size_t g) {
+      for (unsigned t = 0; t < n_toys; ++t) {
+        double rate = 0.;
+        for (unsigned k : group_procs[g]) rate += rates[t * n_used + k];
+        double err = rate - result[g].first;
+        err_sq[g] += err * err;
+      }
+    });
+  }
+  for (unsigned g = 0; g < groups.size(); ++g) {
+    result[g].second = std::sqrt(err_sq[g] / double(n_samples));
+  }
+  this->SetParameterValues(backup);
+  this->SyncParameterVars();
+  return result;
+}
+
 TH2F CombineHarvester::GetRateCovariance(RooFitResult const& fit,
                                          unsigned n_samples) {
   auto lookup = GenerateProcSystMap();
@@ -200,30 +544,10 @@ TH2F CombineHarvester::GetRateCovariance(RooFitResult const& fit,
   for (unsigned i = 0; i < procs_.size(); ++i) {
     nom.SetBinContent(i + 1, ch_procs[i].GetRate());
   }
-  auto backup = GetParameters();
-
-  // Calling randomizePars() ensures that the RooArgList of sampled parameters
-  // is already created within the RooFitResult
-  RooArgList const& rands = fit.randomizePars();
-
-  // Now create two aligned vectors of the RooRealVar parameters and the
-  // corresponding ch::Parameter pointers
-  int n_pars = rands.getSize();
-  std::vector<RooRealVar const*> r_vec(n_pars, nullptr);
-  std::vector<ch::Parameter*> p_vec(n_pars, nullptr);
-  for (unsigned n = 0; n < p_vec.size(); ++n) {
-    r_vec[n] = dynamic_cast<RooRealVar const*>(rands.at(n));
-    p_vec[n] = GetParameter(r_vec[n]->GetName());
-  }
+  auto backup = GetParameterValues();
 
   // Main loop through n_samples
-  for (unsigned rnd = 0; rnd < n_samples; ++rnd) {
-    // Randomise and update values
-    fit.randomizePars();
-    for (int n = 0; n < n_pars; ++n) {
-      if (p_vec[n]) p_vec[n]->set_val(r_vec[n]->getVal());
-    }
-
+  ForEachSample(*this, fit, n_samples, [&](unsigned) {
     for (int i = 1; i <= nom.GetNbinsX(); ++i) {
       for (int j = 1; j <= nom.GetNbinsX(); ++j) {
         int x = j;
@@ -236,7 +560,7 @@ TH2F CombineHarvester::GetRateCovariance(RooFitResult const& fit,
                       (ch_procs[j - 1].GetRate() - nom.GetBinContent(j)));
       }
     }
-  }
+  });
 
   for (int i = 1; i <= nom.GetNbinsX(); ++i) {
     for (int j = 1; j <= nom.GetNbinsX(); ++j) {
@@ -245,7 +569,8 @@ TH2F CombineHarvester::GetRateCovariance(RooFitResult const& fit,
       res.SetBinContent(x, y, res.GetBinContent(x, y) / double(n_samples));
     }
   }
-  this->UpdateParameters(backup);
+  this->SetParameterValues(backup);
+  this->SyncParameterVars();
   return res;
 }
 
@@ -269,37 +594,103 @@ TH2F CombineHarvester::GetRateCorrelation(RooFitResult const& fit,
   return res;
 }
 
-double CombineHarvester::GetRate() {
+double CombineHarvester::GetRate() const {
   auto lookup = GenerateProcSystMap();
-  return GetRateInternal(lookup);
+  auto pars = GenerateProcParamMap(lookup);
+  return GetRateInternal(lookup, pars);
 }
 
-TH1F CombineHarvester::GetShape() {
+TH1F CombineHarvester::GetShape() const {
   auto lookup = GenerateProcSystMap();
-  return GetShapeInternal(lookup);
+  auto pars = GenerateProcParamMap(lookup);
+  return GetShapeInternal(lookup, pars);
+}
+
+TH1F CombineHarvester::GetPdfShape(
+    std::shared_ptr<Process> const& proc) const {
+  // The lock also covers the evaluation, since the pdf and its observable
+  // are shared with every other instance that holds this Process
+  std::lock_guard<std::mutex> lock(pdf_shapes_->mutex);
+  if (!proc->observable()) {
+    RooAbsData const* data_obj = FindMatchingData(proc.get());
+    std::string var_name = "CMS_th1x";
+    if (data_obj) var_name = data_obj->get()->first()->GetName();
+    proc->set_observable((RooRealVar *)proc->pdf()->findServer(var_name.c_str()));
+  }
+  RooAbsReal const* pdf = proc->pdf();
+  RooRealVar * x = proc->observable();
+  PdfShapeCache & cache =
+      pdf_shapes_->shapes[std::weak_ptr<Process const>(proc)];
+  if (cache.pdf != pdf || cache.observable != x ||
+      cache.nbins != x->getBins() || cache.xmin != x->getMin() ||
+      cache.xmax != x->getMax()) {
+    // First time we see this pdf, or the binning of the observable has
+    // changed, e.g. with SetPdfBins: store the binning and the list of
+    // parameters the pdf depends on
+    cache = PdfShapeCache();
+    cache.pdf = pdf;
+    cache.observable = x;
+    cache.nbins = x->getBins();
+    cache.xmin = x->getMin();
+    cache.xmax = x->getMax();
+    TDirectory::TContext no_dir(nullptr);
+    std::unique_ptr<TH1> tmp(x->createHistogram(""));
+    static_cast<TH1F*>(tmp.get())->Copy(cache.shape);
+    cache.shape.SetDirectory(nullptr);
+    std::unique_ptr<RooArgSet> params(pdf->getParameters(RooArgSet(*x)));
+    cache.cacheable = true;
+    RooFIter par_it = params->fwdIterator();
+    RooAbsArg *par = nullptr;
+    while ((par = par_it.next())) {
+      RooRealVar const* var = dynamic_cast<RooRealVar const*>(par);
+      if (var) {
+        cache.params.push_back(var);
+      } else {
+        // Can't track the value of anything else, so always re-evaluate
+        cache.cacheable = false;
+      }
+    }
+  }
+  // Skip the evaluation if none of the parameters have changed
+  std::vector<double> values(cache.params.size());
+  for (unsigned i = 0; i < cache.params.size(); ++i) {
+    values[i] = cache.params[i]->getVal();
+  }
+  if (cache.cacheable && cache.valid && cache.values == values) {
+    return cache.shape;
+  }
+  PROFILE_COUNT("GetPdfShape pdf evaluations", 1);
+  double x_val = x->getVal();
+  for (int b = 1; b <= cache.shape.GetNbinsX(); ++b) {
+    x->setVal(cache.shape.GetBinCenter(b));
+    cache.shape.SetBinContent(b, cache.shape.GetBinWidth(b) * pdf->getVal());
+  }
+  x->setVal(x_val);
+  RooAbsPdf const* aspdf = dynamic_cast<RooAbsPdf const*>(pdf);
+  if ((aspdf && !aspdf->selfNormalized()) || (!aspdf)) {
+    if (cache.shape.Integral() > 0.) {
+      cache.shape.Scale(1. / cache.shape.Integral());
+    }
+  }
+  cache.values = std::move(values);
+  cache.valid = true;
+  return cache.shape;
 }
 
 double CombineHarvester::GetRateInternal(ProcSystMap const& lookup,
-    std::string const& single_sys) {
+    ProcParamMap const& pars, std::vector<unsigned> const* subset) const {
+  SyncParameterVars(subset);
   double rate = 0.0;
-  // TH1F tot_shape
-  for (unsigned i = 0; i < procs_.size(); ++i) {
+  unsigned n_procs = subset ? subset->size() : procs_.size();
+  for (unsigned k = 0; k < n_procs; ++k) {
+    unsigned i = subset ? (*subset)[k] : k;
     double p_rate = procs_[i]->rate();
-    // If we are evaluating the effect of a single parameter
-    // check the list of associated nuisances and skip if
-    // this "single_sys" is not in the list
-    // However - we can't skip if the process has a pdf, as
-    // we haven't checked what the parameters are
-    if (single_sys != "" && !procs_[i]->pdf()) {
-      if (!ch::any_of(lookup[i], [&](Systematic const* sys) {
-        return sys->name() == single_sys;
-      })) continue;
-    }
-    for (auto sys_it : lookup[i]) {
+    for (unsigned j = 0; j < lookup[i].size(); ++j) {
+      Systematic const* sys_it = lookup[i][j];
       if (sys_it->type() == "rateParam") {
         continue;  // don't evaluate this for now
       }
-      double x = params_[sys_it->name()]->val();
+      double x = ParamValue(sys_it, pars[i][j]);
       if (sys_it->asymm()) {
         p_rate *= logKappaForX(x * sys_it->scale(), sys_it->value_d(),
                                sys_it->value_u());
@@ -313,34 +704,31 @@ double CombineHarvester::GetRateInternal(ProcSystMap const& lookup,
 }
 
 TH1F CombineHarvester::GetShapeInternal(ProcSystMap const& lookup,
-    std::string const& single_sys) {
+    ProcParamMap const& pars, std::vector<unsigned> const* subset) const {
+  PROFILE_FUNCTION();
+  // The TH1 copies below would be registered with gDirectory, if there is
+  // one, and then removed again. Unsetting it here, rather than disabling
+  // TH1::AddDirectory globally, keeps this safe to call from several threads
+  // when gDirectory is thread-local.
+  TDirectory::TContext no_dir(nullptr);
+  SyncParameterVars(subset);
   TH1F shape;
   bool shape_init = false;
 
-  for (unsigned i = 0; i < procs_.size(); ++i) {
-    // Might be able to skip if only interested in one nuisance
-    // However - we can't skip if the process has a pdf, as
-    // we haven't checked what the parameters are
-    if (single_sys != "" && !procs_[i]->pdf()) {
-      if (!ch::any_of(lookup[i], [&](Systematic const* sys) {
-        return sys->name() == single_sys;
-      })) continue;
-    }
+  unsigned n_procs = subset ? subset->size() : procs_.size();
+  for (unsigned k = 0; k < n_procs; ++k) {
+    unsigned i = subset ? (*subset)[k] : k;
+    PROFILE_COUNT("GetShapeInternal processes evaluated", 1);
 
     double p_rate = procs_[i]->rate();
     if (procs_[i]->shape() || procs_[i]->data()) {
       TH1F proc_shape = procs_[i]->ShapeAsTH1F();
-      for (auto sys_it : lookup[i]) {
+      for (unsigned j = 0; j < lookup[i].size(); ++j) {
+        Systematic const* sys_it = lookup[i][j];
         if (sys_it->type() == "rateParam") {
           continue;  // don't evaluate this for now
         }
-        auto param_it = params_.find(sys_it->name());
-        if (param_it == params_.end()) {
-          throw std::runtime_error(
-              FNERROR("Parameter " + sys_it->name() +
-                      " not found in CombineHarvester instance"));
-        }
-        double x = param_it->second->val();
+        double x = ParamValue(sys_it, pars[i][j]);
         if (sys_it->asymm()) {
           p_rate *= logKappaForX(x * sys_it->scale(), sys_it->value_d(),
                                  sys_it->value_u());
@@ -376,33 +764,13 @@ TH1F CombineHarvester::GetShapeInternal(ProcSystMap const& lookup,
       }
       shape.Add(&proc_shape);
     } else if (procs_[i]->pdf()) {
-      if (!procs_[i]->observable()) {
-        RooAbsData const* data_obj = FindMatchingData(procs_[i].get());
-        std::string var_name = "CMS_th1x";
-        if (data_obj) var_name = data_obj->get()->first()->GetName();
-        procs_[i]->set_observable((RooRealVar *)procs_[i]->pdf()->findServer(var_name.c_str()));
-      }
-      TH1::AddDirectory(false);
-      TH1F* tmp = (TH1F*)procs_[i]->observable()->createHistogram("");
-      for (int b = 1; b <= tmp->GetNbinsX(); ++b) {
-        procs_[i]->observable()->setVal(tmp->GetBinCenter(b));
-        tmp->SetBinContent(b, tmp->GetBinWidth(b) * procs_[i]->pdf()->getVal());
-      }
-      TH1F proc_shape = *tmp;
-      delete tmp;
-      RooAbsPdf const* aspdf = dynamic_cast<RooAbsPdf const*>(procs_[i]->pdf());
-      if ((aspdf && !aspdf->selfNormalized()) || (!aspdf)) {
-        // LOGLINE(log(), "Have a pdf that is not selfNormalized");
-        // std::cout << "Integral: " << proc_shape.Integral() << "\n";
-        if (proc_shape.Integral() > 0.) {
-          proc_shape.Scale(1. / proc_shape.Integral());
-        }
-      }
-      for (auto sys_it : lookup[i]) {
+      TH1F proc_shape = GetPdfShape(procs_[i]);
+      for (unsigned j = 0; j < lookup[i].size(); ++j) {
+        Systematic const* sys_it = lookup[i][j];
         if (sys_it->type() == "rateParam") {
           continue;  // don't evaluate this for now
         }
-        double x = params_[sys_it->name()]->val();
+        double x = ParamValue(sys_it, pars[i][j]);
         if (sys_it->asymm()) {
           p_rate *= logKappaForX(x * sys_it->scale(), sys_it->value_d(),
                                  sys_it->value_u());
@@ -422,7 +790,7 @@ TH1F CombineHarvester::GetShapeInternal(ProcSystMap const& lookup,
   return shape;
 }
 
-double CombineHarvester::GetObservedRate() {
+double CombineHarvester::GetObservedRate() const {
   double rate = 0.0;
   for (unsigned i = 0; i < obs_.size(); ++i) {
     rate += obs_[i]->rate();
@@ -430,7 +798,8 @@ double CombineHarvester::GetObservedRate() {
   return rate;
 }
 
-TH1F CombineHarvester::GetObservedShape() {
+TH1F CombineHarvester::GetObservedShape() const {
+  TDirectory::TContext no_dir(nullptr);
   TH1F shape;
   bool shape_init = false;
 
@@ -464,7 +833,7 @@ void CombineHarvester::ShapeDiff(double x,
     TH1 const* nom,
     TH1 const* low,
     TH1 const* high,
-    bool linear) {
+    bool linear) const {
   double fx = smoothStepFunc(x);
   for (int i = 1; i <= target->GetNbinsX(); ++i) {
     float h = high->GetBinContent(i);
@@ -489,7 +858,7 @@ void CombineHarvester::ShapeDiff(double x,
     TH1F * target,
     RooDataHist const* nom,
     RooDataHist const* low,
-    RooDataHist const* high) {
+    RooDataHist const* high) const {
   double fx = smoothStepFunc(x);
   for (int i = 1; i <= target->GetNbinsX(); ++i) {
     high->get(i-1);
@@ -0,0 +1,204 @@
+#include "CombineHarvester/CombineTools/interface/CombineHarvester.h"
+#include <iostream>
+#include <map>
+#include <set>
+#include <string>
+#include <vector>
+#include "boost/format.hpp"
+#include "TClass.h"
+#include "TH1.h"
+#include "RooAbsArg.h"
+#include "RooAbsData.h"
+#include "RooDataHist.h"
+#include "RooArgSet.h"
+#include "RooWorkspace.h"
+
+namespace ch {
+
+namespace {
+typedef std::map<std::string, std::map<std::string, CombineHarvester::MemoryUsage>>
+    MemoryMap;
+
+// Approximate size of the per-node bookkeeping in a std::map/std::set
+const std::size_t kTreeNodeOverhead = 4 * sizeof(void*);
+
+// Size of the std::shared_ptr control block allocated alongside an object
+const std::size_t kControlBlock = 2 * sizeof(void*) + 2 * sizeof(int);
+
+void Add(MemoryMap & mem, std::string const& cat, std::string const& type,
+         std::size_t bytes, std::size_t count = 1) {
+  CombineHarvester::MemoryUsage & usage = mem[cat][type];
+  usage.count += count;
+  usage.bytes += bytes;
+}
+
+// Heap memory used by a string, beyond what is already part of the object
+// holding it. Short strings are stored inline.
+std::size_t StringHeap(std::string const& str) {
+  return str.capacity() > 15 ? str.capacity() + 1 : 0;
+}
+
+std::size_t ObjectStrings(Object const& obj) {
+  return StringHeap(obj.bin()) + StringHeap(obj.process()) +
+         StringHeap(obj.analysis()) + StringHeap(obj.era()) +
+         StringHeap(obj.channel()) + StringHeap(obj.mass());
+}
+
+void AddAttributes(MemoryMap & mem, std::string const& cat, Object const& obj) {
+  auto const& attrs = obj.all_attributes();
+  if (attrs.empty()) return;
+  std::size_t bytes = 0;
+  for (auto const& it : attrs) {
+    bytes += kTreeNodeOverhead + sizeof(it) + StringHeap(it.first) +
+             StringHeap(it.second);
+  }
+  Add(mem, cat, "attributes", bytes, attrs.size());
+}
+
+// The TH1 object itself plus its bin content and Sumw2 arrays
+std::size_t TH1Bytes(TH1 const* h) {
+  std::size_t bytes = h->IsA() ? h->IsA()->Size() : sizeof(TH1);
+  std::size_t elem = sizeof(double);
+  if (h->InheritsFrom("TArrayF")) {
+    elem = sizeof(float);
+  } else if (h->InheritsFrom("TArrayI")) {
+    elem = sizeof(int);
+  } else if (h->InheritsFrom("TArrayS")) {
+    elem = sizeof(short);
+  } else if (h->InheritsFrom("TArrayC")) {
+    elem = sizeof(char);
+  }
+  bytes += std::size_t(h->GetNcells()) * elem;
+  bytes += std::size_t(h->GetSumw2N()) * sizeof(double);
+  return bytes;
+}
+
+void AddTH1(MemoryMap & mem, std::string const& cat, TH1 const* h,
+            std::set<void const*> & seen) {
+  if (!h || !seen.insert(h).second) return;
+  Add(mem, cat, "TH1", TH1Bytes(h));
+}
+
+// A RooDataHist keeps, per bin, the weight, the squared-weight sum, the
+// low/high errors and the bin volume
+std::size_t RooAbsDataBytes(RooAbsData const* data) {
+  std::size_t bytes = data->IsA() ? data->IsA()->Size() : sizeof(RooAbsData);
+  std::size_t n_vars = data->get() ? data->get()->getSize() : 0;
+  std::size_t per_entry = dynamic_cast<RooDataHist const*>(data)
+                              ? 5 * sizeof(double)
+                              : (n_vars + 1) * sizeof(double);
+  bytes += std::size_t(data->numEntries()) * per_entry;
+  return bytes;
+}
+}
+
+std::map<std::string, std::map<std::string, CombineHarvester::MemoryUsage>>
+CombineHarvester::MemoryReport() const {
+  MemoryMap mem;
+  std::set<void const*> seen;
+
+  for (auto const& ptr : obs_) {
+    if (!seen.insert(ptr.get()).second) continue;
+    Add(mem, "Observation", "objects", sizeof(Observation) + kControlBlock);
+    Add(mem, "Observation", "strings", ObjectStrings(*ptr), 0);
+    AddAttributes(mem, "Observation", *ptr);
+    AddTH1(mem, "Observation", ptr->shape(), seen);
+  }
+
+  for (auto const& ptr : procs_) {
+    if (!seen.insert(ptr.get()).second) continue;
+    Add(mem, "Process", "objects", sizeof(Process) + kControlBlock);
+    Add(mem, "Process", "strings", ObjectStrings(*ptr), 0);
+    AddAttributes(mem, "Process", *ptr);
+    AddTH1(mem, "Process", ptr->shape(), seen);
+  }
+
+  for (auto const& ptr : systs_) {
+    if (!seen.insert(ptr.get()).second) continue;
+    Add(mem, "Systematic", "objects", sizeof(Systematic) + kControlBlock);
+    Add(mem, "Systematic", "strings",
+        ObjectStrings(*ptr) + StringHeap(ptr->name()) + StringHeap(ptr->type()),
+        0);
+    AddAttributes(mem, "Systematic", *ptr);
+    AddTH1(mem, "Systematic", ptr->shape_u(), seen);
+    AddTH1(mem, "Systematic", ptr->shape_d(), seen);
+  }
+
+  for (auto const& it : params_) {
+    Add(mem, "Parameter", "map entries",
+        kTreeNodeOverhead + sizeof(it) + StringHeap(it.first));
+    if (!seen.insert(it.second.get()).second) continue;
+    Parameter & par = *(it.second);
+    Add(mem, "Parameter", "objects", sizeof(Parameter) + kControlBlock);
+    Add(mem, "Parameter", "strings", StringHeap(par.name()), 0);
+    if (par.vars().capacity()) {
+      Add(mem, "Parameter", "RooRealVar links",
+          par.vars().capacity() * sizeof(RooRealVar*), par.vars().size());
+    }
+    for (auto const& grp : par.groups()) {
+      Add(mem, "Parameter", "groups",
+          kTreeNodeOverhead + sizeof(grp) + StringHeap(grp));
+    }
+  }
+
+  for (auto const& it : wspaces_) {
+    RooWorkspace const* ws = it.second.get();
+    if (!ws || !seen.insert(ws).second) continue;
+    Add(mem, "Workspace", "RooWorkspace",
+        ws->IsA() ? ws->IsA()->Size() : sizeof(RooWorkspace));
+    RooFIter arg_it = ws->components().fwdIterator();
+    RooAbsArg *arg = nullptr;
+    while ((arg = arg_it.next())) {
+      if (!seen.insert(arg).second) continue;
+      TClass * cl = arg->IsA();
+      Add(mem, "Workspace", cl ? cl->GetName() : "RooAbsArg",
+          cl ? cl->Size() : sizeof(RooAbsArg));
+    }
+    for (RooAbsData const* data : ws->allData()) {
+      if (!data || !seen.insert(data).second) continue;
+      Add(mem, "Workspace", data->IsA() ? data->IsA()->GetName() : "RooAbsData",
+          RooAbsDataBytes(data));
+    }
+  }
+
+  if (pdf_shapes_ && seen.insert(pdf_shapes_.get()).second) {
+    std::lock_guard<std::mutex> lock(pdf_shapes_->mutex);
+    for (auto const& it : pdf_shapes_->shapes) {
+      Add(mem, "CombineHarvester", "pdf shape cache",
+          kTreeNodeOverhead + sizeof(it) - sizeof(TH1F) +
+              TH1Bytes(&it.second.shape) +
+              it.second.params.capacity() * sizeof(RooRealVar const*) +
+              it.second.values.capacity() * sizeof(double));
+    }
+  }
+
+  // The vectors of pointers held by this instance
+  Add(mem, "CombineHarvester", "entry pointers",
+      (obs_.capacity() + procs_.capacity() + systs_.capacity()) *
+          sizeof(std::shared_ptr<Object>),
+      obs_.size() + procs_.size() + systs_.size());
+  return mem;
+}
+
+CombineHarvester& CombineHarvester::PrintMemoryReport() {
+  auto mem = MemoryReport();
+  std::size_t total = 0;
+  std::cout << boost::format("%-20s %-40s %12s %14s\n") % "Category" % "Type" %
+                   "Count" % "Size [MB]";
+  for (auto const& cat : mem) {
+    std::size_t cat_total = 0;
+    for (auto const& type : cat.second) {
+      std::cout << boost::format("%-20s %-40s %12i %14.3f\n") % cat.first %
+                       type.first % type.second.count %
+                       (double(type.second.bytes) / (1024. * 1024.));
+      cat_total += type.second.bytes;
+    }
+    std::cout << boost::format("%-20s %-40s %12s %14.3f\n") % cat.first %
+                     "[total]" % "" % (double(cat_total) / (1024. * 1024.));
+    total += cat_total;
+  }
+  std::cout << boost::format("%-20s %-40s %12s %14.3f\n") % "[total]" % "" %
+                   "" % (double(total) / (1024. * 1024.));
+  return *this;
+}
+}
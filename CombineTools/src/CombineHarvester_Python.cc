@@ -9,6 +9,13 @@
 #include "CombineHarvester/CombineTools/interface/Utilities.h"
 #include "CombineHarvester/CombineTools/interface/ValidationTools.h"
 #include "CombineHarvester/CombineTools/interface/ParseCombineWorkspace.h"
+#include <cstring>
+#include <functional>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <unordered_set>
+#include <vector>
 #include "boost/python.hpp"
 #include "TFile.h"
 #include "TH1F.h"
@@ -25,6 +32,7 @@ using ch::CardWriter;
 using ch::BinByBinFactory;
 using ch::AutoRebin;
 using ch::Parameter;
+using ch::Profiler;
 
 void FilterAllPy(ch::CombineHarvester & cb, boost::python::object func) {
       auto lambda = [func](ch::Object *obj) -> bool {
@@ -114,6 +122,460 @@ void CloneProcsAndSystsPy(ch::CombineHarvester& src, ch::CombineHarvester& dest,
   ch::CloneProcsAndSysts(src, dest, lambda);
 }
 
+boost::python::dict MemoryReportPy(ch::CombineHarvester const& cb) {
+  boost::python::dict res;
+  for (auto const& cat : cb.MemoryReport()) {
+    boost::python::dict types;
+    for (auto const& type : cat.second) {
+      types[type.first] =
+          boost::python::make_tuple(type.second.count, type.second.bytes);
+    }
+    res[cat.first] = types;
+  }
+  return res;
+}
+
+void PrintProfilerPy(ch::Profiler const& prof) {
+  prof.Print(std::cout);
+}
+
+// Releases the GIL for its lifetime, so that other python threads can run
+// during a long C++ call. Nothing in that scope may touch a python object or
+// call back into python, so this must not be used for e.g. FilterAllPy.
+class ScopedGILRelease {
+ public:
+  ScopedGILRelease() : state_(PyEval_SaveThread()) {}
+  ~ScopedGILRelease() { PyEval_RestoreThread(state_); }
+
+ private:
+  PyThreadState *state_;
+};
+
+// Wraps a member function F of type Sig so that it is called without the GIL.
+// The arguments are converted from python before, and the return value to
+// python after, the GIL is released.
+template <typename Sig, Sig F>
+struct WithoutGIL;
+
+template <typename R, typename C, typename... Args, R (C::*F)(Args...)>
+struct WithoutGIL<R (C::*)(Args...), F> {
+  static R call(C & obj, Args... args) {
+    ScopedGILRelease release;
+    return (obj.*F)(args...);
+  }
+};
+
+// A minimal python type that exposes a read-only, one-dimensional block of
+// memory through the buffer protocol, so that numpy.asarray or memoryview can
+// wrap it without a copy. The memory is kept valid by a C++ object that exists
+// only to back this array (holder).
+struct ShapeArrayObject {
+  PyObject_HEAD
+  std::shared_ptr<void> *holder;
+  void *data;
+  Py_ssize_t size;
+  Py_ssize_t itemsize;
+  char const* format;
+};
+
+static PyTypeObject ShapeArrayType = {
+    PyVarObject_HEAD_INIT(NULL, 0)
+    "libCombineHarvesterCombineTools.ShapeArray",
+    sizeof(ShapeArrayObject)};
+
+static PyBufferProcs ShapeArrayBufferProcs;
+static PySequenceMethods ShapeArraySequenceMethods;
+
+int ShapeArrayGetBuffer(PyObject *obj, Py_buffer *view, int flags) {
+  ShapeArrayObject *self = reinterpret_cast<ShapeArrayObject *>(obj);
+  if ((flags & PyBUF_WRITABLE) == PyBUF_WRITABLE) {
+    PyErr_SetString(PyExc_BufferError, "ShapeArray is read-only");
+    view->obj = NULL;
+    return -1;
+  }
+  view->obj = obj;
+  Py_INCREF(obj);
+  view->buf = self->data;
+  view->len = self->size * self->itemsize;
+  view->readonly = 1;
+  view->itemsize = self->itemsize;
+  view->format = (flags & PyBUF_FORMAT) == PyBUF_FORMAT
+                     ? const_cast<char *>(self->format)
+                     : NULL;
+  view->ndim = 1;
+  view->shape = (flags & PyBUF_ND) == PyBUF_ND ? &(self->size) : NULL;
+  view->strides =
+      (flags & PyBUF_STRIDES) == PyBUF_STRIDES ? &(self->itemsize) : NULL;
+  view->suboffsets = NULL;
+  view->internal = NULL;
+  return 0;
+}
+
+Py_ssize_t ShapeArrayLength(PyObject *obj) {
+  return reinterpret_cast<ShapeArrayObject *>(obj)->size;
+}
+
+void ShapeArrayDealloc(PyObject *obj) {
+  ShapeArrayObject *self = reinterpret_cast<ShapeArrayObject *>(obj);
+  delete self->holder;
+  Py_TYPE(obj)->tp_free(obj);
+}
+
+void InitShapeArrayType() {
+  ShapeArrayBufferProcs.bf_getbuffer = ShapeArrayGetBuffer;
+  ShapeArraySequenceMethods.sq_length = ShapeArrayLength;
+  ShapeArrayType.tp_dealloc = ShapeArrayDealloc;
+  ShapeArrayType.tp_as_buffer = &ShapeArrayBufferProcs;
+  ShapeArrayType.tp_as_sequence = &ShapeArraySequenceMethods;
+  ShapeArrayType.tp_flags = Py_TPFLAGS_DEFAULT;
+#ifdef Py_TPFLAGS_HAVE_NEWBUFFER
+  ShapeArrayType.tp_flags |= Py_TPFLAGS_HAVE_NEWBUFFER;
+#endif
+  ShapeArrayType.tp_doc =
+      "Read-only view of histogram bin values, e.g. for numpy.asarray()";
+  if (PyType_Ready(&ShapeArrayType) < 0) py::throw_error_already_set();
+}
+
+py::object NewShapeArray(void *data, Py_ssize_t size, Py_ssize_t itemsize,
+                         char const *format,
+                         std::shared_ptr<void> const &holder) {
+  ShapeArrayObject *self = PyObject_New(ShapeArrayObject, &ShapeArrayType);
+  if (!self) py::throw_error_already_set();
+  self->holder = holder ? new std::shared_ptr<void>(holder) : nullptr;
+  self->data = data;
+  self->size = size;
+  self->itemsize = itemsize;
+  self->format = format;
+  return py::object(py::handle<>(reinterpret_cast<PyObject *>(self)));
+}
+
+// The bin contents of a TH1F or TH1D, excluding the underflow and overflow
+// bins, viewed in place
+py::object ContentArray(TH1 const *h, std::shared_ptr<void> const &holder) {
+  if (!h) return py::object();
+  if (h->GetDimension() != 1) {
+    throw std::runtime_error("Bin arrays are only available for 1D histograms");
+  }
+  Py_ssize_t n = h->GetNbinsX();
+  if (TArrayF const *arr = dynamic_cast<TArrayF const *>(h)) {
+    return NewShapeArray(const_cast<float *>(arr->GetArray()) + 1, n,
+                         sizeof(float), "f", holder);
+  }
+  if (TArrayD const *arr = dynamic_cast<TArrayD const *>(h)) {
+    return NewShapeArray(const_cast<double *>(arr->GetArray()) + 1, n,
+                         sizeof(double), "d", holder);
+  }
+  throw std::runtime_error("Histogram is not a TH1F or a TH1D");
+}
+
+// The bin errors are not stored directly (only their squares, or nothing at
+// all for Poisson errors), so these are computed once into a new array
+py::object ErrorArray(TH1 const *h) {
+  if (!h) return py::object();
+  if (h->GetDimension() != 1) {
+    throw std::runtime_error("Bin arrays are only available for 1D histograms");
+  }
+  auto errs = std::make_shared<std::vector<double>>(h->GetNbinsX());
+  for (unsigned i = 0; i < errs->size(); ++i) {
+    (*errs)[i] = h->GetBinError(i + 1);
+  }
+  return NewShapeArray(errs->data(), errs->size(), sizeof(double), "d", errs);
+}
+
+// Take ownership of an evaluated histogram and return views of its contents
+// and errors
+py::tuple ShapeArrays(TH1F const& h) {
+  auto owned = std::make_shared<TH1F>(h);
+  return py::make_tuple(ContentArray(owned.get(), owned),
+                        ErrorArray(owned.get()));
+}
+
+// The shape of an Observation, Process or Systematic can be replaced or
+// deleted from C++ at any time, and the python wrapper of the object does not
+// necessarily own it, so the bin contents are copied into a new array
+template <typename V>
+py::object CopiedValues(V const *first, Py_ssize_t n, char const *format) {
+  auto vals = std::make_shared<std::vector<V>>(first, first + n);
+  return NewShapeArray(vals->data(), vals->size(), sizeof(V), format, vals);
+}
+
+py::object CopiedContentArray(TH1 const *h) {
+  if (!h) return py::object();
+  if (h->GetDimension() != 1) {
+    throw std::runtime_error("Bin arrays are only available for 1D histograms");
+  }
+  Py_ssize_t n = h->GetNbinsX();
+  if (TArrayF const *arr = dynamic_cast<TArrayF const *>(h)) {
+    return CopiedValues(arr->GetArray() + 1, n, "f");
+  }
+  if (TArrayD const *arr = dynamic_cast<TArrayD const *>(h)) {
+    return CopiedValues(arr->GetArray() + 1, n, "d");
+  }
+  throw std::runtime_error("Histogram is not a TH1F or a TH1D");
+}
+
+py::object ObsShapeArrayPy(Observation const& obs) {
+  return CopiedContentArray(obs.shape());
+}
+
+py::object ObsShapeErrorArrayPy(Observation const& obs) {
+  return ErrorArray(obs.shape());
+}
+
+py::object ProcShapeArrayPy(Process const& proc) {
+  return CopiedContentArray(proc.shape());
+}
+
+py::object ProcShapeErrorArrayPy(Process const& proc) {
+  return ErrorArray(proc.shape());
+}
+
+py::object SystShapeUArrayPy(Systematic const& syst) {
+  return CopiedContentArray(syst.shape_u());
+}
+
+py::object SystShapeDArrayPy(Systematic const& syst) {
+  return CopiedContentArray(syst.shape_d());
+}
+
+py::tuple GetShapeArrayPy(CombineHarvester & cb) {
+  return ShapeArrays(cb.GetShape());
+}
+
+py::tuple GetObservedShapeArrayPy(CombineHarvester & cb) {
+  return ShapeArrays(cb.GetObservedShape());
+}
+
+py::tuple Overload1_GetShapeWithUncertaintyArrayPy(CombineHarvester & cb) {
+  return ShapeArrays(cb.GetShapeWithUncertainty());
+}
+
+py::tuple Overload2_GetShapeWithUncertaintyArrayPy(CombineHarvester & cb,
+                                                   RooFitResult const& fit,
+                                                   unsigned n_samples) {
+  TH1F res;
+  {
+    ScopedGILRelease release;
+    res = cb.GetShapeWithUncertainty(fit, n_samples);
+  }
+  return ShapeArrays(res);
+}
+
+// Column-wise access to the properties of all the Observation, Process or
+// Systematic entries, in the order they are stored. Strings are returned as a
+// list and numbers as a ShapeArray, in both cases filled in a single C++ pass
+// instead of one python call per object.
+template <typename V, typename T, typename F>
+py::object NumberColumn(std::vector<T *> const& objs, char const *format,
+                        F func) {
+  auto vals = std::make_shared<std::vector<V>>();
+  vals->reserve(objs.size());
+  for (T *obj : objs) vals->push_back(func(*obj));
+  return NewShapeArray(vals->data(), vals->size(), sizeof(V), format, vals);
+}
+
+template <typename T, typename F>
+py::object StringColumn(std::vector<T *> const& objs, F func) {
+  py::list res;
+  for (T *obj : objs) res.append(func(*obj));
+  return res;
+}
+
+template <typename T>
+py::object ObjectColumn(std::vector<T *> const& objs,
+                        std::string const& field) {
+  if (field == "bin") return StringColumn(objs, std::mem_fn(&T::bin));
+  if (field == "process") return StringColumn(objs, std::mem_fn(&T::process));
+  if (field == "analysis") return StringColumn(objs, std::mem_fn(&T::analysis));
+  if (field == "era") return StringColumn(objs, std::mem_fn(&T::era));
+  if (field == "channel") return StringColumn(objs, std::mem_fn(&T::channel));
+  if (field == "mass") return StringColumn(objs, std::mem_fn(&T::mass));
+  if (field == "bin_id") {
+    return NumberColumn<int>(objs, "i", std::mem_fn(&T::bin_id));
+  }
+  throw std::runtime_error("Unknown column: " + field);
+}
+
+py::object ObsColumnPy(CombineHarvester & cb, std::string const& field) {
+  std::vector<Observation *> objs;
+  cb.ForEachObs([&](Observation *obs) { objs.push_back(obs); });
+  if (field == "rate") {
+    return NumberColumn<double>(objs, "d", std::mem_fn(&Observation::rate));
+  }
+  return ObjectColumn(objs, field);
+}
+
+py::object ProcColumnPy(CombineHarvester & cb, std::string const& field) {
+  std::vector<Process *> objs;
+  cb.ForEachProc([&](Process *proc) { objs.push_back(proc); });
+  if (field == "rate") {
+    return NumberColumn<double>(objs, "d", std::mem_fn(&Process::rate));
+  }
+  if (field == "signal") {
+    return NumberColumn<unsigned char>(objs, "?",
+                                       std::mem_fn(&Process::signal));
+  }
+  return ObjectColumn(objs, field);
+}
+
+py::object SystColumnPy(CombineHarvester & cb, std::string const& field) {
+  std::vector<Systematic *> objs;
+  cb.ForEachSyst([&](Systematic *syst) { objs.push_back(syst); });
+  if (field == "name") {
+    return StringColumn(objs, std::mem_fn(&Systematic::name));
+  }
+  if (field == "type") {
+    return StringColumn(objs, std::mem_fn(&Systematic::type));
+  }
+  if (field == "value_u") {
+    return NumberColumn<double>(objs, "d", std::mem_fn(&Systematic::value_u));
+  }
+  if (field == "value_d") {
+    return NumberColumn<double>(objs, "d", std::mem_fn(&Systematic::value_d));
+  }
+  if (field == "scale") {
+    return NumberColumn<double>(objs, "d", std::mem_fn(&Systematic::scale));
+  }
+  if (field == "asymm") {
+    return NumberColumn<unsigned char>(objs, "?",
+                                       std::mem_fn(&Systematic::asymm));
+  }
+  if (field == "signal") {
+    return NumberColumn<unsigned char>(objs, "?",
+                                       std::mem_fn(&Systematic::signal));
+  }
+  return ObjectColumn(objs, field);
+}
+
+// True if a buffer format describes one-byte booleans or integers, with an
+// optional byte order character. A missing format means unsigned bytes.
+bool IsByteFormat(char const *format) {
+  if (!format) return true;
+  if (format[0] != '\0' && std::strchr("@=<>!|", format[0])) ++format;
+  return std::strcmp(format, "?") == 0 || std::strcmp(format, "b") == 0 ||
+         std::strcmp(format, "B") == 0;
+}
+
+// Convert a sequence of booleans, one per object, into a vector. A contiguous
+// one-dimensional buffer of bools or bytes (e.g. a numpy bool array) is read
+// directly, anything else is read element by element using the truth value
+// of each element.
+std::vector<char> MaskFromPy(py::object mask, std::size_t n) {
+  std::vector<char> res;
+  Py_buffer view;
+  if (PyObject_GetBuffer(mask.ptr(), &view, PyBUF_ND | PyBUF_FORMAT) == 0) {
+    if (view.ndim == 1 && view.itemsize == 1 && IsByteFormat(view.format)) {
+      char const *buf = static_cast<char const *>(view.buf);
+      res.assign(buf, buf + view.len);
+    }
+    PyBuffer_Release(&view);
+  } else {
+    PyErr_Clear();
+  }
+  if (res.empty() && n > 0) {
+    Py_ssize_t len = py::len(mask);
+    res.resize(len);
+    for (Py_ssize_t i = 0; i < len; ++i) {
+      py::object item = mask[i];
+      int truth = PyObject_IsTrue(item.ptr());
+      if (truth < 0) py::throw_error_already_set();
+      res[i] = truth;
+    }
+  }
+  if (res.size() != n) {
+    throw std::runtime_error("Mask has " + std::to_string(res.size()) +
+                             " entries but there are " + std::to_string(n) +
+                             " objects");
+  }
+  return res;
+}
+
+// Keep only the objects for which the mask is true
+template <typename T>
+void FilterByMask(std::vector<T *> const& objs, py::object mask,
+                  std::function<void(std::function<bool(T *)>)> filter) {
+  std::vector<char> keep = MaskFromPy(mask, objs.size());
+  std::unordered_set<T const *> drop;
+  for (std::size_t i = 0; i < objs.size(); ++i) {
+    if (!keep[i]) drop.insert(objs[i]);
+  }
+  if (drop.empty()) return;
+  filter([&](T *obj) { return drop.count(obj) > 0; });
+}
+
+CombineHarvester& FilterObsMaskPy(CombineHarvester & cb, py::object mask) {
+  std::vector<Observation *> objs;
+  cb.ForEachObs([&](Observation *obs) { objs.push_back(obs); });
+  FilterByMask<Observation>(objs, mask,
+                            [&](std::function<bool(Observation *)> func) {
+                              cb.FilterObs(func);
+                            });
+  return cb;
+}
+
+CombineHarvester& FilterProcsMaskPy(CombineHarvester & cb, py::object mask) {
+  std::vector<Process *> objs;
+  cb.ForEachProc([&](Process *proc) { objs.push_back(proc); });
+  FilterByMask<Process>(objs, mask, [&](std::function<bool(Process *)> func) {
+    cb.FilterProcs(func);
+  });
+  return cb;
+}
+
+CombineHarvester& FilterSystsMaskPy(CombineHarvester & cb, py::object mask) {
+  std::vector<Systematic *> objs;
+  cb.ForEachSyst([&](Systematic *syst) { objs.push_back(syst); });
+  FilterByMask<Systematic>(objs, mask,
+                           [&](std::function<bool(Systematic *)> func) {
+                             cb.FilterSysts(func);
+                           });
+  return cb;
+}
+
+void AddProcessColumnsPy(CombineHarvester & cb,
+                         std::vector<std::string> const& process,
+                         std::vector<std::string> const& bin,
+                         std::vector<int> const& bin_id,
+                         std::vector<std::string> const& mass,
+                         std::vector<std::string> const& analysis,
+                         std::vector<std::string> const& era,
+                         std::vector<std::string> const& channel,
+                         std::vector<bool> const& signal) {
+  CombineHarvester::ProcessColumns cols;
+  cols.process = process;
+  cols.bin = bin;
+  cols.bin_id = bin_id;
+  cols.mass = mass;
+  cols.analysis = analysis;
+  cols.era = era;
+  cols.channel = channel;
+  cols.signal = signal;
+  ScopedGILRelease release;
+  cb.AddProcessColumns(cols);
+}
+
+void AddSystColumnsPy(CombineHarvester & cb, CombineHarvester & target,
+                      std::vector<unsigned> const& proc,
+                      std::vector<std::string> const& name,
+                      std::vector<std::string> const& type,
+                      std::vector<double> const& value_u,
+                      std::vector<double> const& value_d,
+                      std::vector<bool> const& asymm,
+                      std::vector<std::string> const& formula,
+                      std::vector<std::string> const& args) {
+  CombineHarvester::SystColumns cols;
+  cols.proc = proc;
+  cols.name = name;
+  cols.type = type;
+  cols.value_u = value_u;
+  cols.value_d = value_d;
+  cols.asymm = asymm;
+  cols.formula = formula;
+  cols.args = args;
+  ScopedGILRelease release;
+  cb.AddSystColumns(target, cols);
+}
+
 // To resolve overloaded methods we first define some pointers
 int (CombineHarvester::*Overload1_ParseDatacard)(
     std::string const&, std::string const&, std::string const&,
@@ -133,6 +595,7 @@ void Overload3_WriteDatacard(ch::CombineHarvester& cb, std::string const& name,
   TFile *file_ = nullptr;
   if (!file.is_none())
     file_ = (TFile*)(TPython::ObjectProxy_AsVoidPtr(file.ptr()));
+  ScopedGILRelease release;
   cb.WriteDatacard(name,*file_);
 }
 
@@ -237,6 +700,8 @@ BOOST_PYTHON_MODULE(libCombineHarvesterCombineTools)
   convert_py_tup_to_cpp_pair<int, std::string>();
   convert_py_seq_to_cpp_vector<std::pair<int, std::string>>();
   convert_py_seq_to_cpp_vector<int>();
+  convert_py_seq_to_cpp_vector<unsigned>();
+  convert_py_seq_to_cpp_vector<bool>();
   convert_py_seq_to_cpp_vector<double>();
   convert_py_root_to_cpp_root<TFile>();
   convert_py_root_to_cpp_root<TH1F>();
@@ -246,6 +711,10 @@ BOOST_PYTHON_MODULE(libCombineHarvesterCombineTools)
   convert_py_root_to_cpp_root<RooFitResult>();
   convert_py_root_to_cpp_root<RooWorkspace>();
 
+  InitShapeArrayType();
+  py::scope().attr("ShapeArray") = py::object(py::handle<>(
+      py::borrowed(reinterpret_cast<PyObject *>(&ShapeArrayType))));
+
   py::class_<CombineHarvester>("CombineHarvester")
       // Constructors, destructors and copying
       .def("cp", &CombineHarvester::cp)
@@ -265,11 +734,23 @@ BOOST_PYTHON_MODULE(libCombineHarvesterCombineTools)
            py::return_internal_reference<>())
       .def("SetVerbosity", &CombineHarvester::SetVerbosity)
       .def("Verbosity", &CombineHarvester::Verbosity)
+      // Memory accounting
+      .def("MemoryReport", MemoryReportPy)
+      .def("PrintMemoryReport", &CombineHarvester::PrintMemoryReport,
+           py::return_internal_reference<>())
       // Datacards
-      .def("__ParseDatacard__", Overload1_ParseDatacard)
-      .def("QuickParseDatacard", Overload2_ParseDatacard)
-      .def("WriteDatacard", Overload1_WriteDatacard)
-      .def("WriteDatacard", Overload2_WriteDatacard)
+      .def("__ParseDatacard__",
+           &WithoutGIL<decltype(Overload1_ParseDatacard),
+                       &CombineHarvester::ParseDatacard>::call)
+      .def("QuickParseDatacard",
+           &WithoutGIL<decltype(Overload2_ParseDatacard),
+                       &CombineHarvester::ParseDatacard>::call)
+      .def("WriteDatacard",
+           &WithoutGIL<decltype(Overload1_WriteDatacard),
+                       &CombineHarvester::WriteDatacard>::call)
+      .def("WriteDatacard",
+           &WithoutGIL<decltype(Overload2_WriteDatacard),
+                       &CombineHarvester::WriteDatacard>::call)
       .def("WriteDatacard", Overload3_WriteDatacard)
       // Filters
       .def("bin", &CombineHarvester::bin,
@@ -310,6 +791,12 @@ BOOST_PYTHON_MODULE(libCombineHarvesterCombineTools)
           py::return_internal_reference<>())
       .def("FilterSysts", FilterSystsPy,
           py::return_internal_reference<>())
+      .def("FilterObsMask", FilterObsMaskPy,
+          py::return_internal_reference<>())
+      .def("FilterProcsMask", FilterProcsMaskPy,
+          py::return_internal_reference<>())
+      .def("FilterSystsMask", FilterSystsMaskPy,
+          py::return_internal_reference<>())
       // Set producers
       .def("bin_set", &CombineHarvester::bin_set)
       .def("bin_id_set", &CombineHarvester::bin_id_set)
@@ -320,6 +807,10 @@ BOOST_PYTHON_MODULE(libCombineHarvesterCombineTools)
       .def("mass_set", &CombineHarvester::mass_set)
       .def("syst_name_set", &CombineHarvester::syst_name_set)
       .def("syst_type_set", &CombineHarvester::syst_type_set)
+      // Column accessors
+      .def("ObsColumn", ObsColumnPy)
+      .def("ProcColumn", ProcColumnPy)
+      .def("SystColumn", SystColumnPy)
       // Modification
       .def("GetParameter", Overload1_GetParameter,
         py::return_value_policy<py::reference_existing_object>())
@@ -343,20 +834,38 @@ BOOST_PYTHON_MODULE(libCombineHarvesterCombineTools)
       .def("GetRate", &CombineHarvester::GetRate)
       .def("GetObservedRate", &CombineHarvester::GetObservedRate)
       .def("GetUncertainty", Overload1_GetUncertainty)
-      .def("GetUncertainty", Overload2_GetUncertainty)
+      .def("GetUncertainty",
+           &WithoutGIL<decltype(Overload2_GetUncertainty),
+                       &CombineHarvester::GetUncertainty>::call)
       .def("GetShape", &CombineHarvester::GetShape)
       .def("GetShapeWithUncertainty", Overload1_GetShapeWithUncertainty)
-      .def("GetShapeWithUncertainty", Overload2_GetShapeWithUncertainty)
+      .def("GetShapeWithUncertainty",
+           &WithoutGIL<decltype(Overload2_GetShapeWithUncertainty),
+                       &CombineHarvester::GetShapeWithUncertainty>::call)
       .def("GetRateCovariance", &CombineHarvester::GetRateCovariance)
       .def("GetRateCorrelation", &CombineHarvester::GetRateCorrelation)
       .def("GetObservedShape", &CombineHarvester::GetObservedShape)
+      .def("GetShapeArray", GetShapeArrayPy)
+      .def("GetShapeWithUncertaintyArray",
+           Overload1_GetShapeWithUncertaintyArrayPy)
+      .def("GetShapeWithUncertaintyArray",
+           Overload2_GetShapeWithUncertaintyArrayPy)
+      .def("GetObservedShapeArray", GetObservedShapeArrayPy)
       // Creation
       .def("__AddObservations__", &CombineHarvester::AddObservations)
       .def("__AddProcesses__", &CombineHarvester::AddProcesses)
       .def("AddSystFromProc", &CombineHarvester::AddSystFromProc)
-      .def("ExtractShapes", &CombineHarvester::ExtractShapes)
-      .def("AddBinByBin", Overload_AddBinByBin)
-      .def("MergeBinErrors",  &CombineHarvester::MergeBinErrors)
+      .def("__AddProcessColumns__", AddProcessColumnsPy)
+      .def("__AddSystColumns__", AddSystColumnsPy)
+      .def("ExtractShapes",
+           &WithoutGIL<decltype(&CombineHarvester::ExtractShapes),
+                       &CombineHarvester::ExtractShapes>::call)
+      .def("AddBinByBin",
+           &WithoutGIL<decltype(Overload_AddBinByBin),
+                       &CombineHarvester::AddBinByBin>::call)
+      .def("MergeBinErrors",
+           &WithoutGIL<decltype(&CombineHarvester::MergeBinErrors),
+                       &CombineHarvester::MergeBinErrors>::call)
       .def("InsertObservation", &CombineHarvester::InsertObservation)
       .def("InsertProcess", &CombineHarvester::InsertProcess)
       .def("InsertSystematic", &CombineHarvester::InsertSystematic)
@@ -396,6 +905,8 @@ BOOST_PYTHON_MODULE(libCombineHarvesterCombineTools)
       .def("rate", &Observation::rate)
       .def("set_shape", Overload_Obs_set_shape)
       .def("ShapeAsTH1F", &Observation::ShapeAsTH1F)
+      .def("shape_array", ObsShapeArrayPy)
+      .def("shape_error_array", ObsShapeErrorArrayPy)
       .def("ClonedShape",&Observation::ClonedShape)
       .def(py::self_ns::str(py::self_ns::self))
     ;
@@ -408,6 +919,8 @@ BOOST_PYTHON_MODULE(libCombineHarvesterCombineTools)
       .def("set_signal", &Process::set_signal)
       .def("signal", &Process::signal)
       .def("ShapeAsTH1F", &Process::ShapeAsTH1F)
+      .def("shape_array", ProcShapeArrayPy)
+      .def("shape_error_array", ProcShapeErrorArrayPy)
       .def("ClonedShape", &Process::ClonedShape)
       .def(py::self_ns::str(py::self_ns::self))
     ;
@@ -432,6 +945,8 @@ BOOST_PYTHON_MODULE(libCombineHarvesterCombineTools)
       .def("set_shapes", Overload_Syst_set_shapes)
       .def("ShapeUAsTH1F", &Systematic::ShapeUAsTH1F)
       .def("ShapeDAsTH1F", &Systematic::ShapeDAsTH1F)
+      .def("shape_u_array", SystShapeUArrayPy)
+      .def("shape_d_array", SystShapeDArrayPy)
       .def("SwapUpAndDown", &Systematic::SwapUpAndDown)
       .def(py::self_ns::str(py::self_ns::self))
     ;
@@ -472,9 +987,15 @@ BOOST_PYTHON_MODULE(libCombineHarvesterCombineTools)
     py::def("SplitSyst", ch::SplitSyst);
 
     py::class_<BinByBinFactory>("BinByBinFactory")
-      .def("MergeBinErrors", &BinByBinFactory::MergeBinErrors)
-      .def("AddBinByBin", &BinByBinFactory::AddBinByBin)
-      .def("MergeAndAdd", &BinByBinFactory::MergeAndAdd)
+      .def("MergeBinErrors",
+           &WithoutGIL<decltype(&BinByBinFactory::MergeBinErrors),
+                       &BinByBinFactory::MergeBinErrors>::call)
+      .def("AddBinByBin",
+           &WithoutGIL<decltype(&BinByBinFactory::AddBinByBin),
+                       &BinByBinFactory::AddBinByBin>::call)
+      .def("MergeAndAdd",
+           &WithoutGIL<decltype(&BinByBinFactory::MergeAndAdd),
+                       &BinByBinFactory::MergeAndAdd>::call)
       .def("SetVerbosity", &BinByBinFactory::SetVerbosity,
            py::return_internal_reference<>())
       .def("SetAddThreshold", &BinByBinFactory::SetAddThreshold,
@@ -517,5 +1038,19 @@ BOOST_PYTHON_MODULE(libCombineHarvesterCombineTools)
     py::def("CheckSizeOfShapeEffect", Overload1_CheckSizeOfShapeEffect);
     py::def("CheckSmallSignals", Overload1_CheckSmallSignals);
     py::def("ValidateCards", ch::ValidateCards);
+    py::def("ValidateCardsIncremental", ch::ValidateCardsIncremental);
+
+    py::class_<Profiler, boost::noncopyable>("Profiler", py::no_init)
+      .def("Enabled", &Profiler::Enabled)
+      .def("SetEnabled", &Profiler::SetEnabled)
+      .def("Tracing", &Profiler::Tracing)
+      .def("SetTracing", &Profiler::SetTracing)
+      .def("Reset", &Profiler::Reset)
+      .def("Print", PrintProfilerPy)
+      .def("WriteJSON", &Profiler::WriteJSON)
+      .def("WriteChromeTrace", &Profiler::WriteChromeTrace)
+    ;
+    py::def("GetProfiler", &Profiler::Instance,
+            py::return_value_policy<py::reference_existing_object>());
 
 }
@@ -0,0 +1,73 @@
+#include "CombineHarvester/CombineTools/interface/HistogramPool.h"
+#include <algorithm>
+#include <memory>
+#include <mutex>
+#include "CombineHarvester/CombineTools/interface/ContentHash.h"
+
+namespace ch {
+
+namespace {
+// Purge expired entries at most once per this many insertions
+const std::size_t kMinPurgeInterval = 1024;
+}
+
+bool SameContent(TH1 const* a, TH1 const* b) {
+  if (a->IsA() != b->IsA() || a->GetDimension() != b->GetDimension() ||
+      a->GetNcells() != b->GetNcells() ||
+      a->GetSumw2N() != b->GetSumw2N()) {
+    return false;
+  }
+  int n = a->GetNbinsX();
+  if (n != b->GetNbinsX()) return false;
+  for (int i = 1; i <= n + 1; ++i) {
+    if (a->GetBinLowEdge(i) != b->GetBinLowEdge(i)) return false;
+  }
+  for (int i = 0; i < a->GetNcells(); ++i) {
+    if (a->GetBinContent(i) != b->GetBinContent(i) ||
+        a->GetBinError(i) != b->GetBinError(i)) {
+      return false;
+    }
+  }
+  return true;
+}
+
+HistogramPool& HistogramPool::Instance() {
+  static HistogramPool instance;
+  return instance;
+}
+
+std::shared_ptr<TH1 const> HistogramPool::Share(std::unique_ptr<TH1> hist) {
+  if (!hist) return std::shared_ptr<TH1 const>();
+  hist->SetDirectory(0);
+  std::uint64_t hash = ContentHash().Add(hist.get()).Value();
+  std::lock_guard<std::mutex> lock(mutex_);
+  auto range = hists_.equal_range(hash);
+  for (auto it = range.first; it != range.second; ++it) {
+    std::shared_ptr<TH1 const> existing = it->second.lock();
+    if (existing && SameContent(existing.get(), hist.get())) return existing;
+  }
+  std::shared_ptr<TH1 const> res(hist.release());
+  hists_.emplace(hash, res);
+  if (++n_inserted_ >= std::max(kMinPurgeInterval, hists_.size() / 2)) {
+    Purge();
+  }
+  return res;
+}
+
+std::size_t HistogramPool::Size() {
+  std::lock_guard<std::mutex> lock(mutex_);
+  Purge();
+  return hists_.size();
+}
+
+void HistogramPool::Purge() {
+  for (auto it = hists_.begin(); it != hists_.end();) {
+    if (it->second.expired()) {
+      it = hists_.erase(it);
+    } else {
+      ++it;
+    }
+  }
+  n_inserted_ = 0;
+}
+}
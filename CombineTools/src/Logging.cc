@@ -1,7 +1,13 @@
 #include "CombineHarvester/CombineTools/interface/Logging.h"
 #include <string>
 #include <iostream>
+#include <fstream>
+#include <iomanip>
+#include <cstdlib>
+#include <algorithm>
 #include "boost/lexical_cast.hpp"
+#include "boost/format.hpp"
+#include "CombineHarvester/CombineTools/interface/json.hpp"
 
 namespace ch {
 
@@ -46,21 +52,188 @@ std::string FnError(std::string const& message, std::string const& file,
 }
 
 // Implementation of FnTimer ("Function Timer") class
-FnTimer::FnTimer(std::string name) : name_(name), calls_(0), elapsed_(0.) {}
+FnTimer::FnTimer(std::string name) : name_(name), calls_(0), elapsed_ns_(0) {}
 FnTimer::~FnTimer() {
+  double elapsed = double(elapsed_ns_) * 1E-9;
   printf(
       "[Timer] %-40s Calls: %-20u Total [s]: %-20.5g Per-call [s]: %-20.5g\n",
-      name_.c_str(), calls_, elapsed_, elapsed_ / double(calls_));
+      name_.c_str(), unsigned(calls_), elapsed, elapsed / double(calls_));
 }
 FnTimer::Token FnTimer::Inc() {
   ++calls_;
   return Token(this);
 }
-void FnTimer::StartTimer() { start_ = std::chrono::system_clock::now(); }
-void FnTimer::StopTimer() {
-  end_ = std::chrono::system_clock::now();
-  elapsed_ += std::chrono::duration<double>(end_ - start_).count();
+void FnTimer::AddElapsed(std::chrono::steady_clock::time_point start,
+                         std::chrono::steady_clock::time_point end) {
+  elapsed_ns_ +=
+      std::chrono::duration_cast<std::chrono::nanoseconds>(end - start)
+          .count();
+  Profiler & prof = Profiler::Instance();
+  if (prof.Enabled()) prof.AddTime(name_, start, end);
+}
+FnTimer::Token::Token(FnTimer* src)
+    : src_(src), start_(std::chrono::steady_clock::now()) {}
+FnTimer::Token::~Token() {
+  src_->AddElapsed(start_, std::chrono::steady_clock::now());
+}
+
+// Implementation of the Profiler class
+Profiler& Profiler::Instance() {
+  static Profiler instance;
+  return instance;
+}
+
+Profiler::Profiler()
+    : enabled_(false),
+      tracing_(false),
+      origin_(std::chrono::steady_clock::now()) {
+  if (char const* env = std::getenv("CH_PROFILE")) {
+    json_file_ = env;
+    if (!json_file_.empty()) SetEnabled(true);
+  }
+  if (char const* env = std::getenv("CH_PROFILE_TRACE")) {
+    trace_file_ = env;
+    if (!trace_file_.empty()) SetTracing(true);
+  }
+}
+
+Profiler::~Profiler() {
+  try {
+    if (!json_file_.empty()) WriteJSON(json_file_);
+    if (!trace_file_.empty()) WriteChromeTrace(trace_file_);
+  } catch (std::exception const& e) {
+    std::cerr << e.what() << "\n";
+  }
+}
+
+void Profiler::SetTracing(bool tracing) {
+  tracing_ = tracing;
+  if (tracing) enabled_ = true;
+}
+
+void Profiler::AddTime(std::string const& name,
+                       std::chrono::steady_clock::time_point start,
+                       std::chrono::steady_clock::time_point end) {
+  std::int64_t dur =
+      std::chrono::duration_cast<std::chrono::nanoseconds>(end - start)
+          .count();
+  std::lock_guard<std::mutex> lock(mutex_);
+  auto it = timers_.find(name);
+  if (it == timers_.end()) it = timers_.emplace(name, Stat()).first;
+  Stat & stat = it->second;
+  if (stat.calls == 0 || dur < stat.min_ns) stat.min_ns = dur;
+  if (stat.calls == 0 || dur > stat.max_ns) stat.max_ns = dur;
+  ++stat.calls;
+  stat.total_ns += dur;
+  if (Tracing()) {
+    auto tid = thread_ids_.emplace(std::this_thread::get_id(),
+                                   unsigned(thread_ids_.size())).first;
+    // The map key is used as the name so that the event does not depend on
+    // the lifetime of the string passed in
+    events_.push_back(
+        {&(it->first), tid->second,
+         std::chrono::duration_cast<std::chrono::nanoseconds>(start - origin_)
+             .count(),
+         dur});
+  }
+}
+
+void Profiler::AddCount(std::string const& name, std::int64_t n) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  counters_[name] += n;
+}
+
+void Profiler::Reset() {
+  std::lock_guard<std::mutex> lock(mutex_);
+  events_.clear();
+  timers_.clear();
+  counters_.clear();
+}
+
+std::map<std::string, Profiler::Stat> Profiler::Timers() const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return timers_;
+}
+
+std::map<std::string, std::int64_t> Profiler::Counters() const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return counters_;
+}
+
+void Profiler::Print(std::ostream& out) const {
+  auto timers = Timers();
+  auto counters = Counters();
+  std::vector<std::pair<std::string, Stat>> sorted(timers.begin(),
+                                                   timers.end());
+  std::sort(sorted.begin(), sorted.end(),
+            [](std::pair<std::string, Stat> const& a,
+               std::pair<std::string, Stat> const& b) {
+              return a.second.total_ns > b.second.total_ns;
+            });
+  for (auto const& it : sorted) {
+    Stat const& stat = it.second;
+    out << boost::format(
+               "[Profiler] %-50s Calls: %-10i Total [s]: %-12.5g Per-call "
+               "[s]: %-12.5g Min [s]: %-12.5g Max [s]: %-12.5g\n") %
+               it.first % stat.calls % (double(stat.total_ns) * 1E-9) %
+               (double(stat.total_ns) * 1E-9 / double(stat.calls)) %
+               (double(stat.min_ns) * 1E-9) % (double(stat.max_ns) * 1E-9);
+  }
+  for (auto const& it : counters) {
+    out << boost::format("[Profiler] %-50s Count: %i\n") % it.first %
+               it.second;
+  }
+}
+
+void Profiler::WriteJSON(std::string const& filename) const {
+  nlohmann::json js;
+  js["timers"] = nlohmann::json::object();
+  js["counters"] = nlohmann::json::object();
+  for (auto const& it : Timers()) {
+    js["timers"][it.first] = {{"calls", it.second.calls},
+                              {"total_ns", it.second.total_ns},
+                              {"min_ns", it.second.min_ns},
+                              {"max_ns", it.second.max_ns}};
+  }
+  for (auto const& it : Counters()) js["counters"][it.first] = it.second;
+  std::ofstream outfile(filename);
+  if (!outfile.good()) {
+    throw std::runtime_error(FNERROR("Unable to open file " + filename));
+  }
+  outfile << std::setw(4) << js << std::endl;
+}
+
+void Profiler::WriteChromeTrace(std::string const& filename) const {
+  nlohmann::json js;
+  js["traceEvents"] = nlohmann::json::array();
+  js["displayTimeUnit"] = "ns";
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    std::int64_t end_ns = 0;
+    for (auto const& ev : events_) {
+      end_ns = std::max(end_ns, ev.start_ns + ev.dur_ns);
+      // The trace event format expects times in microseconds
+      js["traceEvents"].push_back({{"name", *(ev.name)},
+                                   {"ph", "X"},
+                                   {"pid", 0},
+                                   {"tid", ev.thread},
+                                   {"ts", double(ev.start_ns) * 1E-3},
+                                   {"dur", double(ev.dur_ns) * 1E-3}});
+    }
+    // Counters are only known in total, so are placed at the end
+    for (auto const& it : counters_) {
+      js["traceEvents"].push_back({{"name", it.first},
+                                   {"ph", "C"},
+                                   {"pid", 0},
+                                   {"tid", 0},
+                                   {"ts", double(end_ns) * 1E-3},
+                                   {"args", {{"count", it.second}}}});
+    }
+  }
+  std::ofstream outfile(filename);
+  if (!outfile.good()) {
+    throw std::runtime_error(FNERROR("Unable to open file " + filename));
+  }
+  outfile << js << std::endl;
 }
-FnTimer::Token::Token(FnTimer* src) : src_(src) { src_->StartTimer(); }
-FnTimer::Token::~Token() { src_->StopTimer(); }
 }
@@ -0,0 +1,126 @@
+#include "CombineHarvester/CombineTools/interface/NamePattern.h"
+#include <string>
+#include <utility>
+#include <vector>
+#include "boost/lexical_cast.hpp"
+
+namespace ch {
+
+namespace {
+// Where one placeholder is a prefix of another (e.g. $BIN and $BINID) the
+// longer one must come first
+const std::vector<std::pair<std::string, NamePattern::Placeholder>> kTokens = {
+    {"$BINID", NamePattern::kBinId},
+    {"$BIN", NamePattern::kBin},
+    {"$PROCESS", NamePattern::kProcess},
+    {"$MASS", NamePattern::kMass},
+    {"$ERA", NamePattern::kEra},
+    {"$CHANNEL", NamePattern::kChannel},
+    {"$ANALYSIS", NamePattern::kAnalysis},
+    {"$TAG", NamePattern::kTag},
+    {"$SYSTEMATIC", NamePattern::kSystematic},
+    {"$#", NamePattern::kIndex}};
+}
+
+NamePattern::Values::Values() : attrs_(nullptr) { vals_.fill(nullptr); }
+
+NamePattern::Values& NamePattern::Values::Set(Placeholder p,
+                                              std::string const& val) {
+  owned_[p] = val;
+  vals_[p] = &(owned_[p]);
+  return *this;
+}
+
+NamePattern::Values& NamePattern::Values::Unset(Placeholder p) {
+  vals_[p] = nullptr;
+  return *this;
+}
+
+NamePattern::Values& NamePattern::Values::SetObject(Object const& obj) {
+  Set(kBinId, boost::lexical_cast<std::string>(obj.bin_id()));
+  vals_[kBin] = &(obj.bin());
+  vals_[kProcess] = &(obj.process());
+  vals_[kMass] = &(obj.mass());
+  vals_[kEra] = &(obj.era());
+  vals_[kChannel] = &(obj.channel());
+  vals_[kAnalysis] = &(obj.analysis());
+  attrs_ = &(obj.all_attributes());
+  return *this;
+}
+
+NamePattern::NamePattern(std::string const& pattern) : pattern_(pattern) {
+  std::string literal;
+  auto flush = [&]() {
+    if (literal.empty()) return;
+    segments_.push_back({Kind::kLiteral, kNumPlaceholders, literal, ""});
+    literal.clear();
+  };
+  std::size_t i = 0;
+  while (i < pattern.size()) {
+    bool matched = false;
+    if (pattern[i] == '$') {
+      for (auto const& tok : kTokens) {
+        if (pattern.compare(i, tok.first.size(), tok.first) == 0) {
+          flush();
+          segments_.push_back({Kind::kPlaceholder, tok.second, tok.first, ""});
+          i += tok.first.size();
+          matched = true;
+          break;
+        }
+      }
+      std::size_t close = std::string::npos;
+      if (!matched && pattern.compare(i, 6, "$ATTR(") == 0 &&
+          (close = pattern.find(')', i + 6)) != std::string::npos) {
+        flush();
+        segments_.push_back({Kind::kAttribute, kNumPlaceholders,
+                             pattern.substr(i, close + 1 - i),
+                             pattern.substr(i + 6, close - i - 6)});
+        i = close + 1;
+        matched = true;
+      }
+    }
+    if (!matched) literal += pattern[i++];
+  }
+  flush();
+}
+
+void NamePattern::Render(Values const& vals, std::string & out) const {
+  out.clear();
+  for (auto const& seg : segments_) {
+    if (seg.kind == Kind::kPlaceholder) {
+      std::string const* val = vals.Get(seg.placeholder);
+      out += val ? *val : seg.text;
+    } else if (seg.kind == Kind::kAttribute) {
+      auto const* attrs = vals.attributes();
+      if (attrs) {
+        auto it = attrs->find(seg.label);
+        out += it != attrs->end() ? it->second : seg.text;
+      } else {
+        out += seg.text;
+      }
+    } else {
+      out += seg.text;
+    }
+  }
+}
+
+std::string NamePattern::Render(Values const& vals) const {
+  std::string out;
+  Render(vals, out);
+  return out;
+}
+
+bool NamePattern::Contains(Placeholder p) const {
+  for (auto const& seg : segments_) {
+    if (seg.kind == Kind::kPlaceholder && seg.placeholder == p) return true;
+  }
+  return false;
+}
+
+bool NamePattern::IsLiteral() const {
+  for (auto const& seg : segments_) {
+    if (seg.kind != Kind::kLiteral) return false;
+  }
+  return true;
+}
+}
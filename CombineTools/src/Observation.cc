@@ -1,5 +1,6 @@
 #include "CombineHarvester/CombineTools/interface/Observation.h"
 #include <iostream>
+#include "TDirectory.h"
 #include "boost/format.hpp"
 #include "CombineHarvester/CombineTools/interface/Logging.h"
 
@@ -78,6 +79,8 @@ void Observation::set_shape(TH1 const& shape, bool set_rate) {
 
 std::unique_ptr<TH1> Observation::ClonedShape() const {
   if (!shape_) return std::unique_ptr<TH1>();
+  // Clone without registering the copy in gDirectory
+  TDirectory::TContext no_dir(nullptr);
   std::unique_ptr<TH1> res(static_cast<TH1 *>(shape_->Clone()));
   res->SetDirectory(0);
   return res;
@@ -95,6 +98,7 @@ TH1F Observation::ShapeAsTH1F() const {
     throw std::runtime_error(
         FNERROR("Observation object does not contain a shape"));
   }
+  TDirectory::TContext no_dir(nullptr);
   TH1F res;
   // Need to get the shape as a concrete type (TH1F or TH1D)
   // A nice way to do this is just to use TH1D::Copy into a fresh TH1F
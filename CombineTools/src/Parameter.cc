@@ -13,7 +13,8 @@ Parameter::Parameter()
       err_d_(-1.0),
       range_u_(std::numeric_limits<double>::max()),
       range_d_(std::numeric_limits<double>::lowest()),
-      frozen_(false) {
+      frozen_(false),
+      vars_dirty_(false) {
   }
 
 Parameter::~Parameter() { }
@@ -27,6 +28,7 @@ void swap(Parameter& first, Parameter& second) {
   swap(first.range_u_, second.range_u_);
   swap(first.range_d_, second.range_d_);
   swap(first.frozen_, second.frozen_);
+  swap(first.vars_dirty_, second.vars_dirty_);
   swap(first.vars_, second.vars_);
   swap(first.groups_, second.groups_);
 }
@@ -39,6 +41,7 @@ Parameter::Parameter(Parameter const& other)
       range_u_(other.range_u_),
       range_d_(other.range_d_),
       frozen_(other.frozen_),
+      vars_dirty_(other.vars_dirty_),
       vars_(other.vars_),
       groups_(other.groups_) {
 }
@@ -50,7 +53,8 @@ Parameter::Parameter(Parameter&& other)
       err_d_(-1.0),
       range_u_(std::numeric_limits<double>::max()),
       range_d_(std::numeric_limits<double>::lowest()),
-      frozen_(false) {
+      frozen_(false),
+      vars_dirty_(false) {
   swap(*this, other);
 }
 
@@ -0,0 +1,108 @@
+#include "CombineHarvester/CombineTools/interface/ParameterSampler.h"
+#include <algorithm>
+#include <cmath>
+#include <random>
+#include <stdexcept>
+#include <string>
+#include <vector>
+#include "TMatrixDSym.h"
+#include "RooRealVar.h"
+#include "CombineHarvester/CombineTools/interface/Logging.h"
+#include "CombineHarvester/CombineTools/interface/Parallel.h"
+
+namespace ch {
+
+namespace {
+// The number of toys generated with each random number engine
+const unsigned kBlockSize = 64;
+}
+
+ParameterSampler::ParameterSampler(RooFitResult const& fit, std::uint64_t seed)
+    : seed_(seed), n_calls_(0) {
+  PROFILE_FUNCTION();
+  RooArgList const& pars = fit.floatParsFinal();
+  unsigned n = pars.getSize();
+  names_.resize(n);
+  means_.resize(n);
+  min_.resize(n);
+  max_.resize(n);
+  for (unsigned i = 0; i < n; ++i) {
+    RooRealVar const* var = dynamic_cast<RooRealVar const*>(pars.at(i));
+    if (!var) {
+      throw std::runtime_error(
+          FNERROR("Floating parameter " + std::string(pars.at(i)->GetName()) +
+                  " is not a RooRealVar"));
+    }
+    names_[i] = var->GetName();
+    means_[i] = var->getVal();
+    min_[i] = var->getMin();
+    max_[i] = var->getMax();
+  }
+  TMatrixDSym const& cov = fit.covarianceMatrix();
+  if (unsigned(cov.GetNrows()) != n) {
+    throw std::runtime_error(
+        FNERROR("Covariance matrix does not match the floating parameters"));
+  }
+
+  // Cholesky-Banachiewicz decomposition, row by row
+  chol_.assign(std::size_t(n) * (n + 1) / 2, 0.);
+  for (unsigned i = 0; i < n; ++i) {
+    double * row_i = &(chol_[std::size_t(i) * (i + 1) / 2]);
+    for (unsigned j = 0; j <= i; ++j) {
+      double const* row_j = &(chol_[std::size_t(j) * (j + 1) / 2]);
+      double sum = cov(i, j);
+      for (unsigned k = 0; k < j; ++k) sum -= row_i[k] * row_j[k];
+      if (i == j) {
+        if (!(sum > 0.)) {
+          throw std::runtime_error(
+              FNERROR("Covariance matrix is not positive definite at "
+                      "parameter " + names_[i]));
+        }
+        row_i[i] = std::sqrt(sum);
+      } else {
+        row_i[j] = sum / row_j[j];
+      }
+    }
+  }
+}
+
+std::vector<double> ParameterSampler::Generate(unsigned n_toys,
+                                               unsigned n_threads) {
+  std::vector<double> result(std::size_t(n_toys) * names_.size());
+  Generate(n_toys, result.data(), n_threads);
+  return result;
+}
+
+void ParameterSampler::Generate(unsigned n_toys, double * out,
+                                unsigned n_threads) {
+  PROFILE_FUNCTION();
+  unsigned n_blocks = (n_toys + kBlockSize - 1) / kBlockSize;
+  std::uint64_t call = n_calls_++;
+  std::size_t n_pars = names_.size();
+  ParallelFor(n_blocks, n_threads, [&](std::size_t b) {
+    unsigned first = b * kBlockSize;
+    unsigned n = std::min(kBlockSize, n_toys - first);
+    GenerateBlock((call << 32) | b, n, out + first * n_pars);
+  });
+}
+
+void ParameterSampler::GenerateBlock(std::uint64_t block, unsigned n_toys,
+                                     double * out) const {
+  std::seed_seq seq{std::uint32_t(seed_), std::uint32_t(seed_ >> 32),
+                    std::uint32_t(block), std::uint32_t(block >> 32)};
+  std::mt19937_64 engine(seq);
+  std::normal_distribution<double> gaus;
+  std::size_t n_pars = names_.size();
+  std::vector<double> z(n_pars);
+  for (unsigned t = 0; t < n_toys; ++t) {
+    for (std::size_t i = 0; i < n_pars; ++i) z[i] = gaus(engine);
+    double * x = out + t * n_pars;
+    for (std::size_t i = 0; i < n_pars; ++i) {
+      double const* row_i = &(chol_[i * (i + 1) / 2]);
+      double sum = 0.;
+      for (std::size_t k = 0; k <= i; ++k) sum += row_i[k] * z[k];
+      x[i] = std::min(std::max(means_[i] + sum, min_[i]), max_[i]);
+    }
+  }
+}
+}
@@ -1,7 +1,9 @@
 #include "CombineHarvester/CombineTools/interface/ParseCombineWorkspace.h"
 #include "HiggsAnalysis/CombinedLimit/interface/CMSHistErrorPropagator.h"
 #include <iostream>
+#include <map>
 #include <string>
+#include <utility>
 #include <vector>
 #include "RooWorkspace.h"
 #include "RooSimultaneous.h"
@@ -37,13 +39,9 @@ void ParseCombineWorkspace(CombineHarvester& cb, RooWorkspace& ws,
 
   std::vector<std::string> cats;
 
-  struct ProcInfo {
-    std::string bin;
-    std::string proc;
-    std::string pdf;
-    std::string norm;
-  };
-  std::map<std::string, std::vector<ProcInfo>> proc_infos;
+  // The (pdf, norm) object names for each (bin, process)
+  std::map<std::pair<std::string, std::string>,
+           std::pair<std::string, std::string>> pdf_names;
 
   RooAbsData *data = ws.data(data_name.c_str());
   // Hard-coded the category as "CMS_channel". Could deduce instead...
@@ -104,8 +102,8 @@ void ParseCombineWorkspace(CombineHarvester& cb, RooWorkspace& ws,
         proc.set_process(jpdf->getStringAttribute("combine.process"));
         proc.set_rate(1.);
         proc.set_signal(jcoeff->getAttribute("combine.signal"));
-        proc_infos[proc.bin()].push_back(
-            {proc.bin(), proc.process(), jpdf->GetName(), jcoeff->GetName()});
+        pdf_names[std::make_pair(proc.bin(), proc.process())] =
+            std::make_pair(jpdf->GetName(), jcoeff->GetName());
         cb.InsertProcess(proc);
       }
       if (delete_pdfs) delete pdfs;
@@ -113,16 +111,9 @@ void ParseCombineWorkspace(CombineHarvester& cb, RooWorkspace& ws,
   }
   cb.AddWorkspace(ws);
   cb.ExtractData(ws.GetName(), "$BIN");
-  // This loop is slow if we have have a lot of procs
-  // Better way would be to filter to each bin, then do all the procs for that
-  // bin
-  for (auto b : cb.bin_set()) {
-    auto cb_bin = cb.cp().bin({b});
-      for (auto const& pinfo: proc_infos[b]) {
-        cb_bin.cp().process({pinfo.proc}).ExtractPdfs(
-            cb, ws.GetName(), pinfo.pdf, pinfo.norm);
-      }
-  }
+  // Attach all the pdfs and norms in one pass, rather than filtering cb for
+  // every (bin, process) pair
+  cb.ExtractPdfsByName(cb, ws.GetName(), pdf_names);
 }
 
 RooAbsReal* FindAddPdf(RooAbsReal* input) {
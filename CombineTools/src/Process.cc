@@ -1,6 +1,8 @@
 #include "CombineHarvester/CombineTools/interface/Process.h"
 #include <iostream>
+#include <mutex>
 #include <string>
+#include "TDirectory.h"
 #include "boost/format.hpp"
 #include "CombineHarvester/CombineTools/interface/Logging.h"
 
@@ -18,7 +20,7 @@ Process::Process()
   }
 
 Process::~Process() {
-  if (cached_int_) delete cached_int_;
+  delete cached_int_.load();
 }
 
 void swap(Process& first, Process& second) {
@@ -30,7 +32,22 @@ void swap(Process& first, Process& second) {
   swap(first.data_, second.data_);
   swap(first.norm_, second.norm_);
   swap(first.cached_obs_, second.cached_obs_);
-  swap(first.cached_int_, second.cached_int_);
+  first.cached_int_ = second.cached_int_.exchange(first.cached_int_);
+}
+
+RooAbsReal* Process::PdfIntegral() const {
+  RooAbsReal* integral = cached_int_.load(std::memory_order_acquire);
+  if (integral) return integral;
+  // Creating the integral also registers it with the pdf, which may be shared
+  // with other processes, so only one thread at a time may do this
+  static std::mutex mutex;
+  std::lock_guard<std::mutex> lock(mutex);
+  integral = cached_int_.load(std::memory_order_relaxed);
+  if (!integral) {
+    integral = pdf_->createIntegral(RooArgSet(*cached_obs_));
+    cached_int_.store(integral, std::memory_order_release);
+  }
+  return integral;
 }
 
 Process::Process(Process const& other)
@@ -97,6 +114,8 @@ void Process::set_shape(TH1 const& shape, bool set_rate) {
 
 std::unique_ptr<TH1> Process::ClonedShape() const {
   if (!shape_) return std::unique_ptr<TH1>();
+  // Clone without registering the copy in gDirectory
+  TDirectory::TContext no_dir(nullptr);
   std::unique_ptr<TH1> res(static_cast<TH1 *>(shape_->Clone()));
   res->SetDirectory(0);
   return res;
@@ -114,6 +133,7 @@ TH1F Process::ShapeAsTH1F() const {
     throw std::runtime_error(
         FNERROR("Process object does not contain a shape"));
   }
+  TDirectory::TContext no_dir(nullptr);
   TH1F res;
   if (this->shape()) {
     // Need to get the shape as a concrete type (TH1F or TH1D)
@@ -1,6 +1,8 @@
 #include "CombineHarvester/CombineTools/interface/Systematic.h"
 #include <iostream>
+#include "TDirectory.h"
 #include "boost/format.hpp"
+#include "CombineHarvester/CombineTools/interface/HistogramPool.h"
 #include "CombineHarvester/CombineTools/interface/Logging.h"
 
 namespace ch {
@@ -44,21 +46,10 @@ Systematic::Systematic(Systematic const& other)
       value_d_(other.value_d_),
       scale_(other.scale_),
       asymm_(other.asymm_),
+      shape_u_(other.shape_u_),
+      shape_d_(other.shape_d_),
       data_u_(other.data_u_),
-      data_d_(other.data_d_) {
-  TH1 *h_u = nullptr;
-  if (other.shape_u_) {
-    h_u = dynamic_cast<TH1*>(other.shape_u_->Clone());
-    h_u->SetDirectory(0);
-  }
-  shape_u_ = std::unique_ptr<TH1>(h_u);
-  TH1 *h_d = nullptr;
-  if (other.shape_d_) {
-    h_d = dynamic_cast<TH1*>(other.shape_d_->Clone());
-    h_d->SetDirectory(0);
-  }
-  shape_d_ = std::unique_ptr<TH1>(h_d);
-}
+      data_d_(other.data_d_) {}
 
 Systematic::Systematic(Systematic&& other)
     : Object(),
@@ -115,18 +106,21 @@ void Systematic::set_shapes(std::unique_ptr<TH1> shape_u,
   //   }
   // }
 
-  shape_u_ = std::move(shape_u);
-  shape_d_ = std::move(shape_d);
-  shape_u_->SetDirectory(0);
-  shape_d_->SetDirectory(0);
+  shape_u->SetDirectory(0);
+  shape_d->SetDirectory(0);
 
   if (nominal && nominal->Integral() > 0.) {
-    this->set_value_u(shape_u_->Integral() / nominal->Integral());
-    this->set_value_d(shape_d_->Integral() / nominal->Integral());
+    this->set_value_u(shape_u->Integral() / nominal->Integral());
+    this->set_value_d(shape_d->Integral() / nominal->Integral());
   }
 
-  if (shape_u_->Integral() > 0.) shape_u_->Scale(1. / shape_u_->Integral());
-  if (shape_d_->Integral() > 0.) shape_d_->Scale(1. / shape_d_->Integral());
+  if (shape_u->Integral() > 0.) shape_u->Scale(1. / shape_u->Integral());
+  if (shape_d->Integral() > 0.) shape_d->Scale(1. / shape_d->Integral());
+
+  // The normalised templates are frequently identical between entries, e.g.
+  // across mass points, so only one copy of each is kept
+  shape_u_ = HistogramPool::Instance().Share(std::move(shape_u));
+  shape_d_ = HistogramPool::Instance().Share(std::move(shape_d));
 }
 
 void Systematic::set_shapes(TH1 const& shape_u, TH1 const& shape_d,
@@ -149,6 +143,8 @@ void Systematic::set_data(RooDataHist* data_u, RooDataHist* data_d,
 
 std::unique_ptr<TH1> Systematic::ClonedShapeU() const {
   if (!shape_u_) return std::unique_ptr<TH1>();
+  // Clone without registering the copy in gDirectory
+  TDirectory::TContext no_dir(nullptr);
   std::unique_ptr<TH1> res(static_cast<TH1 *>(shape_u_->Clone()));
   res->SetDirectory(0);
   return res;
@@ -156,12 +152,15 @@ std::unique_ptr<TH1> Systematic::ClonedShapeU() const {
 
 std::unique_ptr<TH1> Systematic::ClonedShapeD() const {
   if (!shape_d_) return std::unique_ptr<TH1>();
+  // Clone without registering the copy in gDirectory
+  TDirectory::TContext no_dir(nullptr);
   std::unique_ptr<TH1> res(static_cast<TH1 *>(shape_d_->Clone()));
   res->SetDirectory(0);
   return res;
 }
 
 TH1F Systematic::ShapeUAsTH1F() const {
+  TDirectory::TContext no_dir(nullptr);
   TH1F res;
   if (this->shape_u()) {
     // Need to get the shape as a concrete type (TH1F or TH1D)
@@ -180,6 +179,7 @@ TH1F Systematic::ShapeUAsTH1F() const {
 }
 
 TH1F Systematic::ShapeDAsTH1F() const {
+  TDirectory::TContext no_dir(nullptr);
   TH1F res;
   if (this->shape_d()) {
     // Need to get the shape as a concrete type (TH1F or TH1D)
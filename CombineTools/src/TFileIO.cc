@@ -1,34 +1,245 @@
 #include "CombineHarvester/CombineTools/interface/TFileIO.h"
+#include <algorithm>
+#include <map>
 #include <memory>
 #include <string>
 #include <vector>
+#include "TClass.h"
 #include "TFile.h"
 #include "TH1.h"
 #include "TDirectory.h"
+#include "TKey.h"
+#include "boost/lexical_cast.hpp"
 #include "CombineHarvester/CombineTools/interface/Logging.h"
 
 namespace ch {
 
+namespace {
+// A key to be read, and the paths under which it was requested
+struct PrefetchRecord {
+  TKey* key;
+  std::vector<std::string> paths;
+};
+
+// A set of records from one file that are read with a single ReadBuffers call
+struct PrefetchBatch {
+  TFile* file;
+  std::vector<PrefetchRecord> records;
+  std::vector<Long64_t> pos;
+  std::vector<int> len;
+  std::unique_ptr<char[]> buffer;
+};
+
+// The location of an object in a file
+struct ObjectPath {
+  TDirectory* dir = nullptr;
+  std::string name;
+  // The cycle selected with a trailing ";N", or 9999 for the highest one
+  short cycle = 9999;
+};
+
+// Split path into its directory, object name and cycle without changing
+// gDirectory. The subdirectory lookups are cached in dirs if it is not null.
+// Returns false if the path is invalid or the directory does not exist.
+bool ResolvePath(TFile* file, std::string const& path,
+                 std::map<std::string, TDirectory*> * dirs, ObjectPath & res) {
+  std::size_t slash = path.rfind('/');
+  std::string name = slash == std::string::npos ? path : path.substr(slash + 1);
+  short cycle = 9999;
+  std::size_t semicolon = name.find(';');
+  if (semicolon != std::string::npos) {
+    try {
+      cycle = boost::lexical_cast<short>(name.substr(semicolon + 1));
+    } catch (boost::bad_lexical_cast &) {
+      return false;
+    }
+    name = name.substr(0, semicolon);
+  }
+  if (name.empty()) return false;
+  TDirectory* dir = file;
+  if (slash != std::string::npos && slash > 0) {
+    std::string dir_path = path.substr(0, slash);
+    if (dirs) {
+      auto it = dirs->find(dir_path);
+      if (it == dirs->end()) {
+        it = dirs->emplace(dir_path,
+                           file->GetDirectory(dir_path.c_str())).first;
+      }
+      dir = it->second;
+    } else {
+      dir = file->GetDirectory(dir_path.c_str());
+    }
+  }
+  if (!dir) return false;
+  res.dir = dir;
+  res.name = name;
+  res.cycle = cycle;
+  return true;
+}
+
+// As with TDirectory::Get, an object held in memory (e.g. one that has not
+// been written yet) takes precedence over the keys, unless a cycle is given
+TObject* FindInMemory(ObjectPath const& loc) {
+  return loc.cycle == 9999 ? loc.dir->FindObject(loc.name.c_str()) : nullptr;
+}
+
+bool IsTH1Key(TKey const* key) {
+  TClass* cl = TClass::GetClass(key->GetClassName());
+  return cl && cl->InheritsFrom(TH1::Class());
+}
+
+void UnpackBatch(PrefetchBatch & batch,
+                 std::map<std::pair<TFile*, std::string>,
+                          std::unique_ptr<TH1>> & hists) {
+  std::size_t offset = 0;
+  for (std::size_t i = 0; i < batch.records.size(); ++i) {
+    PrefetchRecord const& rec = batch.records[i];
+    std::unique_ptr<TObject> obj(
+        rec.key->ReadObjWithBuffer(batch.buffer.get() + offset));
+    offset += batch.len[i];
+    TH1* h = dynamic_cast<TH1*>(obj.get());
+    if (!h) continue;
+    obj.release();
+    h->SetDirectory(0);
+    for (std::size_t p = 1; p < rec.paths.size(); ++p) {
+      std::unique_ptr<TH1> cpy(static_cast<TH1*>(h->Clone()));
+      cpy->SetDirectory(0);
+      hists[std::make_pair(batch.file, rec.paths[p])] = std::move(cpy);
+    }
+    hists[std::make_pair(batch.file, rec.paths[0])] = std::unique_ptr<TH1>(h);
+  }
+  batch.buffer.reset();
+}
+}
+
 std::unique_ptr<TH1> GetClonedTH1(TFile* file, std::string const& path) {
   if (!file) {
     throw std::runtime_error(FNERROR("Supplied ROOT file pointer is null"));
   }
-  TDirectory* backup_dir = gDirectory;
-  file->cd();
-  if (!gDirectory->Get(path.c_str())) {
-    gDirectory = backup_dir;
+  PROFILE_COUNT("GetClonedTH1 histograms read", 1);
+  // Read the key directly instead of going through gDirectory, so that the
+  // object is only read once and no global state is changed
+  ObjectPath loc;
+  TObject* mem_obj = nullptr;
+  TKey* key = nullptr;
+  if (ResolvePath(file, path, nullptr, loc)) {
+    mem_obj = FindInMemory(loc);
+    if (!mem_obj) key = loc.dir->GetKey(loc.name.c_str(), loc.cycle);
+  }
+  if (!mem_obj && !key) {
     throw std::runtime_error(
         FNERROR("TH1 " + path + " not found in " + file->GetName()));
   }
-  std::unique_ptr<TH1> res(
-      dynamic_cast<TH1*>(gDirectory->Get(path.c_str())->Clone()));
+  std::unique_ptr<TH1> res;
+  if (mem_obj) {
+    if (TH1 const* h = dynamic_cast<TH1 const*>(mem_obj)) {
+      res.reset(static_cast<TH1*>(h->Clone()));
+    }
+  } else if (IsTH1Key(key)) {
+    res.reset(dynamic_cast<TH1*>(key->ReadObj()));
+  }
   if (!res) {
-    gDirectory = backup_dir;
     throw std::runtime_error(FNERROR("Object " + path + " in " +
                                      file->GetName() + " is not of type TH1"));
   }
   res->SetDirectory(0);
-  gDirectory = backup_dir;
+  return res;
+}
+
+TH1Prefetcher::TH1Prefetcher(std::size_t batch_bytes)
+    : batch_bytes_(batch_bytes) {}
+
+void TH1Prefetcher::Add(TFile* file, std::string const& path) {
+  queue_.emplace_back(file, path);
+  ++uses_[queue_.back()];
+}
+
+void TH1Prefetcher::Run() {
+  PROFILE_FUNCTION();
+  // Group the queued paths by file and then by key, so that each record is
+  // only read once
+  std::map<TFile*, std::map<TKey*, std::vector<std::string>>> keys;
+  std::map<TFile*, std::map<std::string, TDirectory*>> dirs;
+  for (Key const& q : queue_) {
+    if (!q.first || hists_.count(q)) continue;
+    // Objects in memory are left to ch::GetClonedTH1
+    ObjectPath loc;
+    if (!ResolvePath(q.first, q.second, &(dirs[q.first]), loc) ||
+        FindInMemory(loc)) {
+      continue;
+    }
+    TKey* key = loc.dir->GetKey(loc.name.c_str(), loc.cycle);
+    if (!key || !IsTH1Key(key)) continue;
+    std::vector<std::string> & paths = keys[q.first][key];
+    if (std::find(paths.begin(), paths.end(), q.second) == paths.end()) {
+      paths.push_back(q.second);
+    }
+  }
+  queue_.clear();
+
+  // Split the records of each file, in file order, into batches
+  std::vector<PrefetchBatch> batches;
+  for (auto & file_keys : keys) {
+    std::vector<PrefetchRecord> records;
+    records.reserve(file_keys.second.size());
+    for (auto & key_paths : file_keys.second) {
+      records.push_back({key_paths.first, std::move(key_paths.second)});
+    }
+    std::sort(records.begin(), records.end(),
+              [](PrefetchRecord const& a, PrefetchRecord const& b) {
+                return a.key->GetSeekKey() < b.key->GetSeekKey();
+              });
+    std::size_t bytes = 0;
+    for (PrefetchRecord & rec : records) {
+      std::size_t n = rec.key->GetNbytes();
+      if (batches.empty() || batches.back().file != file_keys.first ||
+          bytes + n > batch_bytes_) {
+        batches.emplace_back();
+        batches.back().file = file_keys.first;
+        bytes = 0;
+      }
+      PrefetchBatch & batch = batches.back();
+      batch.pos.push_back(rec.key->GetSeekKey());
+      batch.len.push_back(rec.key->GetNbytes());
+      batch.records.push_back(std::move(rec));
+      bytes += n;
+    }
+  }
+
+  // Read each batch with a single call and then unpack it. Both steps use
+  // the TFile, so they are done one after the other in this thread.
+  for (PrefetchBatch & batch : batches) {
+    std::size_t total = 0;
+    for (int n : batch.len) total += n;
+    batch.buffer.reset(new char[total]);
+    // ReadBuffers returns true on failure, in which case these histograms
+    // are left to be read individually
+    bool failed = batch.file->ReadBuffers(batch.buffer.get(), batch.pos.data(),
+                                          batch.len.data(),
+                                          int(batch.len.size()));
+    PROFILE_COUNT("TH1Prefetcher bytes read", total);
+    if (!failed) UnpackBatch(batch, hists_);
+    batch.buffer.reset();
+  }
+}
+
+std::unique_ptr<TH1> TH1Prefetcher::GetClonedTH1(
+    TFile* file, std::string const& path) {
+  Key key(file, path);
+  auto it = hists_.find(key);
+  if (it == hists_.end()) return ch::GetClonedTH1(file, path);
+  PROFILE_COUNT("TH1Prefetcher histograms used", 1);
+  auto uses = uses_.find(key);
+  if (uses == uses_.end() || uses->second <= 1) {
+    // Last use, so hand over the histogram itself
+    std::unique_ptr<TH1> res = std::move(it->second);
+    hists_.erase(it);
+    if (uses != uses_.end()) uses_.erase(uses);
+    return res;
+  }
+  --(uses->second);
+  std::unique_ptr<TH1> res(static_cast<TH1*>(it->second->Clone()));
+  res->SetDirectory(0);
   return res;
 }
 }
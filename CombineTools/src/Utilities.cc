@@ -6,12 +6,14 @@
 #include <fstream>
 #include <map>
 #include "boost/format.hpp"
+#include "TDirectory.h"
 #include "RooFitResult.h"
 #include "RooRealVar.h"
 #include "RooDataHist.h"
 #include "RooAbsReal.h"
 #include "RooAbsData.h"
 #include "CombineHarvester/CombineTools/interface/CombineHarvester.h"
+#include "CombineHarvester/CombineTools/interface/NamePattern.h"
 
 namespace ch {
 
@@ -76,21 +78,20 @@ std::vector<ch::Parameter> ExtractSampledFitParameters(
 // Property matching & editing
 // ---------------------------------------------------------------------------
 void SetStandardBinNames(CombineHarvester& cb, std::string const& pattern) {
+  NamePattern name_pattern(pattern);
+  NamePattern::Values vals;
+  std::string name;
   cb.ForEachObj([&](ch::Object* obj) {
-    ch::SetStandardBinName(obj, pattern);
+    vals.SetObject(*obj);
+    name_pattern.Render(vals, name);
+    obj->set_bin(name);
   });
 }
 
 void SetStandardBinName(ch::Object* obj, std::string pattern) {
-  boost::replace_all(pattern, "$BINID",
-                     boost::lexical_cast<std::string>(obj->bin_id()));
-  boost::replace_all(pattern, "$BIN", obj->bin());
-  boost::replace_all(pattern, "$PROCESS", obj->process());
-  boost::replace_all(pattern, "$MASS", obj->mass());
-  boost::replace_all(pattern, "$ERA", obj->era());
-  boost::replace_all(pattern, "$CHANNEL", obj->channel());
-  boost::replace_all(pattern, "$ANALYSIS", obj->analysis());
-  obj->set_bin(pattern);
+  NamePattern::Values vals;
+  vals.SetObject(*obj);
+  obj->set_bin(NamePattern(pattern).Render(vals));
 }
 
 void SetFromBinName(ch::Object *input, std::string parse_rules) {
@@ -168,7 +169,7 @@ RooDataHist TH1F2Data(TH1F const& hist, RooRealVar const& x,
 }
 
 TH1F RebinHist(TH1F const& hist) {
-  TH1::AddDirectory(0);
+  TDirectory::TContext no_dir(nullptr);
   TH1F shape("tmp", "tmp", hist.GetNbinsX(), 0.,
              static_cast<float>(hist.GetNbinsX()));
   for (int i = 1; i <= hist.GetNbinsX(); ++i) {
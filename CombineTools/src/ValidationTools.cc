@@ -5,6 +5,7 @@
 #include <string>
 #include <fstream>
 #include <map>
+#include <tuple>
 #include "boost/format.hpp"
 #include "RooFitResult.h"
 #include "RooRealVar.h"
@@ -12,6 +13,8 @@
 #include "RooAbsReal.h"
 #include "RooAbsData.h"
 #include "CombineHarvester/CombineTools/interface/CombineHarvester.h"
+#include "CombineHarvester/CombineTools/interface/Parallel.h"
+#include "CombineHarvester/CombineTools/interface/ContentHash.h"
 
 namespace ch {
 using json = nlohmann::json;
@@ -295,25 +298,396 @@ void CheckSmallSignals(CombineHarvester& cb, double minSigFrac, json& jsobj){
 
 void ValidateCards(CombineHarvester& cb, std::string const& filename, double maxNormEff, double minSigFrac){
  json output_js; 
- bool is_shape_card=1;
- cb.ForEachProc([&](ch::Process *proc){
-   if(proc->pdf()||!(proc->shape())){
-     is_shape_card=0;
-    }
- });
- if(is_shape_card){     
-   ValidateShapeUncertaintyDirection(cb, output_js);      
-   CheckSizeOfShapeEffect(cb, output_js);
-   ValidateShapeTemplates(cb,output_js);
-   CheckEmptyBins(cb,output_js);
- } else {
-   std::cout<<"Not a shape-based datacard / shape-based datacard using RooDataHist. Skipping checks on systematic shapes."<<std::endl;
- }
- CheckEmptyShapes(cb, output_js);      
- CheckNormEff(cb, maxNormEff, output_js);
- CheckSmallSignals(cb,minSigFrac, output_js);
+ ValidationEngine()
+     .SetMaxNormEff(maxNormEff)
+     .SetMinSigFrac(minSigFrac)
+     .Run(cb, output_js);
  std::ofstream outfile(filename);
  outfile <<std::setw(4)<<output_js<<std::endl;
 }
 
+void ValidateCardsIncremental(CombineHarvester& cb, std::string const& filename, double maxNormEff, double minSigFrac, std::string const& cache_file){
+ json output_js;
+ json diff;
+ ValidationEngine()
+     .SetMaxNormEff(maxNormEff)
+     .SetMinSigFrac(minSigFrac)
+     .SetCacheFile(cache_file)
+     .Run(cb, output_js, &diff);
+ std::ofstream outfile(filename);
+ outfile <<std::setw(4)<<output_js<<std::endl;
+ std::cout<<"Incremental validation: "<<diff["systs"]["reused"]<<" systematics unchanged, "
+   <<diff["systs"]["new"]<<" new, "<<diff["systs"]["changed"]<<" changed, "<<diff["systs"]["removed"]<<" removed; "
+   <<diff["procs"]["new"]<<" new, "<<diff["procs"]["changed"]<<" changed and "<<diff["procs"]["removed"]<<" removed processes"<<std::endl;
+ for (auto const& path : diff["added"]) std::cout<<"  + "<<path.get<std::string>()<<std::endl;
+ for (auto const& path : diff["resolved"]) std::cout<<"  - "<<path.get<std::string>()<<std::endl;
+}
+
+namespace {
+// The properties compared by ch::MatchingProcess, usable as a map key
+typedef std::tuple<std::string, std::string, bool, std::string, std::string,
+                   std::string, int, std::string> ProcKey;
+
+template <class T>
+ProcKey MakeProcKey(T const& obj) {
+  return ProcKey(obj.bin(), obj.process(), obj.signal(), obj.analysis(),
+                 obj.era(), obj.channel(), obj.bin_id(), obj.mass());
+}
+
+// A string identifying an object in the cache file. This has to include
+// everything that can distinguish two entries, the attributes too.
+std::string CacheKey(ch::Object const& obj) {
+  std::string key =
+      obj.bin() + "|" + obj.process() + "|" + (obj.signal() ? "1" : "0") +
+      "|" + obj.analysis() + "|" + obj.era() + "|" + obj.channel() + "|" +
+      std::to_string(obj.bin_id()) + "|" + obj.mass();
+  for (auto const& it : obj.all_attributes()) {
+    key += "|" + it.first + "=" + it.second;
+  }
+  return key;
+}
+
+void HashObject(ContentHash& hash, ch::Object const& obj) {
+  hash.Add(obj.bin()).Add(obj.process()).Add(obj.signal()).Add(obj.analysis())
+      .Add(obj.era()).Add(obj.channel()).Add(obj.bin_id()).Add(obj.mass());
+  for (auto const& it : obj.all_attributes()) hash.Add(it.first).Add(it.second);
+}
+
+// Collects a "/"-separated path for each finding in a report. An object
+// holding only plain values (e.g. {"value_u": .., "value_d": ..}) counts as
+// a single finding, as does each entry of an array.
+void FlattenReport(json const& js, std::string const& path,
+                   std::set<std::string>& paths) {
+  if (js.is_array()) {
+    for (auto const& val : js) {
+      paths.insert(path + "/" + (val.is_string() ? val.get<std::string>() : val.dump()));
+    }
+  } else if (js.is_object()) {
+    bool is_leaf = true;
+    for (auto it = js.begin(); it != js.end(); ++it) {
+      if (it.value().is_structured()) is_leaf = false;
+    }
+    if (is_leaf && !path.empty()) {
+      paths.insert(path);
+      return;
+    }
+    for (auto it = js.begin(); it != js.end(); ++it) {
+      FlattenReport(it.value(), path.empty() ? it.key() : path + "/" + it.key(), paths);
+    }
+  } else {
+    paths.insert(path);
+  }
+}
+
+// Counts the keys of `current` that are new, changed and unchanged with
+// respect to `previous`, and the keys of `previous` that were removed
+json CompareHashes(std::map<std::string, std::string> const& current,
+                   json const& previous) {
+  unsigned n_new = 0, n_changed = 0, n_same = 0, n_removed = 0;
+  for (auto const& it : current) {
+    auto prev = previous.find(it.first);
+    if (prev == previous.end()) {
+      ++n_new;
+    } else if ((prev->is_object() ? prev->at("hash") : *prev) != it.second) {
+      ++n_changed;
+    } else {
+      ++n_same;
+    }
+  }
+  for (auto it = previous.begin(); it != previous.end(); ++it) {
+    if (!current.count(it.key())) ++n_removed;
+  }
+  return {{"new", n_new}, {"changed", n_changed}, {"reused", n_same}, {"removed", n_removed}};
+}
+}
+
+ValidationEngine::ValidationEngine()
+    : n_threads_(DefaultNumThreads()),
+      max_norm_eff_(0.1),
+      min_sig_frac_(0.001) {}
+
+std::vector<std::pair<std::string, ValidationEngine::SystCheck>>
+ValidationEngine::BuiltinSystChecks(bool shape_checks) const {
+  std::vector<std::pair<std::string, SystCheck>> checks;
+  double max_norm_eff = max_norm_eff_;
+  if (shape_checks) {
+    checks.push_back(std::make_pair("uncertVarySameDirect",
+        [](SystInput const& in, json& res) {
+      ch::Systematic const* sys = in.sys;
+      if(sys->type()=="shape" && ( (sys->value_u() > 1. && sys->value_d() > 1.) || (sys->value_u() < 1. && sys->value_d() < 1.))){
+        res={{"value_u",sys->value_u()},{"value_d",sys->value_d()}};
+        return true;
+      }
+      return false;
+    }));
+    checks.push_back(std::make_pair("smallShapeEff",
+        [](SystInput const& in, json& res) {
+      double diff_lim=0.001;
+      ch::Systematic const* sys = in.sys;
+      const TH1* hist_u = sys->shape_u();
+      const TH1* hist_d = sys->shape_d();
+      if(sys->type()!="shape" || !hist_u || !hist_d || !in.nominal) return false;
+      std::vector<double> const& hist_nom = *(in.nominal);
+      double up_diff=0;
+      double down_diff=0;
+      for(int i=1;i<=hist_u->GetNbinsX();i++){
+        double nom = unsigned(i) <= hist_nom.size() ? hist_nom[i-1] : 0.;
+        if(fabs(hist_u->GetBinContent(i))+fabs(nom)>0){
+          up_diff+=2*double(fabs(hist_u->GetBinContent(i)-nom))/(fabs(hist_u->GetBinContent(i))+fabs(nom));
+        }
+        if(fabs(hist_d->GetBinContent(i))+fabs(nom)>0){
+          down_diff+=2*double(fabs(hist_d->GetBinContent(i)-nom))/(fabs(hist_d->GetBinContent(i))+fabs(nom));
+        }
+      }
+      if(up_diff<diff_lim && down_diff<diff_lim){
+        res={{"diff_u",up_diff},{"diff_d",down_diff}};
+        return true;
+      }
+      return false;
+    }));
+    checks.push_back(std::make_pair("uncertTemplSame",
+        [](SystInput const& in, json& res) {
+      ch::Systematic const* sys = in.sys;
+      const TH1* hist_u = sys->shape_u();
+      const TH1* hist_d = sys->shape_d();
+      if(sys->type()!="shape" || fabs(sys->value_u() - sys->value_d()) >= 0.0000001 || !hist_u || !hist_d) return false;
+      for(int i=1;i<=hist_u->GetNbinsX();i++){
+        if(fabs(hist_u->GetBinContent(i))+fabs(hist_d->GetBinContent(i))>0){
+          if(2*double(fabs(hist_u->GetBinContent(i)-hist_d->GetBinContent(i)))/(fabs(hist_u->GetBinContent(i))+fabs(hist_d->GetBinContent(i)))>0.001) return false;
+        }
+      }
+      res={{"value_u",sys->value_u()},{"value_d",sys->value_d()}};
+      return true;
+    }));
+  }
+  checks.push_back(std::make_pair("emptySystematicShape",
+      [](SystInput const& in, json& res) {
+    ch::Systematic const* sys = in.sys;
+    if(!in.proc_empty && sys->type()=="shape" && (sys->value_u()==0. || sys->value_d()==0.)){
+      res={{"value_u",sys->value_u()},{"value_d",sys->value_d()}};
+      return true;
+    }
+    return false;
+  }));
+  checks.push_back(std::make_pair("largeNormEff",
+      [max_norm_eff](SystInput const& in, json& res) {
+    ch::Systematic const* sys = in.sys;
+    if(!in.proc_empty && ((sys->type()=="shape" &&  (std::abs(sys->value_u()-1) > max_norm_eff || std::abs(sys->value_d()-1)>max_norm_eff)) || (sys->type()=="lnN" && (std::abs(sys->value_u()-1) > max_norm_eff) ))){
+      res={{"value_u",sys->value_u()},{"value_d",sys->value_d()}};
+      return true;
+    }
+    return false;
+  }));
+  return checks;
+}
+
+void ValidationEngine::Run(CombineHarvester& cb, json& jsobj, json* diff) const {
+  std::vector<ch::Process*> procs;
+  std::vector<ch::Systematic*> systs;
+  cb.ForEachProc([&](ch::Process *proc){ procs.push_back(proc); });
+  cb.ForEachSyst([&](ch::Systematic *sys){ systs.push_back(sys); });
+
+  bool is_shape_card=1;
+  for (auto proc : procs) {
+    if(proc->pdf()||!(proc->shape())) is_shape_card=0;
+  }
+  if (!is_shape_card) {
+    std::cout<<"Not a shape-based datacard / shape-based datacard using RooDataHist. Skipping checks on systematic shapes."<<std::endl;
+  }
+
+  auto checks = BuiltinSystChecks(is_shape_card);
+  checks.insert(checks.end(), checks_.begin(), checks_.end());
+  std::map<std::string, unsigned> check_index;
+  for (unsigned c = 0; c < checks.size(); ++c) check_index[checks[c].first] = c;
+
+  // Cached findings are only valid if they were produced with the same
+  // settings and the same set of checks
+  bool use_cache = !cache_file_.empty();
+  json cache = json::object();
+  std::string settings_hash;
+  bool reuse_findings = false;
+  if (use_cache) {
+    ContentHash hash;
+    hash.Add(is_shape_card).Add(max_norm_eff_).Add(min_sig_frac_);
+    for (auto const& check : checks) hash.Add(check.first);
+    settings_hash = hash.Hex();
+    std::ifstream infile(cache_file_);
+    if (infile.good()) {
+      try {
+        infile >> cache;
+      } catch (std::exception const& e) {
+        std::cout<<"Unable to read validation cache file "<<cache_file_<<", it will be rebuilt"<<std::endl;
+        cache = json::object();
+      }
+    }
+    if (!cache.is_object()) cache = json::object();
+    for (std::string key : {"procs", "systs", "report"}) {
+      if (!cache.count(key) || !cache[key].is_object()) cache[key] = json::object();
+    }
+    reuse_findings = cache.count("settings") && cache["settings"] == settings_hash;
+  }
+  json const& cached_systs = use_cache ? cache["systs"] : cache;
+
+  // Single pass through the processes: note the empty ones, sum up the
+  // nominal templates per (bin, process) and the background template and
+  // signal yields per bin. Negative bins are clipped as in GetShape().
+  std::set<ProcKey> empty_procs;
+  std::map<std::pair<std::string, std::string>, std::vector<double>> nominals;
+  std::map<std::string, std::vector<double>> bkg_totals;
+  std::map<std::string, double> sig_totals;
+  std::map<std::string, std::map<std::string, double>> sig_rates;
+  std::map<std::string, std::string> proc_hashes;
+  for (auto proc : procs) {
+    double rate = proc->rate();
+    if (use_cache) {
+      ContentHash hash;
+      HashObject(hash, *proc);
+      hash.Add(rate).Add(proc->shape());
+      proc_hashes[CacheKey(*proc)] = hash.Hex();
+    }
+    if (rate == 0.) {
+      empty_procs.insert(MakeProcKey(*proc));
+      jsobj["emptyProcessShape"][proc->bin()].push_back(proc->process());
+    }
+    if (proc->signal()) {
+      sig_totals[proc->bin()] += rate;
+      sig_rates[proc->bin()][proc->process()] += rate;
+    }
+    if (!is_shape_card) continue;
+    TH1 const* h = proc->shape();
+    unsigned nbins = h->GetNbinsX();
+    std::vector<double> & nom =
+        nominals[std::make_pair(proc->bin(), proc->process())];
+    if (nom.size() < nbins) nom.resize(nbins, 0.);
+    std::vector<double> * bkg = nullptr;
+    if (!proc->signal()) {
+      bkg = &(bkg_totals[proc->bin()]);
+      if (bkg->size() < nbins) bkg->resize(nbins, 0.);
+    }
+    for (unsigned b = 0; b < nbins; ++b) {
+      double val = std::max(h->GetBinContent(b + 1), 0.) * rate;
+      nom[b] += val;
+      if (bkg) (*bkg)[b] += val;
+    }
+  }
+  std::map<std::pair<std::string, std::string>, std::string> nominal_hashes;
+  for (auto & it : nominals) {
+    double integral = 0.;
+    for (double val : it.second) integral += val;
+    if (integral > 0.) {
+      for (double & val : it.second) val /= integral;
+    }
+    if (use_cache) nominal_hashes[it.first] = ContentHash().Add(it.second).Hex();
+  }
+
+  // Visit each Systematic once, running every check on it. Results are
+  // stored per Systematic so they can be merged in order afterwards. With a
+  // cache, a Systematic whose inputs are unchanged takes its stored results.
+  std::vector<std::vector<std::pair<unsigned, json>>> findings(systs.size());
+  std::vector<std::string> syst_keys(use_cache ? systs.size() : 0);
+  std::vector<std::string> syst_hashes(use_cache ? systs.size() : 0);
+  ParallelFor(systs.size(), n_threads_, [&](std::size_t i) {
+    SystInput input;
+    input.sys = systs[i];
+    input.proc_empty = empty_procs.count(MakeProcKey(*systs[i]));
+    auto nom_key = std::make_pair(systs[i]->bin(), systs[i]->process());
+    auto it = nominals.find(nom_key);
+    input.nominal = it != nominals.end() ? &(it->second) : nullptr;
+    if (use_cache) {
+      ch::Systematic const* sys = systs[i];
+      ContentHash hash;
+      HashObject(hash, *sys);
+      hash.Add(sys->name()).Add(sys->type()).Add(sys->value_u())
+          .Add(sys->value_d()).Add(sys->scale()).Add(sys->asymm())
+          .Add(sys->shape_u()).Add(sys->shape_d()).Add(input.proc_empty);
+      auto nom_hash = nominal_hashes.find(nom_key);
+      hash.Add(nom_hash != nominal_hashes.end() ? nom_hash->second : "");
+      syst_keys[i] = CacheKey(*sys) + "|" + sys->name();
+      syst_hashes[i] = hash.Hex();
+      auto cached = cached_systs.find(syst_keys[i]);
+      if (reuse_findings && cached != cached_systs.end() &&
+          cached->at("hash") == syst_hashes[i]) {
+        for (auto const& res : cached->at("findings")) {
+          auto idx = check_index.find(res.at(0).get<std::string>());
+          if (idx != check_index.end()) {
+            findings[i].push_back(std::make_pair(idx->second, res.at(1)));
+          }
+        }
+        return;
+      }
+    }
+    for (unsigned c = 0; c < checks.size(); ++c) {
+      json res;
+      if (checks[c].second(input, res)) {
+        findings[i].push_back(std::make_pair(c, std::move(res)));
+      }
+    }
+  });
+  for (unsigned i = 0; i < systs.size(); ++i) {
+    ch::Systematic const* sys = systs[i];
+    for (auto const& res : findings[i]) {
+      jsobj[checks[res.first].first][sys->name()][sys->bin()][sys->process()] = res.second;
+    }
+  }
+
+  if (is_shape_card) {
+    for (auto const& it : bkg_totals) {
+      for (unsigned b = 0; b < it.second.size(); ++b) {
+        if (it.second[b] <= 0) jsobj["emptyBkgBin"][it.first].push_back(b + 1);
+      }
+    }
+  }
+
+  for (auto const& it : sig_rates) {
+    double sigrate = sig_totals[it.first];
+    for (auto const& p : it.second) {
+      if (p.second < min_sig_frac_*sigrate) {
+        jsobj["smallSignalProc"][it.first][p.first]={{"sigrate_tot",sigrate},{"procrate",p.second}};
+      }
+    }
+  }
+
+  if (!use_cache) return;
+
+  std::map<std::string, std::string> syst_hash_map;
+  json new_systs = json::object();
+  for (unsigned i = 0; i < systs.size(); ++i) {
+    syst_hash_map[syst_keys[i]] = syst_hashes[i];
+    json stored = json::array();
+    for (auto const& res : findings[i]) {
+      stored.push_back({checks[res.first].first, res.second});
+    }
+    new_systs[syst_keys[i]] = {{"hash", syst_hashes[i]}, {"findings", stored}};
+  }
+
+  if (diff) {
+    *diff = json::object();
+    (*diff)["procs"] = CompareHashes(proc_hashes, cache["procs"]);
+    (*diff)["systs"] = CompareHashes(syst_hash_map, cache["systs"]);
+    if (!reuse_findings) (*diff)["systs"]["reused"] = 0;
+    std::set<std::string> old_paths;
+    std::set<std::string> new_paths;
+    FlattenReport(cache["report"], "", old_paths);
+    FlattenReport(jsobj, "", new_paths);
+    (*diff)["added"] = json::array();
+    (*diff)["resolved"] = json::array();
+    for (auto const& path : new_paths) {
+      if (!old_paths.count(path)) (*diff)["added"].push_back(path);
+    }
+    for (auto const& path : old_paths) {
+      if (!new_paths.count(path)) (*diff)["resolved"].push_back(path);
+    }
+  }
+
+  json new_cache = {{"settings", settings_hash},
+                    {"procs", proc_hashes},
+                    {"systs", new_systs},
+                    {"report", jsobj}};
+  std::ofstream outfile(cache_file_);
+  if (!outfile.good()) {
+    throw std::runtime_error(FNERROR("Unable to write validation cache file " + cache_file_));
+  }
+  outfile << new_cache << std::endl;
+}
+
 }
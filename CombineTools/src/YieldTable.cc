@@ -0,0 +1,80 @@
+#include "CombineHarvester/CombineTools/interface/YieldTable.h"
+#include <stdexcept>
+#include <string>
+#include <vector>
+#include "boost/lexical_cast.hpp"
+#include "CombineHarvester/CombineTools/interface/Logging.h"
+
+namespace ch {
+
+YieldTable::YieldTable(CombineHarvester & cb) : cb_(cb) {}
+
+YieldTable& YieldTable::AddRow(std::string const& label,
+                               Selector const& selector) {
+  row_labels_.push_back(label);
+  rows_.push_back(selector);
+  return *this;
+}
+
+YieldTable& YieldTable::AddRow(std::string const& label,
+                               std::vector<std::string> const& processes) {
+  return AddRow(label, [processes](CombineHarvester & cb) {
+    cb.process(processes);
+  });
+}
+
+YieldTable& YieldTable::AddColumn(std::string const& label,
+                                  Selector const& selector) {
+  col_labels_.push_back(label);
+  cols_.push_back(selector);
+  return *this;
+}
+
+YieldTable& YieldTable::Evaluate(RooFitResult const* fit, unsigned n_samples,
+                                 unsigned n_threads) {
+  PROFILE_FUNCTION();
+  std::vector<CombineHarvester> cells;
+  cells.reserve(rows_.size() * cols_.size());
+  for (unsigned r = 0; r < rows_.size(); ++r) {
+    for (unsigned c = 0; c < cols_.size(); ++c) {
+      cells.push_back(cb_.cp());
+      cols_[c](cells.back());
+      rows_[r](cells.back());
+    }
+  }
+  rates_.assign(cells.size(), 0.);
+  errors_.assign(cells.size(), 0.);
+  if (fit) {
+    auto res = cb_.GetRatesWithUncertainty(cells, *fit, n_samples, n_threads);
+    for (unsigned i = 0; i < cells.size(); ++i) {
+      rates_[i] = res[i].first;
+      errors_[i] = res[i].second;
+    }
+  } else {
+    for (unsigned i = 0; i < cells.size(); ++i) {
+      rates_[i] = cells[i].GetRate();
+      errors_[i] = cells[i].GetUncertainty();
+    }
+  }
+  return *this;
+}
+
+std::size_t YieldTable::CellIndex(unsigned row, unsigned col) const {
+  std::size_t idx = std::size_t(row) * cols_.size() + col;
+  if (row >= rows_.size() || col >= cols_.size() || idx >= rates_.size()) {
+    throw std::runtime_error(
+        FNERROR("Cell (" + boost::lexical_cast<std::string>(row) + "," +
+                boost::lexical_cast<std::string>(col) +
+                ") is not defined or Evaluate() has not been called"));
+  }
+  return idx;
+}
+
+double YieldTable::Rate(unsigned row, unsigned col) const {
+  return rates_[CellIndex(row, col)];
+}
+
+double YieldTable::Uncertainty(unsigned row, unsigned col) const {
+  return errors_[CellIndex(row, col)];
+}
+}